@@ -0,0 +1,36 @@
+#version 430 core
+
+layout(location = 0) in vec2 in_pos;    /* Local space                        */
+layout(location = 1) in vec2 in_txd_pos;
+layout(location = 2) in uint in_object_id; /* Index of the object, see        */
+                                        /* 'VA_OBJECT_ID_ATTRIB'              */
+
+/* 'stVaObjectData'                      */
+struct stObjectData
+{
+    vec2 pos;
+    vec2 size;
+    int layer;
+    int unit;
+};
+
+layout(std430, binding = 0) readonly buffer ObjectData
+{
+    stObjectData objects[];
+};
+
+uniform mat4 uf_projection;
+
+out vec2 vs_out_txd_pos;
+flat out int vs_out_txd_layer;
+flat out int vs_out_txd_unit;
+
+void main()
+{
+    stObjectData data = objects[in_object_id];
+
+    gl_Position = uf_projection * vec4(data.pos + in_pos * data.size, 0.0, 1.0);
+    vs_out_txd_pos = in_txd_pos;
+    vs_out_txd_layer = data.layer;
+    vs_out_txd_unit = data.unit;
+}
@@ -0,0 +1,17 @@
+#version 430 core
+
+out vec4 fs_out_color;
+
+in vec2 vs_out_txd_pos;
+flat in float vs_out_txd_layer;
+flat in uint vs_out_txd_unit;
+
+/* 'TU_MAX_UNITS' samplers set to units 0, 1, ... The unit is the same for all
+   instances of a draw, as GLSL requires for indexing sampler arrays */
+uniform sampler2DArray uf_txd_units[16];
+
+void main()
+{
+    fs_out_color = texture(uf_txd_units[vs_out_txd_unit],
+        vec3(vs_out_txd_pos, vs_out_txd_layer));
+}
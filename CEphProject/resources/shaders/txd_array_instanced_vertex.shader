@@ -0,0 +1,31 @@
+#version 430 core
+
+layout(location = 0) in vec2 in_pos;    /* Corner of the unit quad            */
+
+/* Per instance                          */
+layout(location = 1) in vec4 in_model_pos_size; /* xy - position, zw - size   */
+layout(location = 2) in vec4 in_txd_rect;       /* xy - position, zw - size   */
+layout(location = 3) in uint in_txd_layer;
+layout(location = 4) in uvec2 in_txd_unit_flags; /* x - unit, y - flags       */
+
+uniform mat4 uf_projection;
+
+out vec2 vs_out_txd_pos;
+flat out float vs_out_txd_layer;
+flat out uint vs_out_txd_unit;
+
+void main()
+{
+    vec2 pos = in_model_pos_size.xy + in_pos * in_model_pos_size.zw;
+    gl_Position = uf_projection * vec4(pos, 0.0, 1.0);
+
+    /* The texture top is at the greater v, rotated textures have their top
+       along the left edge of the placed area */
+    vec2 corner = vec2(in_pos.x, 1.0 - in_pos.y);
+    if ((in_txd_unit_flags.y & 1u) != 0u)
+        corner = vec2(in_pos.y, in_pos.x);
+    vs_out_txd_pos = in_txd_rect.xy + corner * in_txd_rect.zw;
+
+    vs_out_txd_layer = float(in_txd_layer);
+    vs_out_txd_unit = in_txd_unit_flags.x;
+}
@@ -0,0 +1,514 @@
+/**-----------------------------------------------------------------------------
+; @file asset_pack.c
+;
+; @brief
+;   The file implements the functionality of the 'asset_pack' module.
+;
+;   ap - asset pack
+;
+; @date   October 2021
+; @author Eph
+;
+-----------------------------------------------------------------------------**/
+
+
+
+/** @includes ----------------------------------------------------------------*/
+#include <stdio.h>  /* fopen_s, fwrite, snprintf */
+#include <string.h> /* memcmp, strlen */
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <dirent.h>   /* opendir */
+#include <sys/stat.h> /* stat */
+#include <unistd.h>   /* access */
+#endif
+
+#include "asset_pack.h"
+#include "mapped_file.h"
+#include "memory.h"
+#include "../containers/list.h"
+#include "../log.h"
+
+
+
+/** @types -------------------------------------------------------------------*/
+
+#define PACK_MAGIC      "EPAK"
+#define PACK_VERSION    1
+
+typedef struct
+{
+    char magic[4];                      /* 'PACK_MAGIC', not null-terminated  */
+    unsigned int version;               /* 'PACK_VERSION'                     */
+    unsigned int files_count;
+    unsigned int slots_count;           /* Power of two                       */
+}stPackHeader;
+
+
+/* Directory slot */
+typedef struct
+{
+    unsigned long long hash;            /* Hash of the path, 0 - empty slot   */
+    unsigned long long offset;          /* Contents of the file               */
+    unsigned long long size;
+    unsigned long long name_offset;     /* Path of the file                   */
+    unsigned int name_length;
+    unsigned int reserved;
+}stPackSlot;
+
+
+
+/** @static_data -------------------------------------------------------------*/
+static stMappedFile* _pack_file = NULL;
+static const unsigned char* _pack_data = NULL;
+static size_t _pack_size = 0;
+static const stPackSlot* _slots = NULL;
+static unsigned int _slots_count = 0;
+
+
+
+/** @internal_prototypes -----------------------------------------------------*/
+static int _file_exists(const char* path);
+static unsigned long long _hash_path(const char* path);
+static int _is_same_path(const unsigned char* name, size_t name_length,
+    const char* path);
+static void _collect_files(const char* dir_path, list* out_paths);
+static char* _join_path(const char* dir_path, const char* file_name);
+static int _write_pack(FILE* file, list* paths, int files_count);
+
+
+
+/** @functions ---------------------------------------------------------------*/
+
+/**-----------------------------------------------------------------------------
+; @func ap_open
+;
+; @brief
+;   Maps the pack into memory. Files that are looked up with 'ap_find' are
+;   taken from this pack until 'ap_close' is called.
+;
+; @return
+;   int | 0 on success, -1 if there is no pack at 'pack_path' (nothing is
+;       | logged in this case) or it is invalid.
+;
+-----------------------------------------------------------------------------**/
+int ap_open(const char* pack_path)
+{
+    extern stMappedFile* _pack_file;
+    extern const unsigned char* _pack_data;
+    extern size_t _pack_size;
+    extern const stPackSlot* _slots;
+    extern unsigned int _slots_count;
+
+    ap_close();
+
+    if (!_file_exists(pack_path))
+        return -1;
+
+    stMappedFile* file = mf_open(pack_path);
+    if (NULL == file)
+        return -1;
+
+    const unsigned char* data = mf_get_data(file);
+    size_t size = mf_get_size(file);
+
+    stPackHeader header;
+    if (size < sizeof(header))
+    {
+        LOG_ERROR("Unable to open asset pack [%s]. The file is too small.",
+            pack_path);
+        mf_close(file);
+        return -1;
+    }
+    memcpy(&header, data, sizeof(header));
+
+    /* The directory must be a power of two slots and fit in the file */
+    int is_valid = (0 == memcmp(header.magic, PACK_MAGIC,
+        sizeof(header.magic))) && (PACK_VERSION == header.version) &&
+        (header.slots_count > 0) &&
+        (0 == (header.slots_count & (header.slots_count - 1))) &&
+        (header.files_count < header.slots_count) &&
+        (sizeof(header) + (size_t)header.slots_count * sizeof(stPackSlot) <=
+            size);
+    if (!is_valid)
+    {
+        LOG_ERROR("Unable to open asset pack [%s]. Invalid header.",
+            pack_path);
+        mf_close(file);
+        return -1;
+    }
+
+    _pack_file = file;
+    _pack_data = data;
+    _pack_size = size;
+    _slots = (const stPackSlot*)(data + sizeof(header));
+    _slots_count = header.slots_count;
+    LOG_MSG("Asset pack [%s] with [%u] files is opened.", pack_path,
+        header.files_count);
+    return 0;
+}
+
+
+/**-----------------------------------------------------------------------------
+; @func ap_close
+;
+; @brief
+;   Unmaps the pack. Pointers returned by 'ap_find' become invalid.
+;
+-----------------------------------------------------------------------------**/
+void ap_close(void)
+{
+    extern stMappedFile* _pack_file;
+    extern const unsigned char* _pack_data;
+    extern size_t _pack_size;
+    extern const stPackSlot* _slots;
+    extern unsigned int _slots_count;
+
+    if (NULL == _pack_file)
+        return;
+
+    mf_close(_pack_file);
+    _pack_file = NULL;
+    _pack_data = NULL;
+    _pack_size = 0;
+    _slots = NULL;
+    _slots_count = 0;
+}
+
+
+/**-----------------------------------------------------------------------------
+; @func ap_find
+;
+; @brief
+;   Looks up the file in the open pack.
+;
+; @params
+;   path     | Path of the file as it was packed ('resources/img/a.png').
+;   out_size | [out] Size of the file.
+;
+; @return
+;   Contents of the file inside the pack mapping or NULL if no pack is open
+;   or the file is not in the pack.
+;
+-----------------------------------------------------------------------------**/
+const void* ap_find(const char* path, size_t* out_size)
+{
+    extern const unsigned char* _pack_data;
+    extern size_t _pack_size;
+    extern const stPackSlot* _slots;
+    extern unsigned int _slots_count;
+
+    if (NULL == _slots)
+        return NULL;
+
+    unsigned long long hash = _hash_path(path);
+    unsigned int mask = _slots_count - 1;
+    for (unsigned int i = 0; i < _slots_count; i++)
+    {
+        const stPackSlot* slot = &_slots[(hash + i) & mask];
+        if (0 == slot->hash)
+            return NULL;
+        if (slot->hash != hash)
+            continue;
+
+        /* Corrupted slots are skipped as if the file were not packed */
+        if (slot->name_offset > _pack_size ||
+            slot->name_length > _pack_size - slot->name_offset ||
+            slot->offset > _pack_size ||
+            slot->size > _pack_size - slot->offset)
+        {
+            continue;
+        }
+        if (!_is_same_path(_pack_data + slot->name_offset, slot->name_length,
+            path))
+        {
+            continue;
+        }
+
+        *out_size = (size_t)slot->size;
+        return _pack_data + slot->offset;
+    }
+    return NULL;
+}
+
+
+/**-----------------------------------------------------------------------------
+; @func ap_create
+;
+; @brief
+;   Writes all files of the directory and its subdirectories to a new pack.
+;   The files are packed under their paths starting with 'dir_path', so
+;   packing 'resources' stores 'resources/img/a.png'.
+;
+; @return
+;   int | 0 on success, -1 on failure.
+;
+-----------------------------------------------------------------------------**/
+int ap_create(const char* pack_path, const char* dir_path)
+{
+    list* paths = list_create();
+    _collect_files(dir_path, paths);
+
+    /* The pack itself may be inside the directory */
+    int files_count = 0;
+    for (list_node* node = paths->nodes; node != NULL; )
+    {
+        list_node* next = node->next;
+        if (_is_same_path((const unsigned char*)pack_path, strlen(pack_path),
+            node->data))
+        {
+            m_free(node->data);
+            list_erase(paths, node);
+        }
+        else
+        {
+            files_count++;
+        }
+        node = next;
+    }
+
+    int result = -1;
+    FILE* file = NULL;
+    if (0 != fopen_s(&file, pack_path, "wb"))
+    {
+        LOG_ERROR("Unable to write asset pack [%s].", pack_path);
+    }
+    else
+    {
+        result = _write_pack(file, paths, files_count);
+        fclose(file);
+        if (result != 0)
+        {
+            LOG_ERROR("Unable to write asset pack [%s].", pack_path);
+        }
+        else
+        {
+            LOG_MSG("Asset pack [%s] with [%d] files of [%s] is created.",
+                pack_path, files_count, dir_path);
+        }
+    }
+
+    for (list_node* node = paths->nodes; node != NULL; node = node->next)
+        m_free(node->data);
+    list_destroy(paths);
+    return result;
+}
+
+
+static int _file_exists(const char* path)
+{
+#if defined(_WIN32)
+    return GetFileAttributesA(path) != INVALID_FILE_ATTRIBUTES;
+#else
+    return 0 == access(path, F_OK);
+#endif
+}
+
+
+/* FNV-1a hash of the path with '\' treated as '/'. Never 0, since 0 marks
+   empty slots */
+static unsigned long long _hash_path(const char* path)
+{
+    unsigned long long hash = 14695981039346656037ULL;
+    for (const char* c = path; *c != '\0'; c++)
+    {
+        hash ^= (unsigned char)(('\\' == *c) ? '/' : *c);
+        hash *= 1099511628211ULL;
+    }
+    return (0 == hash) ? 1 : hash;
+}
+
+
+static int _is_same_path(const unsigned char* name, size_t name_length,
+    const char* path)
+{
+    size_t i = 0;
+    for (; i < name_length && path[i] != '\0'; i++)
+    {
+        char a = ('\\' == name[i]) ? '/' : (char)name[i];
+        char b = ('\\' == path[i]) ? '/' : path[i];
+        if (a != b)
+            return 0;
+    }
+    return (i == name_length) && ('\0' == path[i]);
+}
+
+
+/* Pushes the paths of all files of the directory and its subdirectories to
+   'out_paths'. Each path is allocated with 'm_malloc' */
+static void _collect_files(const char* dir_path, list* out_paths)
+{
+#if defined(_WIN32)
+    char pattern[MAX_PATH];
+    snprintf(pattern, sizeof(pattern), "%s/*", dir_path);
+
+    WIN32_FIND_DATAA find_data;
+    HANDLE find = FindFirstFileA(pattern, &find_data);
+    if (INVALID_HANDLE_VALUE == find)
+    {
+        LOG_ERROR("Unable to read directory [%s].", dir_path);
+        return;
+    }
+    do
+    {
+        if (0 == strcmp(find_data.cFileName, ".") ||
+            0 == strcmp(find_data.cFileName, ".."))
+        {
+            continue;
+        }
+        char* path = _join_path(dir_path, find_data.cFileName);
+        if (NULL == path)
+            continue;
+        if (find_data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+        {
+            _collect_files(path, out_paths);
+            m_free(path);
+        }
+        else
+        {
+            list_push(out_paths, path);
+        }
+    } while (FindNextFileA(find, &find_data));
+    FindClose(find);
+#else
+    DIR* dir = opendir(dir_path);
+    if (NULL == dir)
+    {
+        LOG_ERROR("Unable to read directory [%s].", dir_path);
+        return;
+    }
+    for (struct dirent* entry = readdir(dir); entry != NULL;
+        entry = readdir(dir))
+    {
+        if (0 == strcmp(entry->d_name, ".") || 0 == strcmp(entry->d_name, ".."))
+            continue;
+        char* path = _join_path(dir_path, entry->d_name);
+        if (NULL == path)
+            continue;
+
+        struct stat st;
+        if (0 == stat(path, &st) && S_ISDIR(st.st_mode))
+        {
+            _collect_files(path, out_paths);
+            m_free(path);
+        }
+        else if (0 == stat(path, &st) && S_ISREG(st.st_mode))
+        {
+            list_push(out_paths, path);
+        }
+        else
+        {
+            m_free(path);
+        }
+    }
+    closedir(dir);
+#endif
+}
+
+
+static char* _join_path(const char* dir_path, const char* file_name)
+{
+    size_t size = strlen(dir_path) + 1 + strlen(file_name) + 1;
+    char* path = m_malloc(size);
+    if (path != NULL)
+        snprintf(path, size, "%s/%s", dir_path, file_name);
+    return path;
+}
+
+
+static int _write_pack(FILE* file, list* paths, int files_count)
+{
+    /* At most half of the slots are used, so lookups probe few slots */
+    unsigned int slots_count = 16;
+    while (slots_count < (unsigned int)files_count * 2)
+        slots_count *= 2;
+
+    stPackSlot* slots = m_calloc(slots_count, sizeof(stPackSlot));
+    if (NULL == slots)
+        return -1;
+
+    /* Paths follow the directory, contents follow the paths */
+    unsigned long long offset = sizeof(stPackHeader) +
+        (unsigned long long)slots_count * sizeof(stPackSlot);
+    for (list_node* node = paths->nodes; node != NULL; node = node->next)
+        offset += strlen(node->data);
+
+    unsigned long long name_offset = sizeof(stPackHeader) +
+        (unsigned long long)slots_count * sizeof(stPackSlot);
+    int is_written = 1;
+    for (list_node* node = paths->nodes; node != NULL; node = node->next)
+    {
+        stMappedFile* packed_file = mf_open(node->data);
+        if (NULL == packed_file)
+        {
+            is_written = 0;
+            break;
+        }
+
+        unsigned long long hash = _hash_path(node->data);
+        unsigned int i = (unsigned int)(hash & (slots_count - 1));
+        while (slots[i].hash != 0)
+            i = (i + 1) & (slots_count - 1);
+
+        offset = (offset + 15) & ~15ULL;
+        slots[i].hash = hash;
+        slots[i].offset = offset;
+        slots[i].size = mf_get_size(packed_file);
+        slots[i].name_offset = name_offset;
+        slots[i].name_length = (unsigned int)strlen(node->data);
+        offset += slots[i].size;
+        name_offset += slots[i].name_length;
+        mf_close(packed_file);
+    }
+
+    stPackHeader header;
+    memcpy(header.magic, PACK_MAGIC, sizeof(header.magic));
+    header.version = PACK_VERSION;
+    header.files_count = files_count;
+    header.slots_count = slots_count;
+
+    is_written = is_written &&
+        (1 == fwrite(&header, sizeof(header), 1, file)) &&
+        (slots_count == fwrite(slots, sizeof(stPackSlot), slots_count, file));
+
+    /* Paths are stored with '/' separators */
+    for (list_node* node = paths->nodes; node != NULL && is_written;
+        node = node->next)
+    {
+        for (char* c = node->data; *c != '\0'; c++)
+        {
+            if ('\\' == *c)
+                *c = '/';
+        }
+        size_t length = strlen(node->data);
+        is_written = (length == fwrite(node->data, 1, length, file));
+    }
+
+    /* Contents are written in the order of the paths, so their offsets grow
+       as calculated above */
+    static const unsigned char padding[16] = { 0 };
+    long long position = ftell(file);
+    for (list_node* node = paths->nodes; node != NULL && is_written;
+        node = node->next)
+    {
+        size_t padding_size = (size_t)(((position + 15) & ~15LL) - position);
+        is_written = (padding_size == fwrite(padding, 1, padding_size, file));
+
+        stMappedFile* packed_file = mf_open(node->data);
+        if (NULL == packed_file)
+        {
+            is_written = 0;
+            break;
+        }
+        size_t size = mf_get_size(packed_file);
+        if (size > 0)
+            is_written = is_written &&
+                (1 == fwrite(mf_get_data(packed_file), size, 1, file));
+        mf_close(packed_file);
+        position += padding_size + size;
+    }
+
+    m_free(slots);
+    return is_written ? 0 : -1;
+}
@@ -0,0 +1,62 @@
+/**-----------------------------------------------------------------------------
+; @file asset_pack.h
+;
+; @brief
+;   Single file that contains all resource files. The pack is mapped into
+;   memory once, and the image and shader loaders take the contents of
+;   resources straight from the mapping instead of opening loose files.
+;
+; @usage:
+;   - run the program with the '--pack <pack> <directory>' arguments (see
+;     'main') or call 'ap_create' to pack all files of the directory and its
+;     subdirectories;
+;   - open the pack with 'ap_open' before loading resources (the program opens
+;     'AP_DEFAULT_PATH' if it exists);
+;   - load resources by their usual paths ('resources/img/256x256.jpg').
+;     Paths that are not in the pack are loaded from loose files;
+;   - close the pack with 'ap_close' after the resources are released.
+;
+; @notes:
+;   Pack file:
+;     - header: magic, version, number of files, number of directory slots;
+;     - directory: hash table of 'slots_count' (a power of two) slots with
+;       linear probing. A slot keeps the hash, offset and size of the file
+;       and the offset and length of its path;
+;     - paths of the files (not null-terminated);
+;     - contents of the files, each starts at a 16-byte boundary.
+;   Paths are stored with '/' separators, '\' in looked up paths is treated
+;   as '/'. All values are little-endian.
+;
+;   Images decoded from the pack do not reference it, but cooked images (see
+;   'image_cooker.h') point into the mapping, so they must be freed before
+;   the pack is closed.
+;
+; @date   October 2021
+; @author Eph
+;
+-----------------------------------------------------------------------------**/
+
+
+
+#ifndef ASSET_PACK_H
+#define ASSET_PACK_H
+
+
+
+#include <stddef.h> /* size_t */
+
+
+
+#define AP_DEFAULT_PATH "resources.pak"
+
+
+
+int ap_open(const char* pack_path);
+void ap_close(void);
+const void* ap_find(const char* path, size_t* out_size);
+
+int ap_create(const char* pack_path, const char* dir_path);
+
+
+
+#endif /* !ASSET_PACK_H */
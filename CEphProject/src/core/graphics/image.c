@@ -1,23 +1,163 @@
-#define STB_IMAGE_IMPLEMENTATION
+#include <limits.h> /* INT_MAX */
+#include <stdio.h>  /* snprintf */
+#include <string.h> /* memcmp, strcmp */
 
-#include <stb_image.h>
 #include "image.h"
+#include "image_cooker.h"
+#include "../asset_pack.h"
+#include "../mapped_file.h"
 #include "../memory.h"
 #include "../../log.h"
 
+/* Decoded pixels and intermediate buffers of the decoder come from the pool
+   of the 'memory' module, so decoding many images of similar size reuses the
+   same blocks. Files are read by the 'mapped_file' module */
+#define STBI_MALLOC(size)           m_pool_alloc(size)
+#define STBI_REALLOC(ptr, new_size) m_pool_realloc(ptr, new_size)
+#define STBI_FREE(ptr)              m_pool_free(ptr)
+#define STBI_NO_STDIO
+#define STB_IMAGE_IMPLEMENTATION
+
+#include <stb_image.h>
+
+
+
+static int _get_cooked_path(const char* image_path, char* out_path,
+    size_t out_size);
+static stImage* _load_image_from_memory(const void* data, size_t size,
+    const char* name);
+static stImage* _load_cooked_image(const unsigned char* data, size_t size,
+    const char* name);
 
 
+
+/* Loads the cooked copy of the image ('<image_path>.cimg', see
+   'ic_cook_directory') if there is one, the image itself otherwise */
 const stImage* load_image(const char* image_path)
 {
-    /* To flip loaded image on the y-axis */
-    stbi_set_flip_vertically_on_load(1);
+    char cooked_path[1024];
+    if (_get_cooked_path(image_path, cooked_path, sizeof(cooked_path)))
+    {
+        size_t packed_size = 0;
+        if (ap_find(cooked_path, &packed_size) != NULL ||
+            mf_exists(cooked_path))
+        {
+            const stImage* image_ptr = load_source_image(cooked_path);
+            if (image_ptr != NULL)
+                return image_ptr;
+        }
+    }
+    return load_source_image(image_path);
+}
 
-    stImage* image_ptr = m_malloc(sizeof(stImage));
-    // TODO: Use another stbi function to load image bytes into memory using the
-    //       'memory' module.
 
-    image_ptr->data_ptr = stbi_load(
-        image_path,
+/* Maps the file into memory and decodes it from there, so the encoded bytes
+   are not copied through stdio buffers. Cooked images keep the file mapped
+   and use its pixels as they are. Files of the open asset pack are taken
+   from its mapping without opening them. The cooked copy of the image is not
+   looked for */
+const stImage* load_source_image(const char* image_path)
+{
+    size_t packed_size = 0;
+    const void* packed_data = ap_find(image_path, &packed_size);
+    if (packed_data != NULL)
+    {
+        stImage* image_ptr = _load_image_from_memory(packed_data, packed_size,
+            image_path);
+        if (NULL == image_ptr)
+        {
+            LOG_ERROR("Unable to load image [%s].", image_path);
+        }
+        return image_ptr;
+    }
+
+    stMappedFile* file = mf_open(image_path);
+    if (NULL == file)
+    {
+        LOG_ERROR("Unable to load image [%s].", image_path);
+        return NULL;
+    }
+
+    stImage* image_ptr = _load_image_from_memory(mf_get_data(file),
+        mf_get_size(file), image_path);
+    if (image_ptr != NULL && image_ptr->is_cooked)
+        image_ptr->file_ptr = file;
+    else
+        mf_close(file);
+    return image_ptr;
+}
+
+
+/* 'name' is used only in error messages. The pixels of cooked images point
+   into 'data', so it must stay valid until the image is freed */
+const stImage* load_image_from_memory(const void* data, size_t size,
+    const char* name)
+{
+    return _load_image_from_memory(data, size, name);
+}
+
+
+void free_image(const stImage* image_ptr)
+{
+    if (NULL == image_ptr)
+        return;
+
+    if (image_ptr->is_cooked)
+    {
+        mf_close(image_ptr->file_ptr);
+    }
+    else if (image_ptr->data_ptr != NULL)
+    {
+        stbi_image_free(image_ptr->data_ptr);
+    }
+    m_free((void*)image_ptr);
+}
+
+
+/* Returns 0 if the image is already cooked or the path is too long */
+static int _get_cooked_path(const char* image_path, char* out_path,
+    size_t out_size)
+{
+    size_t path_length = strlen(image_path);
+    size_t extension_length = strlen(IC_EXTENSION);
+    if (path_length >= extension_length && 0 == strcmp(image_path +
+        path_length - extension_length, IC_EXTENSION))
+        return 0;
+
+    int length = snprintf(out_path, out_size, "%s%s", image_path,
+        IC_EXTENSION);
+    return length > 0 && (size_t)length < out_size;
+}
+
+
+static stImage* _load_image_from_memory(const void* data, size_t size,
+    const char* name)
+{
+    if (NULL == data || 0 == size || size > INT_MAX)
+    {
+        LOG_ERROR("Unable to load image [%s]. Invalid size [%zu].", name,
+            size);
+        return NULL;
+    }
+
+    if (size >= sizeof(stCookedImageHeader) &&
+        0 == memcmp(data, IC_MAGIC, sizeof(((stCookedImageHeader*)0)->magic)))
+    {
+        return _load_cooked_image(data, size, name);
+    }
+
+    /* Rows are stored from top to bottom. The texture builder flips them
+       while converting pixels, so there is no need for a separate pass over
+       the whole image here */
+    stbi_set_flip_vertically_on_load(0);
+
+    stImage* image_ptr = m_calloc(1, sizeof(stImage));
+    if (NULL == image_ptr)
+        return NULL;
+
+    image_ptr->data_ptr = (char*)stbi_load_from_memory(
+        data,
+        (int)size,
         &image_ptr->width,
         &image_ptr->height,
         &image_ptr->channels_count,
@@ -25,7 +165,8 @@ const stImage* load_image(const char* image_path)
 
     if (NULL == image_ptr->data_ptr)
     {
-        LOG_ERROR("Unable to load image [%s]. %s", image_path, image_ptr->data_ptr);
+        LOG_ERROR("Unable to load image [%s]. %s", name,
+            stbi_failure_reason());
         m_free(image_ptr);
         return NULL;
     }
@@ -33,14 +174,43 @@ const stImage* load_image(const char* image_path)
 }
 
 
-void free_image(const stImage* image_ptr)
+/* Checks the header of the cooked image and points the image to the pixels
+   of its full-size level */
+static stImage* _load_cooked_image(const unsigned char* data, size_t size,
+    const char* name)
 {
-    if (NULL == image_ptr)
-        return;
+    stCookedImageHeader header;
+    memcpy(&header, data, sizeof(header));
 
-    if (image_ptr->data_ptr != NULL)
+    size_t table_size = sizeof(stCookedImageLevel) * header.levels_count;
+    if (header.version != IC_VERSION || header.width == 0 ||
+        header.height == 0 || header.channels_count < 1 ||
+        header.channels_count > 4 || header.levels_count < 1 ||
+        header.levels_count > 32 || sizeof(header) + table_size > size)
     {
-        stbi_image_free(image_ptr->data_ptr);
+        LOG_ERROR("Unable to load cooked image [%s]. Invalid header.", name);
+        return NULL;
     }
-    m_free((void*)image_ptr);
+
+    stCookedImageLevel level;
+    memcpy(&level, data + sizeof(header), sizeof(level));
+    unsigned long long level_size = (unsigned long long)header.width *
+        header.height * header.channels_count;
+    if (level.size != level_size || level.offset > size ||
+        level.size > size - level.offset)
+    {
+        LOG_ERROR("Unable to load cooked image [%s]. The pixels are out of "
+            "the data.", name);
+        return NULL;
+    }
+
+    stImage* image_ptr = m_calloc(1, sizeof(stImage));
+    if (NULL == image_ptr)
+        return NULL;
+    image_ptr->data_ptr = (char*)(data + level.offset);
+    image_ptr->width = header.width;
+    image_ptr->height = header.height;
+    image_ptr->channels_count = header.channels_count;
+    image_ptr->is_cooked = 1;
+    return image_ptr;
 }
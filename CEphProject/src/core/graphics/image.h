@@ -3,17 +3,29 @@
 
 
 
+#include <stddef.h> /* size_t */
+
+
+
+/* Decoded image. Rows are stored from top to bottom. Cooked images (see
+   'image_cooker.h') are not decoded: their pixels point into the cooked data
+   and rows are stored from bottom to top */
 typedef struct
 {
     char* data_ptr;
     int width;
     int height;
     int channels_count;
+    int is_cooked;
+    void* file_ptr;                     /* Mapped file of the cooked pixels   */
 }stImage;
 
 
 
 const stImage* load_image(const char* image_path);
+const stImage* load_source_image(const char* image_path);
+const stImage* load_image_from_memory(const void* data, size_t size,
+    const char* name);
 void free_image(const stImage* image_ptr);
 
 
@@ -0,0 +1,329 @@
+/**-----------------------------------------------------------------------------
+; @file image_cooker.c
+;
+; @brief
+;   The file implements the functionality of the 'image_cooker' module.
+;
+;   ic - image cooker
+;
+; @date   October 2021
+; @author Eph
+;
+-----------------------------------------------------------------------------**/
+
+
+
+/** @includes ----------------------------------------------------------------*/
+#include <ctype.h>  /* tolower */
+#include <stdio.h>  /* fopen_s, fwrite */
+#include <string.h> /* memcpy, strrchr */
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <dirent.h> /* opendir */
+#endif
+
+#include "image_cooker.h"
+#include "image.h"
+#include "../memory.h"
+#include "../../log.h"
+
+
+
+/** @internal_prototypes -----------------------------------------------------*/
+static int _is_source_image(const char* file_name);
+static int _cook_file(const char* dir_path, const char* file_name,
+    int with_mips);
+static unsigned char* _flip_rows(const stImage* image);
+static unsigned char* _make_next_level(const unsigned char* src, int w,
+    int h, int channels_count);
+static int _write_levels(const char* dst_path, unsigned char** levels,
+    int levels_count, int width, int height, int channels_count);
+
+
+
+/** @functions ---------------------------------------------------------------*/
+
+/**-----------------------------------------------------------------------------
+; @func ic_cook_image
+;
+; @brief
+;   Decodes the source image and writes it as a cooked image.
+;
+; @params
+;   src_path  | Path to the source image.
+;   dst_path  | Path to the cooked image to write.
+;   with_mips | 1 to store all mip levels, 0 to store only the full image.
+;
+; @return
+;   int | 0 on success, -1 on failure.
+;
+-----------------------------------------------------------------------------**/
+int ic_cook_image(const char* src_path, const char* dst_path, int with_mips)
+{
+    const stImage* image = load_source_image(src_path);
+    if (NULL == image)
+        return -1;
+    if (image->is_cooked)
+    {
+        LOG_ERROR("Unable to cook image [%s]. The image is already cooked.",
+            src_path);
+        free_image(image);
+        return -1;
+    }
+
+    unsigned char* levels[32] = { NULL };
+    int levels_count = 0;
+    int result = -1;
+
+    levels[levels_count++] = _flip_rows(image);
+    if (levels[0] != NULL)
+    {
+        int w = image->width;
+        int h = image->height;
+        while (with_mips && (w > 1 || h > 1))
+        {
+            unsigned char* level = _make_next_level(levels[levels_count - 1],
+                w, h, image->channels_count);
+            if (NULL == level)
+                break;
+            levels[levels_count++] = level;
+            w = (w > 1) ? w / 2 : 1;
+            h = (h > 1) ? h / 2 : 1;
+        }
+        result = _write_levels(dst_path, levels, levels_count, image->width,
+            image->height, image->channels_count);
+    }
+
+    for (int i = 0; i < levels_count; i++)
+        m_free(levels[i]);
+    free_image(image);
+    return result;
+}
+
+
+/**-----------------------------------------------------------------------------
+; @func ic_cook_directory
+;
+; @brief
+;   Cooks all source images of the directory (not recursively). The cooked
+;   image is written next to the source one, 'IC_EXTENSION' is appended to
+;   the name of the source ('x.png' -> 'x.png.cimg'), so sources differing
+;   only in the extension do not overwrite each other.
+;
+; @return
+;   int | Number of images that could not be cooked, -1 if the directory
+;       | cannot be read.
+;
+-----------------------------------------------------------------------------**/
+int ic_cook_directory(const char* dir_path, int with_mips)
+{
+    int failed_count = 0;
+    int cooked_count = 0;
+
+#if defined(_WIN32)
+    char pattern[MAX_PATH];
+    snprintf(pattern, sizeof(pattern), "%s\\*", dir_path);
+
+    WIN32_FIND_DATAA find_data;
+    HANDLE find = FindFirstFileA(pattern, &find_data);
+    if (INVALID_HANDLE_VALUE == find)
+    {
+        LOG_ERROR("Unable to read directory [%s].", dir_path);
+        return -1;
+    }
+    do
+    {
+        if (find_data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+            continue;
+        if (!_is_source_image(find_data.cFileName))
+            continue;
+        if (_cook_file(dir_path, find_data.cFileName, with_mips) != 0)
+            failed_count++;
+        else
+            cooked_count++;
+    } while (FindNextFileA(find, &find_data));
+    FindClose(find);
+#else
+    DIR* dir = opendir(dir_path);
+    if (NULL == dir)
+    {
+        LOG_ERROR("Unable to read directory [%s].", dir_path);
+        return -1;
+    }
+    for (struct dirent* entry = readdir(dir); entry != NULL;
+        entry = readdir(dir))
+    {
+        if (!_is_source_image(entry->d_name))
+            continue;
+        if (_cook_file(dir_path, entry->d_name, with_mips) != 0)
+            failed_count++;
+        else
+            cooked_count++;
+    }
+    closedir(dir);
+#endif
+
+    LOG_MSG("Image cooker: [%d] images of [%s] cooked, [%d] failed.",
+        cooked_count, dir_path, failed_count);
+    return failed_count;
+}
+
+
+static int _is_source_image(const char* file_name)
+{
+    static const char* extensions[] = { ".png", ".jpg", ".jpeg", ".bmp",
+        ".tga" };
+
+    const char* extension = strrchr(file_name, '.');
+    if (NULL == extension)
+        return 0;
+
+    for (size_t i = 0; i < sizeof(extensions) / sizeof(extensions[0]); i++)
+    {
+        /* Case-insensitive comparison */
+        size_t c = 0;
+        while (extension[c] != '\0' &&
+            tolower((unsigned char)extension[c]) == extensions[i][c])
+        {
+            c++;
+        }
+        if ('\0' == extension[c] && '\0' == extensions[i][c])
+            return 1;
+    }
+    return 0;
+}
+
+
+static int _cook_file(const char* dir_path, const char* file_name,
+    int with_mips)
+{
+    char src_path[1024];
+    char dst_path[1024];
+
+    int src_length = snprintf(src_path, sizeof(src_path), "%s/%s", dir_path,
+        file_name);
+    int dst_length = snprintf(dst_path, sizeof(dst_path), "%s%s", src_path,
+        IC_EXTENSION);
+    if (src_length >= (int)sizeof(src_path) ||
+        dst_length >= (int)sizeof(dst_path))
+    {
+        LOG_ERROR("Unable to cook image [%s]. The path is too long.",
+            file_name);
+        return -1;
+    }
+    return ic_cook_image(src_path, dst_path, with_mips);
+}
+
+
+/* Returns tightly packed pixels of the image with rows from bottom to top */
+static unsigned char* _flip_rows(const stImage* image)
+{
+    size_t row_size = (size_t)image->width * image->channels_count;
+    unsigned char* pixels = m_malloc(row_size * image->height);
+    if (NULL == pixels)
+        return NULL;
+
+    for (int row = 0; row < image->height; row++)
+    {
+        memcpy(pixels + row * row_size,
+            image->data_ptr + (size_t)(image->height - 1 - row) * row_size,
+            row_size);
+    }
+    return pixels;
+}
+
+
+/* Averages 2x2 blocks of pixels. The last row or column of odd sizes is
+   averaged with itself */
+static unsigned char* _make_next_level(const unsigned char* src, int w,
+    int h, int channels_count)
+{
+    int next_w = (w > 1) ? w / 2 : 1;
+    int next_h = (h > 1) ? h / 2 : 1;
+    unsigned char* dst = m_malloc((size_t)next_w * next_h * channels_count);
+    if (NULL == dst)
+        return NULL;
+
+    for (int y = 0; y < next_h; y++)
+    {
+        int y0 = 2 * y;
+        int y1 = (y0 + 1 < h) ? y0 + 1 : y0;
+        for (int x = 0; x < next_w; x++)
+        {
+            int x0 = 2 * x;
+            int x1 = (x0 + 1 < w) ? x0 + 1 : x0;
+            for (int c = 0; c < channels_count; c++)
+            {
+                int sum =
+                    src[((size_t)y0 * w + x0) * channels_count + c] +
+                    src[((size_t)y0 * w + x1) * channels_count + c] +
+                    src[((size_t)y1 * w + x0) * channels_count + c] +
+                    src[((size_t)y1 * w + x1) * channels_count + c];
+                dst[((size_t)y * next_w + x) * channels_count + c] =
+                    (unsigned char)((sum + 2) / 4);
+            }
+        }
+    }
+    return dst;
+}
+
+
+static int _write_levels(const char* dst_path, unsigned char** levels,
+    int levels_count, int width, int height, int channels_count)
+{
+    FILE* file = NULL;
+    if (0 != fopen_s(&file, dst_path, "wb"))
+    {
+        LOG_ERROR("Unable to write cooked image [%s].", dst_path);
+        return -1;
+    }
+
+    stCookedImageHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, IC_MAGIC, sizeof(header.magic));
+    header.version = IC_VERSION;
+    header.width = width;
+    header.height = height;
+    header.channels_count = channels_count;
+    header.levels_count = levels_count;
+
+    /* Lay out the levels after the level table */
+    stCookedImageLevel table[32];
+    unsigned long long offset = sizeof(header) +
+        sizeof(stCookedImageLevel) * levels_count;
+    for (int i = 0; i < levels_count; i++)
+    {
+        int w = (width >> i) > 0 ? (width >> i) : 1;
+        int h = (height >> i) > 0 ? (height >> i) : 1;
+        offset = (offset + 15) & ~15ULL;
+        table[i].offset = offset;
+        table[i].size = (unsigned long long)w * h * channels_count;
+        offset += table[i].size;
+    }
+
+    int is_written =
+        (1 == fwrite(&header, sizeof(header), 1, file)) &&
+        ((size_t)levels_count == fwrite(table, sizeof(stCookedImageLevel),
+            levels_count, file));
+
+    static const unsigned char padding[16] = { 0 };
+    long long position = sizeof(header) +
+        sizeof(stCookedImageLevel) * levels_count;
+    for (int i = 0; i < levels_count && is_written; i++)
+    {
+        size_t padding_size = (size_t)(table[i].offset - position);
+        is_written =
+            (padding_size == fwrite(padding, 1, padding_size, file)) &&
+            (1 == fwrite(levels[i], (size_t)table[i].size, 1, file));
+        position = table[i].offset + table[i].size;
+    }
+
+    fclose(file);
+    if (!is_written)
+    {
+        LOG_ERROR("Unable to write cooked image [%s].", dst_path);
+        return -1;
+    }
+    return 0;
+}
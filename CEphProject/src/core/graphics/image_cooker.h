@@ -0,0 +1,72 @@
+/**-----------------------------------------------------------------------------
+; @file image_cooker.h
+;
+; @brief
+;   Offline converter of images (PNG, JPG, BMP, TGA) to cooked images: raw
+;   pixels that 'load_image' uses straight from the mapped file without
+;   decoding them.
+;
+; @usage:
+;   - run the program with the '--cook <directory> [--mips]' arguments (see
+;     'main') to cook all images of the directory, or call
+;     'ic_cook_directory'/'ic_cook_image';
+;   - keep passing the path of the source image to the texture builder:
+;     'load_image' uses the cooked image next to it (the source path with
+;     '.cimg' appended) when there is one.
+;
+; @notes:
+;   Cooked image file:
+;     - 'stCookedImageHeader';
+;     - 'levels_count' x 'stCookedImageLevel', level 0 is the full image,
+;       each next level is half the size of the previous one (at least 1);
+;     - pixels of the levels, each level starts at a 16-byte boundary.
+;   Pixels have 'channels_count' bytes (gray, gray + alpha, RGB or RGBA),
+;   rows are tightly packed and go from the bottom of the image to its top, as
+;   OpenGL expects. All values are little-endian.
+;
+; @date   October 2021
+; @author Eph
+;
+-----------------------------------------------------------------------------**/
+
+
+
+#ifndef IMAGE_COOKER_H
+#define IMAGE_COOKER_H
+
+
+
+#define IC_MAGIC        "CIMG"
+#define IC_VERSION      1
+#define IC_EXTENSION    ".cimg"
+
+
+
+/** @types -------------------------------------------------------------------*/
+
+typedef struct
+{
+    char magic[4];                      /* 'IC_MAGIC', not null-terminated    */
+    unsigned int version;               /* 'IC_VERSION'                       */
+    unsigned int width;
+    unsigned int height;
+    unsigned int channels_count;        /* 1..4 bytes per pixel               */
+    unsigned int levels_count;          /* Mip levels, at least 1             */
+    unsigned int reserved[2];
+}stCookedImageHeader;
+
+
+typedef struct
+{
+    unsigned long long offset;          /* From the beginning of the file     */
+    unsigned long long size;            /* Bytes                              */
+}stCookedImageLevel;
+
+
+
+int ic_cook_image(const char* src_path, const char* dst_path, int with_mips);
+int ic_cook_directory(const char* dir_path, int with_mips);
+
+
+
+#endif /* !IMAGE_COOKER_H */
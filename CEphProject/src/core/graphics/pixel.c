@@ -0,0 +1,515 @@
+/**-----------------------------------------------------------------------------
+; @file pixel.c
+;
+; @brief
+;   The file implements the functionality of the 'pixel' module.
+;
+;   px - pixel
+;
+; @date   October 2021
+; @author Eph
+;
+-----------------------------------------------------------------------------**/
+
+
+
+/** @includes ----------------------------------------------------------------*/
+#include <string.h> /* memcpy */
+
+#include "pixel.h"
+#include "../../log.h"
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#define PX_X86
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define PX_AVX2_TARGET
+#else
+#define PX_AVX2_TARGET __attribute__((target("avx2")))
+#endif
+#endif /* x86 */
+
+
+
+/** @static_data -------------------------------------------------------------*/
+static int _simd_level = -1;            /* -1 - not detected yet              */
+
+
+
+/** @internal_prototypes -----------------------------------------------------*/
+static int _detect_simd_level(void);
+static int _get_level(void);
+static unsigned char _mul_div_255(unsigned int c, unsigned int a);
+
+
+
+/** @functions ---------------------------------------------------------------*/
+
+int px_get_simd_level(void)
+{
+    return _get_level();
+}
+
+
+/**-----------------------------------------------------------------------------
+; @func px_set_simd_level
+;
+; @brief
+;   Forces the kernels to use the 'level' implementation ('PX_SIMD_*'). Levels
+;   not supported by the CPU are clamped to the supported one. Used to compare
+;   implementations.
+;
+-----------------------------------------------------------------------------**/
+void px_set_simd_level(int level)
+{
+    int supported = _detect_simd_level();
+    if (level < PX_SIMD_SCALAR)
+        level = PX_SIMD_SCALAR;
+    _simd_level = (level > supported) ? supported : level;
+}
+
+
+/**-----------------------------------------------------------------------------
+; @func px_flip_rows
+;
+; @brief
+;   Flips the image on the y-axis in place.
+;
+; @params
+;   pixels      | Image pixels.
+;   row_size    | Size (in bytes) of one image row.
+;   rows_count  | Number of image rows.
+;
+-----------------------------------------------------------------------------**/
+void px_flip_rows(unsigned char* pixels, int row_size, int rows_count)
+{
+    int level = _get_level();
+
+    for (int y = 0; y < rows_count / 2; y++)
+    {
+        unsigned char* a = pixels + (size_t)y * row_size;
+        unsigned char* b = pixels + (size_t)(rows_count - 1 - y) * row_size;
+        int i = 0;
+
+#ifdef PX_X86
+        if (level >= PX_SIMD_SSE2)
+        {
+            for (; i + 16 <= row_size; i += 16)
+            {
+                __m128i va = _mm_loadu_si128((const __m128i*)(a + i));
+                __m128i vb = _mm_loadu_si128((const __m128i*)(b + i));
+                _mm_storeu_si128((__m128i*)(a + i), vb);
+                _mm_storeu_si128((__m128i*)(b + i), va);
+            }
+        }
+#endif /* PX_X86 */
+
+        for (; i < row_size; i++)
+        {
+            unsigned char tmp = a[i];
+            a[i] = b[i];
+            b[i] = tmp;
+        }
+    }
+}
+
+
+#ifdef PX_X86
+PX_AVX2_TARGET
+static int _expand_rgb_to_rgba_avx2(unsigned char* dst,
+    const unsigned char* src, int pixels_count)
+{
+    const __m256i shuffle = _mm256_setr_epi8(
+        0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1,
+        0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+    const __m256i alpha = _mm256_set1_epi32((int)0xFF000000);
+    int i = 0;
+
+    /* 8 pixels per iteration. 28 source bytes are read, so at least 10 pixels
+       must be left */
+    for (; i + 10 <= pixels_count; i += 8)
+    {
+        const unsigned char* s = src + (size_t)i * 3;
+        __m256i v = _mm256_inserti128_si256(
+            _mm256_castsi128_si256(_mm_loadu_si128((const __m128i*)s)),
+            _mm_loadu_si128((const __m128i*)(s + 12)), 1);
+        v = _mm256_or_si256(_mm256_shuffle_epi8(v, shuffle), alpha);
+        _mm256_storeu_si256((__m256i*)(dst + (size_t)i * 4), v);
+    }
+    return i;
+}
+#endif /* PX_X86 */
+
+
+/**-----------------------------------------------------------------------------
+; @func px_expand_rgb_to_rgba
+;
+; @brief
+;   Converts 3-byte RGB pixels to 4-byte RGBA pixels with an opaque alpha.
+;   'dst' and 'src' must not overlap.
+;
+-----------------------------------------------------------------------------**/
+void px_expand_rgb_to_rgba(unsigned char* dst, const unsigned char* src,
+    int pixels_count)
+{
+    int level = _get_level();
+    int i = 0;
+
+#ifdef PX_X86
+    if (level >= PX_SIMD_AVX2)
+    {
+        i = _expand_rgb_to_rgba_avx2(dst, src, pixels_count);
+    }
+    if (level >= PX_SIMD_SSE2)
+    {
+        const __m128i alpha = _mm_set1_epi32((int)0xFF000000);
+
+        /* 4 pixels per iteration. Each pixel is read as a 4-byte word, so at
+           least 5 pixels must be left */
+        for (; i + 5 <= pixels_count; i += 4)
+        {
+            const unsigned char* s = src + (size_t)i * 3;
+            int p[4];
+            memcpy(&p[0], s + 0, 4);
+            memcpy(&p[1], s + 3, 4);
+            memcpy(&p[2], s + 6, 4);
+            memcpy(&p[3], s + 9, 4);
+            __m128i v = _mm_setr_epi32(p[0], p[1], p[2], p[3]);
+            v = _mm_or_si128(_mm_and_si128(v, _mm_set1_epi32(0x00FFFFFF)), alpha);
+            _mm_storeu_si128((__m128i*)(dst + (size_t)i * 4), v);
+        }
+    }
+#endif /* PX_X86 */
+
+    for (; i < pixels_count; i++)
+    {
+        dst[i * 4 + 0] = src[i * 3 + 0];
+        dst[i * 4 + 1] = src[i * 3 + 1];
+        dst[i * 4 + 2] = src[i * 3 + 2];
+        dst[i * 4 + 3] = 0xFF;
+    }
+}
+
+
+#ifdef PX_X86
+PX_AVX2_TARGET
+static int _premultiply_rgba_avx2(unsigned char* pixels, int pixels_count)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i color_mask = _mm256_set_epi16(
+        0, -1, -1, -1, 0, -1, -1, -1, 0, -1, -1, -1, 0, -1, -1, -1);
+    const __m256i alpha_lanes = _mm256_set_epi16(
+        255, 0, 0, 0, 255, 0, 0, 0, 255, 0, 0, 0, 255, 0, 0, 0);
+    const __m256i round = _mm256_set1_epi16(128);
+
+    int i = 0;
+    for (; i + 8 <= pixels_count; i += 8)
+    {
+        __m256i* p = (__m256i*)(pixels + (size_t)i * 4);
+        __m256i v = _mm256_loadu_si256(p);
+        __m256i half[2] = {
+            _mm256_unpacklo_epi8(v, zero),
+            _mm256_unpackhi_epi8(v, zero) };
+
+        for (int h = 0; h < 2; h++)
+        {
+            /* (a, a, a, 255) multipliers for each pixel */
+            __m256i a = _mm256_shufflehi_epi16(
+                _mm256_shufflelo_epi16(half[h], 0xFF), 0xFF);
+            a = _mm256_or_si256(_mm256_and_si256(a, color_mask), alpha_lanes);
+
+            /* round(c * a / 255) */
+            __m256i t = _mm256_add_epi16(_mm256_mullo_epi16(half[h], a), round);
+            half[h] = _mm256_srli_epi16(
+                _mm256_add_epi16(t, _mm256_srli_epi16(t, 8)), 8);
+        }
+        _mm256_storeu_si256(p, _mm256_packus_epi16(half[0], half[1]));
+    }
+    return i;
+}
+#endif /* PX_X86 */
+
+
+/**-----------------------------------------------------------------------------
+; @func px_premultiply_rgba
+;
+; @brief
+;   Multiplies the color channels of 4-byte RGBA pixels by their alpha in
+;   place. Such textures must be blended with the (GL_ONE,
+;   GL_ONE_MINUS_SRC_ALPHA) blend function.
+;
+-----------------------------------------------------------------------------**/
+void px_premultiply_rgba(unsigned char* pixels, int pixels_count)
+{
+    int level = _get_level();
+    int i = 0;
+
+#ifdef PX_X86
+    if (level >= PX_SIMD_AVX2)
+    {
+        i = _premultiply_rgba_avx2(pixels, pixels_count);
+    }
+    if (level >= PX_SIMD_SSE2)
+    {
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i color_mask = _mm_set_epi16(0, -1, -1, -1, 0, -1, -1, -1);
+        const __m128i alpha_lanes = _mm_set_epi16(255, 0, 0, 0, 255, 0, 0, 0);
+        const __m128i round = _mm_set1_epi16(128);
+
+        for (; i + 4 <= pixels_count; i += 4)
+        {
+            __m128i* p = (__m128i*)(pixels + (size_t)i * 4);
+            __m128i v = _mm_loadu_si128(p);
+            __m128i half[2] = {
+                _mm_unpacklo_epi8(v, zero),
+                _mm_unpackhi_epi8(v, zero) };
+
+            for (int h = 0; h < 2; h++)
+            {
+                /* (a, a, a, 255) multipliers for each pixel */
+                __m128i a = _mm_shufflehi_epi16(
+                    _mm_shufflelo_epi16(half[h], 0xFF), 0xFF);
+                a = _mm_or_si128(_mm_and_si128(a, color_mask), alpha_lanes);
+
+                /* round(c * a / 255) */
+                __m128i t = _mm_add_epi16(_mm_mullo_epi16(half[h], a), round);
+                half[h] = _mm_srli_epi16(
+                    _mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8);
+            }
+            _mm_storeu_si128(p, _mm_packus_epi16(half[0], half[1]));
+        }
+    }
+#endif /* PX_X86 */
+
+    for (; i < pixels_count; i++)
+    {
+        unsigned char* p = pixels + (size_t)i * 4;
+        p[0] = _mul_div_255(p[0], p[3]);
+        p[1] = _mul_div_255(p[1], p[3]);
+        p[2] = _mul_div_255(p[2], p[3]);
+    }
+}
+
+
+/**-----------------------------------------------------------------------------
+; @func px_copy_rect
+;
+; @brief
+;   Copies 'rows_count' rows of 'row_size' bytes. Strides may be negative, so
+;   a sub-rectangle can be copied and flipped on the y-axis in one pass by
+;   pointing 'src' to its last row and passing a negative 'src_stride'.
+;
+;   Rows are copied with 'memcpy', which is already vectorized by the C
+;   runtime.
+;
+-----------------------------------------------------------------------------**/
+void px_copy_rect(unsigned char* dst, long long dst_stride,
+    const unsigned char* src, long long src_stride, int row_size,
+    int rows_count)
+{
+    for (int y = 0; y < rows_count; y++)
+    {
+        memcpy(dst, src, row_size);
+        dst += dst_stride;
+        src += src_stride;
+    }
+}
+
+
+static int _detect_simd_level(void)
+{
+#ifdef PX_X86
+    static int res = -1;
+    if (res != -1)
+        return res;
+
+    res = PX_SIMD_SSE2;
+
+#if defined(_MSC_VER)
+    int info[4] = { 0 };
+    __cpuid(info, 0);
+    if (info[0] >= 7)
+    {
+        __cpuid(info, 1);
+        int has_avx_os = (info[2] & (1 << 27)) && (info[2] & (1 << 28));
+        if (has_avx_os && ((_xgetbv(0) & 0x6) == 0x6))
+        {
+            __cpuidex(info, 7, 0);
+            if (info[1] & (1 << 5))
+                res = PX_SIMD_AVX2;
+        }
+    }
+#else
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        res = PX_SIMD_AVX2;
+#endif
+    return res;
+#else
+    return PX_SIMD_SCALAR;
+#endif /* PX_X86 */
+}
+
+
+static int _get_level(void)
+{
+    if (_simd_level == -1)
+        _simd_level = _detect_simd_level();
+    return _simd_level;
+}
+
+
+/* Must give the same result as the SIMD implementations */
+static unsigned char _mul_div_255(unsigned int c, unsigned int a)
+{
+    unsigned int t = c * a + 128;
+    return (unsigned char)((t + (t >> 8)) >> 8);
+}
+
+
+
+/** @tests-------------------------------------------------------------------**/
+//#define TEST_RUN
+//#define PIXEL_TEST
+//#define TEST_MODULE PIXEL
+
+#ifdef TEST_RUN
+#ifdef PIXEL_TEST
+
+#include <stdlib.h>
+#include <time.h>
+
+#include "../memory.h"
+#include "../../test.h"
+
+
+#define __BENCH_PIXELS (2048 * 2048)
+#define __BENCH_ITERATIONS 20
+
+
+static void fill_random(unsigned char* data, int size)
+{
+    for (int i = 0; i < size; i++)
+        data[i] = (unsigned char)rand();
+}
+
+
+/**-----------------------------------------------------------------------------
+; @unit_test
+;
+; @brief
+;   Checks that every SIMD level gives the same result as the scalar code for
+;   all kernels, including sizes that are not multiples of the vector width.
+;
+-----------------------------------------------------------------------------**/
+TEST_BEGIN(test_simd_levels_match_scalar)
+{
+    /* The loop changes the level, so the highest one is read once */
+    int max_level = px_get_simd_level();
+    for (int count = 1; count < 70; count++)
+    {
+        unsigned char src[70 * 4];
+        unsigned char ref[70 * 4];
+        unsigned char res[70 * 4];
+        fill_random(src, sizeof(src));
+
+        for (int level = PX_SIMD_SSE2; level <= max_level; level++)
+        {
+            px_set_simd_level(PX_SIMD_SCALAR);
+            px_expand_rgb_to_rgba(ref, src, count);
+            px_set_simd_level(level);
+            px_expand_rgb_to_rgba(res, src, count);
+            EXPECT_ZERO(memcmp(ref, res, count * 4));
+
+            memcpy(ref, src, count * 4);
+            memcpy(res, src, count * 4);
+            px_set_simd_level(PX_SIMD_SCALAR);
+            px_premultiply_rgba(ref, count);
+            px_set_simd_level(level);
+            px_premultiply_rgba(res, count);
+            EXPECT_ZERO(memcmp(ref, res, count * 4));
+
+            memcpy(ref, src, count * 4);
+            memcpy(res, src, count * 4);
+            px_set_simd_level(PX_SIMD_SCALAR);
+            px_flip_rows(ref, count, 4);
+            px_set_simd_level(level);
+            px_flip_rows(res, count, 4);
+            EXPECT_ZERO(memcmp(ref, res, count * 4));
+        }
+        px_set_simd_level(max_level);
+    }
+
+    /* Premultiplication edge values */
+    unsigned char p[8] = { 255, 128, 0, 255, 255, 128, 1, 0 };
+    px_premultiply_rgba(p, 2);
+    EXPECT(p[0], 255);
+    EXPECT(p[1], 128);
+    EXPECT(p[3], 255);
+    EXPECT(p[4], 0);
+    EXPECT(p[6], 0);
+    EXPECT(p[7], 0);
+    TEST_END
+}
+
+
+/**-----------------------------------------------------------------------------
+; @unit_test
+;
+; @brief
+;   Measures the throughput (GB/s of processed source data) of each kernel at
+;   each supported SIMD level.
+;
+-----------------------------------------------------------------------------**/
+TEST_BEGIN(bench_kernels_throughput)
+{
+    unsigned char* src = m_malloc((size_t)__BENCH_PIXELS * 4);
+    unsigned char* dst = m_malloc((size_t)__BENCH_PIXELS * 4);
+    fill_random(src, __BENCH_PIXELS * 4);
+
+    for (int level = PX_SIMD_SCALAR; level <= PX_SIMD_AVX2; level++)
+    {
+        px_set_simd_level(level);
+        if (px_get_simd_level() != level)
+            break;
+
+        for (int kernel = 0; kernel < 3; kernel++)
+        {
+            static const char* names[] = { "flip", "expand", "premultiply" };
+            static const int src_bpp[] = { 4, 3, 4 };
+
+            clock_t start = clock();
+            for (int i = 0; i < __BENCH_ITERATIONS; i++)
+            {
+                switch (kernel)
+                {
+                case 0: px_flip_rows(src, 2048 * 4, 2048); break;
+                case 1: px_expand_rgb_to_rgba(dst, src, __BENCH_PIXELS); break;
+                case 2: px_premultiply_rgba(dst, __BENCH_PIXELS); break;
+                }
+            }
+            double seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+            double gb = (double)__BENCH_PIXELS * src_bpp[kernel] *
+                __BENCH_ITERATIONS / (1024.0 * 1024.0 * 1024.0);
+            OUTPUT("  level %d, %-12s %6.2f GB/s\n", level, names[kernel],
+                seconds > 0.0 ? gb / seconds : 0.0);
+        }
+    }
+
+    px_set_simd_level(PX_SIMD_AVX2);
+    m_free(src);
+    m_free(dst);
+    TEST_END
+}
+
+
+RUN_TESTS
+(
+    test_simd_levels_match_scalar,
+    bench_kernels_throughput
+)
+
+
+#endif /* PIXEL_TEST */
+#endif /* TEST_RUN */
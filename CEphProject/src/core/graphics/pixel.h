@@ -0,0 +1,44 @@
+/**-----------------------------------------------------------------------------
+; @file pixel.h
+;
+; @brief
+;   The module implements per-pixel conversion kernels used when preparing
+;   image data for video memory (flip, RGB to RGBA expansion, alpha
+;   premultiplication and sub-rectangle copy).
+;
+;   Each kernel has a scalar, an SSE2 and an AVX2 implementation. The fastest
+;   implementation supported by the CPU is selected on the first call; all
+;   implementations produce bit-exact results.
+;
+; @date   October 2021
+; @author Eph
+;
+-----------------------------------------------------------------------------**/
+
+
+
+#ifndef PIXEL_H
+#define PIXEL_H
+
+
+
+#define PX_SIMD_SCALAR  0
+#define PX_SIMD_SSE2    1
+#define PX_SIMD_AVX2    2
+
+
+
+int px_get_simd_level(void);
+void px_set_simd_level(int level);
+
+void px_flip_rows(unsigned char* pixels, int row_size, int rows_count);
+void px_expand_rgb_to_rgba(unsigned char* dst, const unsigned char* src,
+    int pixels_count);
+void px_premultiply_rgba(unsigned char* pixels, int pixels_count);
+void px_copy_rect(unsigned char* dst, long long dst_stride,
+    const unsigned char* src, long long src_stride, int row_size,
+    int rows_count);
+
+
+
+#endif /* !PIXEL_H */
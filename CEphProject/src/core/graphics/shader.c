@@ -4,19 +4,20 @@
 
 
 
-#include <stdio.h>
-#include <stdlib.h>
-
 #include <glad\glad.h>
 
 #include "shader.h"
+#include "../asset_pack.h"
+#include "../mapped_file.h"
 #include "../../log.h"
 
 
 
 /** @internal_prototypes -----------------------------------------------------*/
+static const char* _open_shader_source(const char* shader_path,
+    int* out_length, stMappedFile** out_file);
 static unsigned int _compile_shader(const char* shader_source,
-    GLenum shader_type);
+    int shader_length, GLenum shader_type);
 static unsigned int _link_shader_program(unsigned int vertex_shader,
     unsigned int fragment_shader);
 
@@ -26,58 +27,39 @@ static unsigned int _link_shader_program(unsigned int vertex_shader,
 unsigned int shader_create_program(const char* vertex_shader_path,
     const char* fragment_shader_path)
 {
-    FILE* vertex_shader_file = NULL;
-    fopen_s(&vertex_shader_file, vertex_shader_path, "rb");
-    char* vertex_shader_source = NULL;
-    if (vertex_shader_file)
-    {
-        fseek(vertex_shader_file, 0, SEEK_END);
-        long fsize = ftell(vertex_shader_file);
-        fseek(vertex_shader_file, 0, SEEK_SET);  /* same as rewind(f); */
-
-        vertex_shader_source = malloc(fsize + 1);
-        fread(vertex_shader_source, 1, fsize, vertex_shader_file);
-        fclose(vertex_shader_file);
-        vertex_shader_source[fsize] = 0;
-    }
-    else
+    int vertex_shader_length = 0;
+    stMappedFile* vertex_shader_file = NULL;
+    const char* vertex_shader_source = _open_shader_source(vertex_shader_path,
+        &vertex_shader_length, &vertex_shader_file);
+    if (NULL == vertex_shader_source)
     {
         LOG_ERROR("Unable to open vertex shader file: %s", vertex_shader_path);
         return 0;
     }
-    FILE* fragment_shader_file = NULL;
-    fopen_s(&fragment_shader_file, fragment_shader_path, "rb");
-    char* fragment_shader_source = NULL;
-    if (fragment_shader_file)
-    {
-        fseek(fragment_shader_file, 0, SEEK_END);
-        long fsize = ftell(fragment_shader_file);
-        fseek(fragment_shader_file, 0, SEEK_SET);  /* same as rewind(f); */
-
-        fragment_shader_source = malloc(fsize + 1);
-        fread(fragment_shader_source, 1, fsize, fragment_shader_file);
-        fclose(fragment_shader_file);
-        fragment_shader_source[fsize] = 0;
-    }
-    else
+    int fragment_shader_length = 0;
+    stMappedFile* fragment_shader_file = NULL;
+    const char* fragment_shader_source = _open_shader_source(
+        fragment_shader_path, &fragment_shader_length, &fragment_shader_file);
+    if (NULL == fragment_shader_source)
     {
         LOG_ERROR("Unable to open fragment shader file: %s",
             fragment_shader_path);
+        mf_close(vertex_shader_file);
         return 0;
     }
 
     unsigned int vertex_shader = _compile_shader(vertex_shader_source,
-        GL_VERTEX_SHADER);
+        vertex_shader_length, GL_VERTEX_SHADER);
     unsigned int fragment_shader = _compile_shader(fragment_shader_source,
-        GL_FRAGMENT_SHADER);
+        fragment_shader_length, GL_FRAGMENT_SHADER);
     unsigned int shader_program = _link_shader_program(vertex_shader, 
        fragment_shader);
    
     GL_CALL(glDeleteShader(vertex_shader));
     GL_CALL(glDeleteShader(fragment_shader));
 
-    free(vertex_shader_source);
-    free(fragment_shader_source);
+    mf_close(vertex_shader_file);
+    mf_close(fragment_shader_file);
 
     return shader_program;
 }
@@ -96,6 +78,14 @@ void shader_set_uf_int(unsigned int shader_program, const char* name, int value)
 }
 
 
+void shader_set_uf_int_array(unsigned int shader_program, const char* name,
+    int count, const int* values)
+{
+    int uniform_location = glGetUniformLocation(shader_program, name);
+    glUniform1iv(uniform_location, count, values);
+}
+
+
 void shader_set_uf_float(unsigned int shader_program, const char* name, float value)
 {
     int uniform_location = glGetUniformLocation(shader_program, name);
@@ -125,14 +115,37 @@ void shader_set_uf_fmat4(unsigned int shader_program, const char* name, mat4 val
 
 
 
+/* Takes the source from the open asset pack or maps the loose file. The
+   source is not null-terminated, so its length is returned as well. The
+   mapped file (NULL for packed sources) must be closed after compiling */
+static const char* _open_shader_source(const char* shader_path,
+    int* out_length, stMappedFile** out_file)
+{
+    size_t size = 0;
+    const char* source = ap_find(shader_path, &size);
+    if (NULL == source)
+    {
+        *out_file = mf_open(shader_path);
+        if (NULL == *out_file)
+            return NULL;
+        source = mf_get_data(*out_file);
+        size = mf_get_size(*out_file);
+    }
+
+    /* Empty files are not mapped */
+    *out_length = (int)size;
+    return (source != NULL) ? source : "";
+}
+
+
 static unsigned int _compile_shader(const char* shader_source,
-    GLenum shader_type)
+    int shader_length, GLenum shader_type)
 {
     int result = 0;
     char info_log[512]; // TODO: 512 hardcode.
 
     unsigned int shader = glCreateShader(shader_type);
-    GL_CALL(glShaderSource(shader, 1, &shader_source, NULL));
+    GL_CALL(glShaderSource(shader, 1, &shader_source, &shader_length));
     GL_CALL(glCompileShader(shader));
 
     GL_CALL(glGetShaderiv(shader, GL_COMPILE_STATUS, &result));
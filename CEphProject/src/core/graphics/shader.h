@@ -11,6 +11,8 @@ void shader_use_program(unsigned int shader_program);
 
 void shader_set_uf_int(
     unsigned int shader_program, const char* name, int value);
+void shader_set_uf_int_array(unsigned int shader_program, const char* name,
+    int count, const int* values);
 void shader_set_uf_float(
     unsigned int shader_program, const char* name, float value);
 void shader_set_uf_fvec2(
@@ -0,0 +1,785 @@
+/**-----------------------------------------------------------------------------
+; @file sprite_batch.c
+;
+; @brief
+;   The file implements the functionality of the 'sprite_batch' module.
+;
+;   sb - sprite batch
+;
+; @date   October 2021
+; @author Eph
+;
+-----------------------------------------------------------------------------**/
+
+
+
+/** @includes ----------------------------------------------------------------*/
+#include <stddef.h> /* offsetof */
+
+#include <glad/glad.h>
+
+#include "sprite_batch.h"
+#include "shader.h"
+#include "texture/texture_units.h"
+#include "../memory.h"
+#include "../../log.h"
+
+
+
+/** @types -------------------------------------------------------------------*/
+
+#define VERTICES_PER_SPRITE 4
+#define INDICES_PER_SPRITE 6
+
+/* The stream buffer holds several flushes, so it is orphaned only when it is
+   full and not on every flush */
+#define STREAM_SPRITES (SB_MAX_SPRITES * 4)
+
+/* 'stSpriteInstance.flags' */
+#define INSTANCE_ROTATED 0x01           /* The texture is stored rotated by   */
+                                        /* 90 degrees                         */
+
+
+/* Per-instance data of a sprite. All sprites share one unit quad */
+typedef struct
+{
+    float pos[2];                       /* Upper left corner, screen space    */
+    float size[2];
+    float txd_rect[4];                  /* Texture coordinates of the placed  */
+                                        /* area: { x, y, width, height }      */
+    unsigned short layer;               /* Layer of the texture 2d array      */
+    unsigned char unit;                 /* Texture unit of the array          */
+    unsigned char flags;                /* 'INSTANCE_*' flags                 */
+}stSpriteInstance;
+
+
+/* Sprite submitted with 'sb_draw' */
+typedef struct
+{
+    tb_handle texture;
+    float pos[2];
+    float size[2];
+}stSprite;
+
+
+/* Sprites of one texture 2d array in the current flush */
+typedef struct
+{
+    unsigned int array_id;
+    unsigned int count;                 /* Sprites of the array               */
+    unsigned int first;                 /* First sprite in '_order'           */
+    int unit;                           /* Texture unit of the array          */
+}stArrayBatch;
+
+
+
+/** @static_data -------------------------------------------------------------*/
+static unsigned int _program = 0;
+static int _projection_location = -1;
+
+static unsigned int _vertex_array = 0;
+static unsigned int _quad_buffer = 0;   /* Vertices of the unit quad          */
+static unsigned int _indices_buffer = 0;
+static unsigned int _instance_buffer = 0; /* Stream of 'stSpriteInstance'     */
+static unsigned int _stream_offset = 0; /* Next free instance of the buffer   */
+
+static stSprite* _sprites = NULL;       /* 'SB_MAX_SPRITES' sprites           */
+static unsigned int _sprites_count = 0;
+static unsigned int* _sprite_batches = NULL; /* Batch of each sprite          */
+static unsigned int* _order = NULL;     /* Sprites sorted by batches          */
+
+static stArrayBatch* _batches = NULL;
+static stTextureBatch* _sorted_batches = NULL;
+static unsigned int _batches_capacity = 0;
+
+static stSpriteBatchStats _stats;
+
+
+
+/** @internal_prototypes -----------------------------------------------------*/
+static int _create_buffers(void);
+static unsigned int _group_sprites(const stTextureTable* textures);
+static int _grow_batches(void);
+static unsigned int _bind_arrays(unsigned int first_batch,
+    unsigned int batches_count);
+static void _write_instances(stSpriteInstance* instances,
+    const stTextureTable* textures, unsigned int first_sprite,
+    unsigned int sprites_count);
+static void _draw_batches(unsigned int first_batch, unsigned int last_batch,
+    unsigned int first_sprite);
+
+
+
+/** @functions ---------------------------------------------------------------*/
+
+/**-----------------------------------------------------------------------------
+; @func sb_init
+;
+; @brief
+;   Creates the shader program and the buffers of the sprite batch.
+;
+; @return
+;   int | 0 on success, -1 on failure.
+;
+-----------------------------------------------------------------------------**/
+int sb_init(void)
+{
+    extern unsigned int _program;
+    extern int _projection_location;
+    extern stSprite* _sprites;
+    extern unsigned int* _sprite_batches;
+    extern unsigned int* _order;
+
+    if (_program != 0)
+        return 0;
+
+    _program = shader_create_program(
+        "resources/shaders/txd_array_instanced_vertex.shader",
+        "resources/shaders/txd_array_instanced_fragment.shader");
+    if (0 == _program)
+    {
+        LOG_ERROR("Unable to create the sprite batch shader program.");
+        return -1;
+    }
+    _projection_location = glGetUniformLocation(_program, "uf_projection");
+
+    /* Instances select their unit from the sampler array, so the samplers
+       are set once instead of per draw */
+    int units[TU_MAX_UNITS];
+    for (int i = 0; i < TU_MAX_UNITS; i++)
+        units[i] = i;
+    int current_program = 0;
+    GL_CALL(glGetIntegerv(GL_CURRENT_PROGRAM, &current_program));
+    GL_CALL(glUseProgram(_program));
+    GL_CALL(glUniform1iv(glGetUniformLocation(_program, "uf_txd_units"),
+        TU_MAX_UNITS, units));
+    GL_CALL(glUseProgram(current_program));
+
+    _sprites = m_malloc(sizeof(stSprite) * SB_MAX_SPRITES);
+    _sprite_batches = m_malloc(sizeof(unsigned int) * SB_MAX_SPRITES);
+    _order = m_malloc(sizeof(unsigned int) * SB_MAX_SPRITES);
+    if (NULL == _sprites || NULL == _sprite_batches || NULL == _order ||
+        _create_buffers() != 0)
+    {
+        sb_destroy();
+        return -1;
+    }
+    return 0;
+}
+
+
+void sb_set_projection(mat4 projection)
+{
+    extern unsigned int _program;
+    extern int _projection_location;
+
+    int current_program = 0;
+    GL_CALL(glGetIntegerv(GL_CURRENT_PROGRAM, &current_program));
+    GL_CALL(glUseProgram(_program));
+    GL_CALL(glUniformMatrix4fv(_projection_location, 1, GL_FALSE,
+        (const float*)projection));
+    GL_CALL(glUseProgram(current_program));
+}
+
+
+/**-----------------------------------------------------------------------------
+; @func sb_draw
+;
+; @brief
+;   Adds the sprite to the batch. The sprite is drawn by the next 'sb_flush'.
+;
+; @params
+;   texture | Handle of a built texture.
+;   pos     | Position of the upper left corner of the sprite.
+;   size    | Size of the sprite. Trimmed textures (see 'tb_trim_rect') are
+;           | drawn on the trimmed part of this rectangle.
+;
+-----------------------------------------------------------------------------**/
+void sb_draw(tb_handle texture, const vec2 pos, const vec2 size)
+{
+    extern stSprite* _sprites;
+    extern unsigned int _sprites_count;
+
+    if (NULL == _sprites)
+    {
+        LOG_ERROR("Unable to draw sprite. The sprite batch is not initialized.");
+        return;
+    }
+    if (TB_INVALID_HANDLE == texture ||
+        texture >= tb_get_texture_table()->count)
+    {
+        LOG_ERROR("Unable to draw sprite. Invalid texture [%u].", texture);
+        return;
+    }
+
+    if (SB_MAX_SPRITES == _sprites_count)
+        sb_flush();
+
+    stSprite* sprite = &_sprites[_sprites_count++];
+    sprite->texture = texture;
+    sprite->pos[0] = pos[0];
+    sprite->pos[1] = pos[1];
+    sprite->size[0] = size[0];
+    sprite->size[1] = size[1];
+}
+
+
+/**-----------------------------------------------------------------------------
+; @func sb_flush
+;
+; @brief
+;   Draws all sprites added since the last flush: groups them by texture 2d
+;   array, binds the arrays, writes the instances into the stream buffer and
+;   issues one instanced draw call per array.
+;
+-----------------------------------------------------------------------------**/
+void sb_flush(void)
+{
+    extern unsigned int _program;
+    extern unsigned int _vertex_array;
+    extern unsigned int _instance_buffer;
+    extern unsigned int _stream_offset;
+    extern unsigned int _sprites_count;
+    extern stTextureBatch* _sorted_batches;
+    extern stSpriteBatchStats _stats;
+
+    if (0 == _sprites_count)
+        return;
+
+    const stTextureTable* textures = tb_get_texture_table();
+    unsigned int batches_count = _group_sprites(textures);
+    if (0 == _sprites_count)
+        return;
+
+    int current_program = 0;
+    int current_vertex_array = 0;
+    GL_CALL(glGetIntegerv(GL_CURRENT_PROGRAM, &current_program));
+    GL_CALL(glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &current_vertex_array));
+    GL_CALL(glUseProgram(_program));
+    GL_CALL(glBindVertexArray(_vertex_array));
+    GL_CALL(glBindBuffer(GL_ARRAY_BUFFER, _instance_buffer));
+
+    /* The units of the arrays must be known before the instances are
+       written, so the batches are drawn in groups of arrays that fit on the
+       units at once (usually a single group) */
+    for (unsigned int first_batch = 0; first_batch < batches_count; )
+    {
+        unsigned int last_batch = _bind_arrays(first_batch, batches_count);
+        const stArrayBatch* first = _sorted_batches[first_batch].data;
+        const stArrayBatch* last = _sorted_batches[last_batch - 1].data;
+        unsigned int sprites_count = last->first + last->count - first->first;
+
+        /* Orphan the buffer when it is full, so the driver gives a new block
+           instead of waiting for the draws that still read the old one */
+        if (_stream_offset + sprites_count > STREAM_SPRITES)
+        {
+            GL_CALL(glBufferData(GL_ARRAY_BUFFER,
+                sizeof(stSpriteInstance) * STREAM_SPRITES, NULL,
+                GL_STREAM_DRAW));
+            _stream_offset = 0;
+        }
+
+        /* The written range is not used by any pending draw, so there is no
+           need to synchronize */
+        stSpriteInstance* instances = glMapBufferRange(GL_ARRAY_BUFFER,
+            sizeof(stSpriteInstance) * _stream_offset,
+            sizeof(stSpriteInstance) * sprites_count,
+            GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT |
+            GL_MAP_UNSYNCHRONIZED_BIT);
+        if (NULL == instances)
+        {
+            LOG_ERROR("Unable to map the sprite batch instance buffer.");
+            break;
+        }
+        _write_instances(instances, textures, first->first, sprites_count);
+        GL_CALL(glUnmapBuffer(GL_ARRAY_BUFFER));
+
+        _draw_batches(first_batch, last_batch, first->first);
+
+        _stats.sprites += sprites_count;
+        _stream_offset += sprites_count;
+        first_batch = last_batch;
+    }
+
+    GL_CALL(glBindVertexArray(current_vertex_array));
+    GL_CALL(glUseProgram(current_program));
+    _sprites_count = 0;
+}
+
+
+/**-----------------------------------------------------------------------------
+; @func sb_begin_frame
+;
+; @brief
+;   Starts counting the sprites and draw calls of a new frame.
+;
+-----------------------------------------------------------------------------**/
+void sb_begin_frame(void)
+{
+    extern stSpriteBatchStats _stats;
+
+    _stats.last_frame_sprites = _stats.sprites;
+    _stats.last_frame_draws = _stats.draws;
+    _stats.sprites = 0;
+    _stats.draws = 0;
+}
+
+
+void sb_get_stats(stSpriteBatchStats* out_stats)
+{
+    extern stSpriteBatchStats _stats;
+
+    *out_stats = _stats;
+}
+
+
+void sb_destroy(void)
+{
+    extern unsigned int _program;
+    extern unsigned int _vertex_array;
+    extern unsigned int _quad_buffer;
+    extern unsigned int _indices_buffer;
+    extern unsigned int _instance_buffer;
+    extern unsigned int _stream_offset;
+    extern stSprite* _sprites;
+    extern unsigned int _sprites_count;
+    extern unsigned int* _sprite_batches;
+    extern unsigned int* _order;
+    extern stArrayBatch* _batches;
+    extern stTextureBatch* _sorted_batches;
+    extern unsigned int _batches_capacity;
+
+    if (_program != 0)
+        GL_CALL(glDeleteProgram(_program));
+    if (_vertex_array != 0)
+        GL_CALL(glDeleteVertexArrays(1, &_vertex_array));
+    if (_quad_buffer != 0)
+        GL_CALL(glDeleteBuffers(1, &_quad_buffer));
+    if (_indices_buffer != 0)
+        GL_CALL(glDeleteBuffers(1, &_indices_buffer));
+    if (_instance_buffer != 0)
+        GL_CALL(glDeleteBuffers(1, &_instance_buffer));
+    _program = 0;
+    _vertex_array = 0;
+    _quad_buffer = 0;
+    _indices_buffer = 0;
+    _instance_buffer = 0;
+    _stream_offset = 0;
+
+    m_free(_sprites);
+    m_free(_sprite_batches);
+    m_free(_order);
+    m_free(_batches);
+    m_free(_sorted_batches);
+    _sprites = NULL;
+    _sprites_count = 0;
+    _sprite_batches = NULL;
+    _order = NULL;
+    _batches = NULL;
+    _sorted_batches = NULL;
+    _batches_capacity = 0;
+}
+
+
+static int _create_buffers(void)
+{
+    extern unsigned int _vertex_array;
+    extern unsigned int _quad_buffer;
+    extern unsigned int _indices_buffer;
+    extern unsigned int _instance_buffer;
+
+    /* Top right, bottom right, bottom left and top left corners, as the
+       texture vertices of the texture table */
+    static const float quad[VERTICES_PER_SPRITE * 2] =
+    {
+        1.0f, 0.0f,  1.0f, 1.0f,  0.0f, 1.0f,  0.0f, 0.0f
+    };
+    static const unsigned short indices[INDICES_PER_SPRITE] =
+    {
+        0, 1, 3,  1, 2, 3
+    };
+
+    int current_vertex_array = 0;
+    GL_CALL(glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &current_vertex_array));
+
+    GL_CALL(glGenVertexArrays(1, &_vertex_array));
+    GL_CALL(glBindVertexArray(_vertex_array));
+
+    GL_CALL(glGenBuffers(1, &_indices_buffer));
+    GL_CALL(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, _indices_buffer));
+    GL_CALL(glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices,
+        GL_STATIC_DRAW));
+
+    /* Binding 0: the unit quad */
+    GL_CALL(glGenBuffers(1, &_quad_buffer));
+    GL_CALL(glBindBuffer(GL_ARRAY_BUFFER, _quad_buffer));
+    GL_CALL(glBufferData(GL_ARRAY_BUFFER, sizeof(quad), quad,
+        GL_STATIC_DRAW));
+    GL_CALL(glBindVertexBuffer(0, _quad_buffer, 0, sizeof(float) * 2));
+    GL_CALL(glVertexAttribFormat(0, 2, GL_FLOAT, GL_FALSE, 0));
+    GL_CALL(glVertexAttribBinding(0, 0));
+    GL_CALL(glEnableVertexAttribArray(0));
+
+    /* Binding 1: one 'stSpriteInstance' per instance */
+    GL_CALL(glGenBuffers(1, &_instance_buffer));
+    GL_CALL(glBindBuffer(GL_ARRAY_BUFFER, _instance_buffer));
+    GL_CALL(glBufferData(GL_ARRAY_BUFFER,
+        sizeof(stSpriteInstance) * STREAM_SPRITES, NULL, GL_STREAM_DRAW));
+    GL_CALL(glBindVertexBuffer(1, _instance_buffer, 0,
+        sizeof(stSpriteInstance)));
+    GL_CALL(glVertexBindingDivisor(1, 1));
+    GL_CALL(glVertexAttribFormat(1, 4, GL_FLOAT, GL_FALSE,
+        offsetof(stSpriteInstance, pos)));
+    GL_CALL(glVertexAttribFormat(2, 4, GL_FLOAT, GL_FALSE,
+        offsetof(stSpriteInstance, txd_rect)));
+    GL_CALL(glVertexAttribIFormat(3, 1, GL_UNSIGNED_SHORT,
+        offsetof(stSpriteInstance, layer)));
+    GL_CALL(glVertexAttribIFormat(4, 2, GL_UNSIGNED_BYTE,
+        offsetof(stSpriteInstance, unit)));
+    for (unsigned int i = 1; i < 5; i++)
+    {
+        GL_CALL(glVertexAttribBinding(i, 1));
+        GL_CALL(glEnableVertexAttribArray(i));
+    }
+
+    GL_CALL(glBindVertexArray(current_vertex_array));
+    GL_CALL(glBindBuffer(GL_ARRAY_BUFFER, 0));
+    return 0;
+}
+
+
+/* Finds the batch of each sprite and sorts the sprites by batches ('_order').
+   Returns the number of batches, which are sorted by 'tu_sort_batches' */
+static unsigned int _group_sprites(const stTextureTable* textures)
+{
+    extern stSprite* _sprites;
+    extern unsigned int _sprites_count;
+    extern unsigned int* _sprite_batches;
+    extern unsigned int* _order;
+    extern stArrayBatch* _batches;
+    extern stTextureBatch* _sorted_batches;
+    extern unsigned int _batches_capacity;
+
+    unsigned int batches_count = 0;
+    unsigned int batch = 0;
+    for (unsigned int i = 0; i < _sprites_count; i++)
+    {
+        unsigned int array_id = textures->array_ids[_sprites[i].texture];
+
+        /* Consecutive sprites usually share the array */
+        if (0 == batches_count || _batches[batch].array_id != array_id)
+        {
+            batch = 0;
+            while (batch < batches_count && _batches[batch].array_id != array_id)
+                batch++;
+            if (batch == batches_count)
+            {
+                if (batches_count == _batches_capacity && _grow_batches() != 0)
+                {
+                    _sprite_batches[i] = (unsigned int)-1;
+                    continue;
+                }
+                _batches[batch].array_id = array_id;
+                _batches[batch].count = 0;
+                batches_count++;
+            }
+        }
+        _batches[batch].count++;
+        _sprite_batches[i] = batch;
+    }
+
+    /* Arrays that are already bound are drawn first */
+    for (unsigned int i = 0; i < batches_count; i++)
+    {
+        _sorted_batches[i].array_id = _batches[i].array_id;
+        _sorted_batches[i].data = &_batches[i];
+    }
+    tu_sort_batches(_sorted_batches, (int)batches_count);
+
+    unsigned int first = 0;
+    for (unsigned int i = 0; i < batches_count; i++)
+    {
+        stArrayBatch* array_batch = _sorted_batches[i].data;
+        array_batch->first = first;
+        first += array_batch->count;
+        array_batch->count = 0;
+    }
+
+    /* Stable counting sort, sprites of one array keep their order. Sprites
+       without a batch are dropped */
+    for (unsigned int i = 0; i < _sprites_count; i++)
+    {
+        if ((unsigned int)-1 == _sprite_batches[i])
+            continue;
+        stArrayBatch* array_batch = &_batches[_sprite_batches[i]];
+        _order[array_batch->first + array_batch->count++] = i;
+    }
+    _sprites_count = first;
+    return batches_count;
+}
+
+
+static int _grow_batches(void)
+{
+    extern stArrayBatch* _batches;
+    extern stTextureBatch* _sorted_batches;
+    extern unsigned int _batches_capacity;
+
+    unsigned int capacity = (0 == _batches_capacity) ? 16 :
+        _batches_capacity * 2;
+    stArrayBatch* batches = m_realloc(_batches,
+        sizeof(stArrayBatch) * capacity);
+    if (NULL == batches)
+        return -1;
+    _batches = batches;
+
+    stTextureBatch* sorted_batches = m_realloc(_sorted_batches,
+        sizeof(stTextureBatch) * capacity);
+    if (NULL == sorted_batches)
+        return -1;
+    _sorted_batches = sorted_batches;
+
+    _batches_capacity = capacity;
+    return 0;
+}
+
+
+/* Binds the arrays of the sorted batches starting from 'first_batch' until
+   all units are used by the current batch. Returns the index after the last
+   bound batch */
+static unsigned int _bind_arrays(unsigned int first_batch,
+    unsigned int batches_count)
+{
+    extern stTextureBatch* _sorted_batches;
+
+    stTextureUnitsStats units;
+    tu_get_stats(&units);
+    int units_count = (units.units_count > 0) ? units.units_count : 1;
+
+    tu_begin_batch();
+    unsigned int batch = first_batch;
+    for (int bound = 0; batch < batches_count && bound < units_count; batch++)
+    {
+        stArrayBatch* array_batch = _sorted_batches[batch].data;
+
+        /* Textures that are not built yet have no array */
+        array_batch->unit = TU_FAIL;
+        if (array_batch->array_id != 0)
+        {
+            array_batch->unit = tu_bind(array_batch->array_id);
+            bound++;
+        }
+    }
+    return batch;
+}
+
+
+/* Writes the instances of the sorted sprites */
+static void _write_instances(stSpriteInstance* instances,
+    const stTextureTable* textures, unsigned int first_sprite,
+    unsigned int sprites_count)
+{
+    extern stSprite* _sprites;
+    extern unsigned int* _sprite_batches;
+    extern unsigned int* _order;
+    extern stArrayBatch* _batches;
+
+    for (unsigned int i = first_sprite; i < first_sprite + sprites_count; i++)
+    {
+        unsigned int sprite_idx = _order[i];
+        const stSprite* sprite = &_sprites[sprite_idx];
+        const float* txd_vertices = textures->vertices[sprite->texture];
+        const float* trim = textures->trims[sprite->texture];
+        int unit = _batches[_sprite_batches[sprite_idx]].unit;
+
+        instances->pos[0] = sprite->pos[0] + trim[0] * sprite->size[0];
+        instances->pos[1] = sprite->pos[1] + trim[1] * sprite->size[1];
+        instances->size[0] = sprite->size[0] * trim[2];
+        instances->size[1] = sprite->size[1] * trim[3];
+
+        /* The top right corner of a rotated texture is its left edge (see
+           'texture_builder') */
+        if (txd_vertices[0] == txd_vertices[2])
+        {
+            instances->txd_rect[0] = txd_vertices[4];
+            instances->txd_rect[1] = txd_vertices[5];
+            instances->txd_rect[2] = txd_vertices[0] - txd_vertices[4];
+            instances->txd_rect[3] = txd_vertices[1] - txd_vertices[5];
+            instances->flags = 0;
+        }
+        else
+        {
+            instances->txd_rect[0] = txd_vertices[6];
+            instances->txd_rect[1] = txd_vertices[7];
+            instances->txd_rect[2] = txd_vertices[2] - txd_vertices[6];
+            instances->txd_rect[3] = txd_vertices[3] - txd_vertices[7];
+            instances->flags = INSTANCE_ROTATED;
+        }
+        instances->layer = (unsigned short)textures->z_offsets[sprite->texture];
+        instances->unit = (unsigned char)((unit != TU_FAIL) ? unit : 0);
+        instances++;
+    }
+}
+
+
+/* Draws the sorted batches in the range. Their instances are written at
+   '_stream_offset' starting from the sprite 'first_sprite' */
+static void _draw_batches(unsigned int first_batch, unsigned int last_batch,
+    unsigned int first_sprite)
+{
+    extern unsigned int _stream_offset;
+    extern stTextureBatch* _sorted_batches;
+    extern stSpriteBatchStats _stats;
+
+    for (unsigned int i = first_batch; i < last_batch; i++)
+    {
+        const stArrayBatch* array_batch = _sorted_batches[i].data;
+        if (TU_FAIL == array_batch->unit)
+            continue;
+
+        /* 'glDrawElementsInstanced' with the base instance, so all batches
+           share one instance buffer binding */
+        GL_CALL(glDrawElementsInstancedBaseInstance(GL_TRIANGLES,
+            INDICES_PER_SPRITE, GL_UNSIGNED_SHORT, NULL, array_batch->count,
+            _stream_offset + array_batch->first - first_sprite));
+        _stats.draws++;
+    }
+}
+
+
+
+/** @tests-------------------------------------------------------------------**/
+//#define TEST_RUN
+//#define SPRITE_BATCH_TEST
+//#define TEST_MODULE SPRITE_BATCH
+
+#ifdef TEST_RUN
+#ifdef SPRITE_BATCH_TEST
+
+#include <GLFW/glfw3.h>
+
+#include "../window.h"
+#include "../../test.h"
+
+
+#define __BENCH_FRAMES 60
+
+
+/**-----------------------------------------------------------------------------
+; @unit_test
+;
+; @brief
+;   Sprites of textures placed on two arrays are drawn with two draw calls no
+;   matter how they are interleaved.
+;
+-----------------------------------------------------------------------------**/
+TEST_BEGIN(test_one_draw_per_array)
+{
+    EXPECT_ZERO(window_init("test", 256, 256, 0, 0));
+    EXPECT_ZERO(sb_init());
+
+    tb_handle small = tb_add_texture(TB_NO_GROUP, "resources/img/256x256.jpg",
+        0, 0, 256, 256, TB_FORMAT_RGBA8);
+    tb_handle large = tb_add_texture(TB_NO_GROUP,
+        "resources/img/2048x2048_white.png", 0, 0, 2048, 2048,
+        TB_FORMAT_RGBA8);
+    tb_build();
+
+    const stTextureTable* textures = tb_get_texture_table();
+    EXPECT((textures->array_ids[small] != textures->array_ids[large]), 1);
+
+    sb_begin_frame();
+    for (int i = 0; i < 1000; i++)
+    {
+        vec2 pos = { (float)(i % 200), (float)(i / 5) };
+        vec2 size = { 16.0f, 16.0f };
+        sb_draw((i % 3) ? small : large, pos, size);
+    }
+    sb_flush();
+
+    stSpriteBatchStats stats;
+    sb_get_stats(&stats);
+    EXPECT(stats.sprites, 1000u);
+    EXPECT(stats.draws, 2u);
+
+    sb_destroy();
+    tb_destroy();
+    tu_destroy();
+    glfwTerminate();
+    TEST_END
+}
+
+
+/**-----------------------------------------------------------------------------
+; @unit_test
+;
+; @brief
+;   Measures how many sprites can be submitted and drawn per frame: the CPU
+;   time of 'sb_draw' + 'sb_flush' and the time until the GPU finishes the
+;   frame.
+;
+-----------------------------------------------------------------------------**/
+TEST_BEGIN(bench_sprites_per_frame)
+{
+    EXPECT_ZERO(window_init("test", 800, 600, 0, 0));
+    EXPECT_ZERO(sb_init());
+
+    tb_handle sheet[16];
+    for (int i = 0; i < 16; i++)
+    {
+        sheet[i] = tb_add_texture(TB_NO_GROUP,
+            "resources/img/512x512_transp.png", (i % 4) * 128, (i / 4) * 128,
+            128, 128, TB_FORMAT_RGBA8);
+    }
+    tb_build();
+
+    mat4 projection = GLM_MAT4_IDENTITY_INIT;
+    glm_ortho(0.0f, 800.0f, 600.0f, 0.0f, -0.1f, 0.1f, projection);
+    sb_set_projection(projection);
+
+    static const int counts[] = { 1000, 10000, 100000 };
+    for (int c = 0; c < 3; c++)
+    {
+        double cpu_time = 0.0;
+        double start = glfwGetTime();
+        for (int frame = 0; frame < __BENCH_FRAMES; frame++)
+        {
+            double frame_start = glfwGetTime();
+            sb_begin_frame();
+            for (int i = 0; i < counts[c]; i++)
+            {
+                vec2 pos = { (float)((i * 37) % 784), (float)((i * 11) % 584) };
+                vec2 size = { 16.0f, 16.0f };
+                sb_draw(sheet[i % 16], pos, size);
+            }
+            sb_flush();
+            cpu_time += glfwGetTime() - frame_start;
+            glFinish();
+        }
+        double frame_time = (glfwGetTime() - start) / __BENCH_FRAMES;
+
+        stSpriteBatchStats stats;
+        sb_get_stats(&stats);
+        OUTPUT("  %6d sprites: %u draws, cpu %.3f ms, frame %.3f ms, "
+            "%.0f sprites per 16.6 ms\n", counts[c], stats.draws,
+            cpu_time * 1000.0 / __BENCH_FRAMES, frame_time * 1000.0,
+            counts[c] * (1.0 / 60.0) / frame_time);
+    }
+
+    sb_destroy();
+    tb_destroy();
+    tu_destroy();
+    glfwTerminate();
+    TEST_END
+}
+
+
+RUN_TESTS
+(
+    test_one_draw_per_array,
+    bench_sprites_per_frame
+)
+
+
+#endif /* SPRITE_BATCH_TEST */
+#endif /* TEST_RUN */
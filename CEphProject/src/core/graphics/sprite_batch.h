@@ -0,0 +1,77 @@
+/**-----------------------------------------------------------------------------
+; @file sprite_batch.h
+;
+; @brief
+;   The module draws textured rectangles (sprites) in batches. Sprites are
+;   collected during the frame, written into a streaming instance buffer and
+;   drawn with one instanced draw call per texture 2d array instead of one draw
+;   call (and a handful of uniform updates) per object. All sprites share one
+;   unit quad, a sprite takes 36 bytes of instance data: position, size,
+;   texture coordinates rectangle, layer and texture unit.
+;
+; @usage:
+;   - call 'sb_init' once after the window is created and 'sb_set_projection'
+;     whenever the projection changes;
+;   - call 'sb_begin_frame' once per frame (the main loop does it);
+;   - call 'sb_draw' for each sprite of the frame;
+;   - call 'sb_flush' to draw the collected sprites (at least once per frame,
+;     after all 'sb_draw' calls);
+;   - call 'sb_destroy' before the textures are destroyed.
+;
+; @notes:
+;   Sprites are sorted by texture 2d array before drawing, so a sprite is
+;   guaranteed to be drawn over the sprites submitted before it only if both
+;   use the same array. Call 'sb_flush' between sprites whose order matters.
+;   Sprites of one array keep their submission order.
+;
+;   'sb_draw' calls 'sb_flush' itself when 'SB_MAX_SPRITES' sprites are
+;   collected.
+;
+;   'sb_flush' changes the active texture unit and the texture bindings (see
+;   'texture_units'), but restores the current program and vertex array.
+;
+; @date   October 2021
+; @author Eph
+;
+-----------------------------------------------------------------------------**/
+
+
+
+#ifndef SPRITE_BATCH_H
+#define SPRITE_BATCH_H
+
+
+
+#include <cglm/cglm.h>
+
+#include "texture/texture_builder.h"
+
+
+
+#define SB_MAX_SPRITES 16384            /* Sprites drawn by one 'sb_flush'    */
+
+
+
+/** @types -------------------------------------------------------------------*/
+
+typedef struct
+{
+    unsigned int sprites;               /* Sprites drawn this frame           */
+    unsigned int draws;                 /* Draw calls this frame              */
+    unsigned int last_frame_sprites;    /* Sprites drawn last frame           */
+    unsigned int last_frame_draws;      /* Draw calls last frame              */
+}stSpriteBatchStats;
+
+
+
+int sb_init(void);
+void sb_set_projection(mat4 projection);
+void sb_draw(tb_handle texture, const vec2 pos, const vec2 size);
+void sb_flush(void);
+void sb_begin_frame(void);
+void sb_get_stats(stSpriteBatchStats* out_stats);
+void sb_destroy(void);
+
+
+
+#endif /* !SPRITE_BATCH_H */
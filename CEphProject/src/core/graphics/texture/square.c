@@ -13,7 +13,7 @@ typedef struct stSquare
 {
     int w;
     int h;
-    unsigned char** bytes;
+    unsigned char* bytes;
 }stSquare;
 
 
@@ -27,7 +27,7 @@ stSquare* sq_create(int w, int h)
     }
     sq->w = w;
     sq->h = h;
-    sq->bytes = m_calloc(w * h, sizeof(unsigned char*));
+    sq->bytes = m_calloc((size_t)w * h, sizeof(unsigned char));
     if (NULL == sq->bytes)
     {
         LOG_ERROR("// TODO:");
@@ -191,6 +191,55 @@ void sq_get_free_rect(const stSquare* sq, int w, int h, int* out_x, int* out_y)
 }
 
 
+/**-----------------------------------------------------------------------------
+; @func sq_get_free_rect_rotatable
+;
+; @brief
+;   Same as 'sq_get_free_rect', but if 'allow_rotation' is not 0, also tries
+;   the rectangle rotated by 90 degrees (i.e. of size ('h', 'w')) and returns
+;   the orientation whose placement has the lowest bottom edge (and then the
+;   leftmost right edge). This keeps the used area of the square compact and
+;   lets long thin rectangles fill the gaps along either axis.
+;
+; @params
+;   sq              | Square.
+;   w               | Width of the rectangle to be placed.
+;   h               | Height of the rectangle to be placed.
+;   allow_rotation  | Whether the rectangle can be rotated.
+;   out_x           | X-pos on which the rectangle can be placed.
+;   out_y           | Y-pos on which the rectangle can be placed.
+;   out_rotated     | 1 if the rectangle must be placed rotated (so it
+;                   | occupies 'h' x 'w' pixels), otherwise 0.
+;
+-----------------------------------------------------------------------------**/
+void sq_get_free_rect_rotatable(const stSquare* sq, int w, int h,
+    int allow_rotation, int* out_x, int* out_y, int* out_rotated)
+{
+    *out_rotated = 0;
+    sq_get_free_rect(sq, w, h, out_x, out_y);
+
+    if (!allow_rotation || w == h)
+        return;
+
+    int rotated_x = SQ_FAIL;
+    int rotated_y = SQ_FAIL;
+    sq_get_free_rect(sq, h, w, &rotated_x, &rotated_y);
+    if (rotated_x == SQ_FAIL)
+        return;
+
+    int is_rotated_better = (*out_x == SQ_FAIL) ||
+        (rotated_y + w < *out_y + h) ||
+        (rotated_y + w == *out_y + h && rotated_x + h < *out_x + w);
+
+    if (is_rotated_better)
+    {
+        *out_x = rotated_x;
+        *out_y = rotated_y;
+        *out_rotated = 1;
+    }
+}
+
+
 /**-----------------------------------------------------------------------------
 ; @func sq_get_used_rect
 ;
@@ -252,3 +301,130 @@ void sq_dbg_print(const stSquare* sq, int x, int y, int w, int h)
     }
     printf("\n\n");
 }
+
+
+
+/** @tests-------------------------------------------------------------------**/
+//#define TEST_RUN
+//#define SQUARE_TEST
+//#define TEST_MODULE SQUARE
+
+#ifdef TEST_RUN
+#ifdef SQUARE_TEST
+
+#include <stdlib.h>
+
+#include "../../../test.h"
+
+
+#define __BENCH_SQUARE_SIZE 512
+#define __BENCH_RECTS 300
+
+
+/* Places rectangles on as many squares as needed. Returns the number of
+   squares used */
+static int pack_rects(const int* ws, const int* hs, int count,
+    int allow_rotation)
+{
+    stSquare* squares[__BENCH_RECTS] = { NULL };
+    int squares_count = 0;
+
+    for (int i = 0; i < count; i++)
+    {
+        int x = SQ_FAIL;
+        int y = SQ_FAIL;
+        int rotated = 0;
+        for (int s = 0; s < squares_count && x == SQ_FAIL; s++)
+        {
+            sq_get_free_rect_rotatable(squares[s], ws[i], hs[i],
+                allow_rotation, &x, &y, &rotated);
+            if (x != SQ_FAIL)
+                sq_use_rect(squares[s], x, y,
+                    rotated ? hs[i] : ws[i], rotated ? ws[i] : hs[i]);
+        }
+        if (x == SQ_FAIL)
+        {
+            squares[squares_count] = sq_create(__BENCH_SQUARE_SIZE,
+                __BENCH_SQUARE_SIZE);
+            sq_get_free_rect_rotatable(squares[squares_count], ws[i], hs[i],
+                allow_rotation, &x, &y, &rotated);
+            sq_use_rect(squares[squares_count], x, y,
+                rotated ? hs[i] : ws[i], rotated ? ws[i] : hs[i]);
+            squares_count++;
+        }
+    }
+
+    for (int s = 0; s < squares_count; s++)
+        sq_destroy(squares[s]);
+    return squares_count;
+}
+
+
+/**-----------------------------------------------------------------------------
+; @unit_test
+;
+; @brief
+;   Checks that a rectangle which fits only when rotated is placed rotated.
+;
+-----------------------------------------------------------------------------**/
+TEST_BEGIN(test_rotated_placement)
+{
+    int x = SQ_FAIL;
+    int y = SQ_FAIL;
+    int rotated = 0;
+    stSquare* sq = sq_create(16, 16);
+    sq_use_rect(sq, 0, 0, 16, 12);
+
+    sq_get_free_rect_rotatable(sq, 4, 16, 0, &x, &y, &rotated);
+    EXPECT(x, SQ_FAIL);
+
+    sq_get_free_rect_rotatable(sq, 4, 16, 1, &x, &y, &rotated);
+    EXPECT(x, 0);
+    EXPECT(y, 12);
+    EXPECT(rotated, 1);
+
+    sq_destroy(sq);
+    TEST_END
+}
+
+
+/**-----------------------------------------------------------------------------
+; @unit_test
+;
+; @brief
+;   Packs long thin strips of random orientation with and without rotation
+;   and reports the number of layers (squares) needed.
+;
+-----------------------------------------------------------------------------**/
+TEST_BEGIN(bench_rotation_layer_count)
+{
+    int ws[__BENCH_RECTS];
+    int hs[__BENCH_RECTS];
+
+    srand(1);
+    for (int i = 0; i < __BENCH_RECTS; i++)
+    {
+        int length = 128 + rand() % 320;
+        int thickness = 8 + rand() % 24;
+        ws[i] = (rand() % 2) ? length : thickness;
+        hs[i] = (ws[i] == length) ? thickness : length;
+    }
+
+    int layers = pack_rects(ws, hs, __BENCH_RECTS, 0);
+    int layers_rotated = pack_rects(ws, hs, __BENCH_RECTS, 1);
+    OUTPUT("  %d strips: %d layers without rotation, %d layers with "
+        "rotation\n", __BENCH_RECTS, layers, layers_rotated);
+    EXPECT(layers_rotated <= layers, 1);
+    TEST_END
+}
+
+
+RUN_TESTS
+(
+    test_rotated_placement,
+    bench_rotation_layer_count
+)
+
+
+#endif /* SQUARE_TEST */
+#endif /* TEST_RUN */
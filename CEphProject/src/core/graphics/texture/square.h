@@ -32,6 +32,8 @@ void sq_destroy(stSquare* sq);
 void sq_use_rect(stSquare* sq, int x, int y, int w, int h);
 void sq_unuse_rect(stSquare* sq, int x, int y, int w, int h);
 void sq_get_free_rect(const stSquare* sq, int w, int h, int* out_x, int* out_y);
+void sq_get_free_rect_rotatable(const stSquare* sq, int w, int h,
+    int allow_rotation, int* out_x, int* out_y, int* out_rotated);
 void sq_get_used_rect(const stSquare* sq, int* out_w, int* out_h);
 void sq_dbg_print(const stSquare* sq, int x, int y, int w, int h);
 
@@ -8,6 +8,7 @@
 ;   abd - array build data
 ;   lbd - layer build data
 ;   tbd - texture build data
+;   ice - image cache entry
 ;
 ; @date   October 2021
 ; @author Eph
@@ -17,6 +18,7 @@
 
 
 /** @includes ----------------------------------------------------------------*/
+#include <stdint.h> /* intptr_t */
 #include <string.h> /* memcpy */
 
 #include <glad/glad.h>
@@ -24,7 +26,12 @@
 
 #include "texture_builder.h"
 #include "square.h"
+#include "texture_units.h"
+#include "texture_residency.h"
+#include "../../thread.h"
+#include "../../window.h"
 #include "../image.h"
+#include "../pixel.h"
 #include "../../memory.h"
 #include "../../../containers/list.h"
 #include "../../../containers/map.h"
@@ -34,8 +41,17 @@
 
 /** @types -------------------------------------------------------------------*/
 
+/* States of the texture table entries */
+#define HANDLE_FREE     0               /* Not used, can be returned again    */
+#define HANDLE_PENDING  1               /* Returned, filled by the next build */
+#define HANDLE_BUILT    2               /* Filled, released by 'tb_destroy'   */
+
+/* Pixels converted at once by '_convert_subimage' */
+#define CONVERT_CHUNK_SIZE  256
+
+
 /* Information about the texture to be created */
-typedef struct
+typedef struct stTextureBuildData
 {
     /* Path to an image where the texture is located */
     const char* image_path;
@@ -49,15 +65,46 @@ typedef struct
     int subimg_w;
     int subimg_h;
 
-    /* The memory address where the texture information will be written */
-    stTexture* target;
+    /* Storage format of the texture ('TB_FORMAT_*') */
+    int format;
+
+    /* Number of grid cells of a sprite sheet (see 'tb_add_sprite_sheet') and
+       their size. 0 for ordinary textures. The cells have 'cells_count'
+       consecutive handles starting at 'handle' */
+    int cells_count;
+    int cell_w;
+    int cell_h;
+
+    /* Entry of the texture table where the texture information will be
+       written */
+    tb_handle handle;
 
     /* Offset (in pixels) at which the texture will be added to the layer */
     int layer_offset_x;
     int layer_offset_y;
+
+    /* 1 if the texture is placed on the layer rotated by 90 degrees */
+    int is_rotated;
+
+    /* Hash of the subimage pixels */
+    unsigned long long hash;
+
+    /* The texture with the same pixels whose placement is shared with this
+       texture. NULL if the texture is placed by itself */
+    struct stTextureBuildData* duplicate_of;
 }stTextureBuildData;
 
 
+/* Image decoded during the build. Images are decoded once per build, no
+   matter how many textures use them */
+typedef struct stImageCacheEntry
+{
+    const char* image_path;
+    const stImage* image;
+    struct stImageCacheEntry* next;     /* Next entry with the same path hash */
+}stImageCacheEntry;
+
+
 /* Information about the layer to be created */
 typedef struct
 {
@@ -69,42 +116,129 @@ typedef struct
 /* Information about the OpenGL texture 2d array to be created */
 typedef struct
 {
-    GLenum unit;
+    int format;                         /* Format of all array layers         */
     list* layers;                       /* List of 'stLayerBuildData objects  */
 
+    /* Created OpenGL texture 2d array */
+    unsigned int array_id;
+    int width;
+    int height;
+    int depth;
+
 }stArrayBuildData;
 
 
+/* OpenGL description of a 'TB_FORMAT_*' storage format */
+typedef struct
+{
+    GLenum internal_format;             /* Format of the texture 2d array     */
+    GLenum format;                      /* Format of the uploaded pixels      */
+    GLenum type;                        /* Data type of the uploaded pixels   */
+    int bytes_per_pixel;                /* Size of the uploaded pixel         */
+}stFormatInfo;
+
+
 
 /** @static_data -------------------------------------------------------------*/
 
+/* Indexed by 'TB_FORMAT_*' values */
+static const stFormatInfo _formats[TB_FORMATS_COUNT] =
+{
+    { GL_RGBA8,  GL_RGBA, GL_UNSIGNED_BYTE,          4 }, /* TB_FORMAT_RGBA8    */
+    { GL_RGBA4,  GL_RGBA, GL_UNSIGNED_SHORT_4_4_4_4, 2 }, /* TB_FORMAT_RGBA4444 */
+    { GL_RGB565, GL_RGB,  GL_UNSIGNED_SHORT_5_6_5,   2 }, /* TB_FORMAT_RGB565   */
+    { GL_RG8,    GL_RG,   GL_UNSIGNED_BYTE,          2 }, /* TB_FORMAT_RG8      */
+    { GL_R8,     GL_RED,  GL_UNSIGNED_BYTE,          1 }, /* TB_FORMAT_R8       */
+};
+
 /* Stores information about all textures to be built */
 static list* _textures_to_build = NULL; /* List of 'stTextureBuildData'       */
 static map* _texture_groups_to_build = NULL;
 static list* _arrays_to_build = NULL;   /* List of 'stArrayBuildData'         */
 static list* _group_indices = NULL;     /* List of 'int'                      */
 
-/* Stores pointers to created textures. Used to remove them from video
-   memory and CPU */
-static list* _created_textures = NULL;  /* List of 'stTexture'                */
+/* Stores created texture 2d arrays. Used to remove them from video memory */
+static list* _created_arrays = NULL;    /* List of 'unsigned int'             */
+
+/* Textures addressed by handles (see 'tb_get_texture_table') */
+static stTextureTable _table = { NULL, NULL, NULL, NULL, NULL, 0 };
+static unsigned int _table_capacity = 0;
+static unsigned char* _handle_states = NULL; /* 'HANDLE_*' of each handle     */
+static unsigned int* _free_handles = NULL;   /* Stack of released handles     */
+static unsigned int _free_handles_count = 0;
+
+/* 'TB_BUILD_*' flags used by 'tb_build' */
+static unsigned int _build_flags = 0;
+
+/* Images decoded during the current build */
+static map* _images = NULL;             /* Map of 'stImageCacheEntry'         */
+
+/* Textures that share the placement of another texture with the same pixels */
+static list* _duplicates = NULL;        /* List of 'stTextureBuildData'       */
+
+/* Background build started by 'tb_build_async' */
+static stThread* _loader_thread = NULL;
+static volatile int _loader_is_done = 0;
+static GLsync _loader_fence = NULL;     /* Signalled when the uploads of the  */
+                                        /* loader thread are complete         */
+/* 1 while arrays are filled on the loader context, read by both threads */
+static volatile int _is_loader_thread = 0;
+
+/* Statistics of the last build (see 'tb_get_build_stats') */
+static stTextureBuildStats _stats;
+static float* _layers_occupancy = NULL; /* 'stats.layers_count' values        */
+static int _stats_are_final = 1;        /* 1 if the next decode or build      */
+                                        /* starts new statistics              */
+static double _build_start_time = 0.0;
 
 
 
 /** @internal_prototypes -----------------------------------------------------*/
-static unsigned int _create_texture_2d_array(unsigned int unit,
-    int width, int height, int depth);
+static unsigned int _create_texture_2d_array(int width, int height,
+    int depth, int format);
+static void _add_texture_build_data(int group_idx,
+    stTextureBuildData* texture_build_data_ptr);
+static void _build_arrays(void);
+static void _finish_build(void);
+static void _loader_thread_func(void* loader_window_ptr);
+static void _bind_array(unsigned int array_id);
+static void _set_cells_vertices(stTextureBuildData* tbd);
+static tb_handle _alloc_handles(unsigned int count);
+static int _grow_table(unsigned int min_capacity);
+static void* _grow_array(void* old_array, size_t item_size,
+    unsigned int old_count, unsigned int new_capacity);
+static void _set_texture(tb_handle handle, const float* vertices,
+    unsigned int array_id, int z_offset, int format);
 static void _cleanup_build_data(void);
+static void _begin_build_stats(void);
+static void _count_layers(void);
+static void _log_build_stats(void);
+static const stImage* _get_image(const char* image_path);
+static void _free_image_cache_entries(size_t key, void* data);
+static unsigned long long _hash_bytes(unsigned long long hash,
+    const void* data, size_t size);
+static const unsigned char* _get_subimage_row(const stImage* img,
+    const stTextureBuildData* tbd, int y);
+static int _hash_texture(stTextureBuildData* tbd);
+static int _is_same_texture(const stTextureBuildData* a,
+    const stTextureBuildData* b);
+static stTextureBuildData* _find_same_texture(map* textures,
+    const stTextureBuildData* tbd);
+static void _remember_texture(map* textures, stTextureBuildData* tbd);
+static void _destroy_list_item(size_t key, void* data);
+static void _deduplicate_textures(void);
+static void _trim_texture(stTextureBuildData* tbd);
+static void _trim_textures(void);
 static void _fit_texture(stTextureBuildData* tbd);
 static void _fit_texture_group(list* group_textures);
 static int _try_add_texture_on_layer(stTextureBuildData* tbd_what,
     stLayerBuildData* lbd_where);
 static void _remove_texture_from_lyer(stTextureBuildData* tbd,
     stLayerBuildData* lbd);
-static stLayerBuildData* _create_layer_bd(void);
-static stArrayBuildData* _create_array_bd(void);
-static stTexture* _load_texture_into_texture_2d_array(
+static stLayerBuildData* _create_layer_bd(int format);
+static stArrayBuildData* _create_array_bd(int format);
+static int _load_texture_into_texture_2d_array(
     unsigned int array_id,
-    unsigned int unit,
     int z_offset,
     int subimage_x_offset,              // TODO: Use cglm.
     int subimage_y_offset,              // TODO: Use cglm.
@@ -115,10 +249,24 @@ static stTexture* _load_texture_into_texture_2d_array(
     unsigned char const* image_bytes,
     int image_width,                    // TODO: Use cglm.
     int image_height,                   // TODO: Use cglm.
-    int image_channels_count);
+    int image_channels_count,
+    int is_bottom_up,
+    int format,
+    int is_rotated,
+    float* out_vertices);
+static void _rotate_pixels(unsigned char* dst, const unsigned char* src,
+    int w, int h, int bytes_per_pixel);
+static int _is_same_layout(int format, int image_channels_count);
+static int _is_alpha_stored(int format, int image_channels_count);
+static void _convert_subimage(unsigned char* dst, int format,
+    unsigned char const* image_bytes, int image_width, int image_height,
+    int image_channels_count, int is_bottom_up, int x, int y, int w, int h);
+static void _expand_to_rgba(unsigned char* dst, const unsigned char* src,
+    int channels_count, int count);
+static void _pack_rgba(unsigned char* dst, int format,
+    const unsigned char* rgba, int count);
 static void _calculate_array_size(stArrayBuildData* tabd,
     int* out_w, int* out_h);
-static int _get_max_texture_image_units(void);
 static int _get_max_3d_texture_size(void);
 static int _get_max_array_texture_layers(void);
 static int _get_texture_2d_array_width(unsigned int id);
@@ -133,10 +281,10 @@ static int _get_texture_2d_array_height(unsigned int id);
 ; @func tb_add_texture
 ;
 ; @brief
-;   Saves data for texture creation. Returns the address where the information
-;   about the texture created based on the received data will be located.
-;   Information at this address will be filled only after calling the 'tb_build'
-;   function.
+;   Saves data for texture creation. Returns the handle of the texture table
+;   entry (see 'tb_get_texture_table') where the information about the texture
+;   created based on the received data will be located. The entry will be
+;   filled only after calling the 'tb_build' function.
 ;
 ; @params
 ;   group_idx   | Texture group number. Textures with the same group are
@@ -149,18 +297,26 @@ static int _get_texture_2d_array_height(unsigned int id);
 ;               | should be used to create the texture.
 ;   subimg_h    | Height (in pixels) of an image (or a part of an image) that
 ;               | should be used to create the texture.
+;   format      | Storage format of the texture ('TB_FORMAT_*'). Ignored for
+;               | all but the first texture of a group.
 ; @return
-;   stTexture * | Pointer to a memory area that will store information about the
-;               | texture after its creation (i.e. after calling the 'tb_build'
-;               | function).
+;   tb_handle   | Handle of the texture after its creation (i.e. after calling
+;               | the 'tb_build' function). 'TB_INVALID_HANDLE' on failure.
 ;
 -----------------------------------------------------------------------------**/
-stTexture* tb_add_texture(int group_idx, const char* image_path, int subimg_x,
-    int subimg_y, int subimg_w, int subimg_h)
+tb_handle tb_add_texture(int group_idx, const char* image_path, int subimg_x,
+    int subimg_y, int subimg_w, int subimg_h, int format)
 {
-    extern list* _textures_to_build;
-    extern map* _texture_groups_to_build;
-    extern list* _group_indices;
+    if (format < 0 || format >= TB_FORMATS_COUNT)
+    {
+        LOG_ERROR("Unable to add texture [%s]. Unknown texture format [%d].",
+            image_path, format);
+        return TB_INVALID_HANDLE;
+    }
+
+    tb_handle handle = _alloc_handles(1);
+    if (TB_INVALID_HANDLE == handle)
+        return TB_INVALID_HANDLE;
 
     stTextureBuildData* texture_build_data_ptr = m_malloc(sizeof(stTextureBuildData));
     texture_build_data_ptr->image_path = image_path;
@@ -168,36 +324,119 @@ stTexture* tb_add_texture(int group_idx, const char* image_path, int subimg_x,
     texture_build_data_ptr->subimg_y = subimg_y;
     texture_build_data_ptr->subimg_w = subimg_w;
     texture_build_data_ptr->subimg_h = subimg_h;
-    texture_build_data_ptr->target = m_calloc(1, sizeof(stTexture));
-    texture_build_data_ptr->target->texture_info_ptr = m_calloc(1, sizeof(stTextureInfo));
+    texture_build_data_ptr->format = format;
+    texture_build_data_ptr->cells_count = 0;
+    texture_build_data_ptr->cell_w = 0;
+    texture_build_data_ptr->cell_h = 0;
+    texture_build_data_ptr->handle = handle;
 
     texture_build_data_ptr->layer_offset_x = -1; /* Will be filled in build() */
     texture_build_data_ptr->layer_offset_y = -1; /* Will be filled in build() */
+    texture_build_data_ptr->is_rotated = 0;      /* Will be filled in build() */
+    texture_build_data_ptr->hash = 0;            /* Will be filled in build() */
+    texture_build_data_ptr->duplicate_of = NULL; /* Will be filled in build() */
 
-    if (group_idx == TB_NO_GROUP)
+    _add_texture_build_data(group_idx, texture_build_data_ptr);
+    return handle;
+}
+
+
+/**-----------------------------------------------------------------------------
+; @func tb_add_sprite_sheet
+;
+; @brief
+;   Saves data for the creation of 'count' textures from the cells of a grid
+;   image. Cells are 'cell_w' x 'cell_h' pixels and are numbered from left to
+;   right and from top to bottom starting at the upper left corner of the
+;   image. The image is decoded once, and the cells are placed next to each
+;   other as one area, so they are uploaded with one call and their UVs are
+;   calculated in one pass. Sprite sheets are neither trimmed nor
+;   deduplicated.
+;
+; @params
+;   group_idx   | Texture group number (see 'tb_add_texture').
+;   image_path  | Path to the grid image.
+;   cell_w      | Width (in pixels) of a cell.
+;   cell_h      | Height (in pixels) of a cell.
+;   count       | Number of cells to use.
+;   format      | Storage format of the textures ('TB_FORMAT_*').
+; @return
+;   tb_handle   | Handle of the first cell. The cells have 'count' consecutive
+;               | handles that will be filled after calling the 'tb_build'
+;               | function. 'TB_INVALID_HANDLE' on failure.
+;
+-----------------------------------------------------------------------------**/
+tb_handle tb_add_sprite_sheet(int group_idx, const char* image_path,
+    int cell_w, int cell_h, int count, int format)
+{
+    if (format < 0 || format >= TB_FORMATS_COUNT)
     {
-        if(NULL == _textures_to_build)
-            _textures_to_build = list_create();
-        list_push(_textures_to_build, texture_build_data_ptr);
+        LOG_ERROR("Unable to add sprite sheet [%s]. Unknown texture format "
+            "[%d].", image_path, format);
+        return TB_INVALID_HANDLE;
     }
-    else
+    if (cell_w <= 0 || cell_h <= 0 || count <= 0)
     {
-        if (NULL == _texture_groups_to_build)
-            _texture_groups_to_build = map_create();
+        LOG_ERROR("Unable to add sprite sheet [%s]. Invalid [%d] cells of "
+            "[%dx%d] pixels.", image_path, count, cell_w, cell_h);
+        return TB_INVALID_HANDLE;
+    }
 
-        list* cur_group_textures = map_search(_texture_groups_to_build, group_idx);
-        if (NULL == cur_group_textures)
-        {
-            cur_group_textures = list_create();
-            if (NULL == _group_indices)
-                _group_indices = list_create();
-            list_push(_group_indices, (void*)group_idx);
-            map_insert(_texture_groups_to_build, group_idx, cur_group_textures);
-        }
+    /* The image size is needed to lay out the grid. The decoded image stays in
+       the cache and is reused by the build */
+    const stImage* img = _get_image(image_path);
+    if (NULL == img)
+        return TB_INVALID_HANDLE;
 
-        list_push(cur_group_textures, texture_build_data_ptr);
+    int columns = img->width / cell_w;
+    int rows = (columns > 0) ? (count + columns - 1) / columns : 0;
+    if (0 == columns || rows * cell_h > img->height)
+    {
+        LOG_ERROR("Unable to add sprite sheet [%s]. The [%dx%d] image has "
+            "less than [%d] cells of [%dx%d] pixels.", image_path, img->width,
+            img->height, count, cell_w, cell_h);
+        return TB_INVALID_HANDLE;
     }
-    return texture_build_data_ptr->target;
+
+    tb_handle handle = _alloc_handles(count);
+    if (TB_INVALID_HANDLE == handle)
+        return TB_INVALID_HANDLE;
+
+    stTextureBuildData* tbd = m_malloc(sizeof(stTextureBuildData));
+    tbd->image_path = image_path;
+    tbd->subimg_x = 0;
+    tbd->subimg_y = 0;
+    tbd->subimg_w = ((count < columns) ? count : columns) * cell_w;
+    tbd->subimg_h = rows * cell_h;
+    tbd->format = format;
+    tbd->cells_count = count;
+    tbd->cell_w = cell_w;
+    tbd->cell_h = cell_h;
+    tbd->handle = handle;
+
+    tbd->layer_offset_x = -1;           /* Will be filled in build()          */
+    tbd->layer_offset_y = -1;           /* Will be filled in build()          */
+    tbd->is_rotated = 0;                /* Will be filled in build()          */
+    tbd->hash = 0;                      /* Not deduplicated                   */
+    tbd->duplicate_of = NULL;
+
+    _add_texture_build_data(group_idx, tbd);
+    return handle;
+}
+
+
+/**-----------------------------------------------------------------------------
+; @func tb_set_build_flags
+;
+; @brief
+;   Sets the 'TB_BUILD_*' flags used by the next calls to the 'tb_build'
+;   function.
+;
+-----------------------------------------------------------------------------**/
+void tb_set_build_flags(unsigned int flags)
+{
+    extern unsigned int _build_flags;
+    _build_flags = flags;
 }
 
 
@@ -205,24 +444,142 @@ stTexture* tb_add_texture(int group_idx, const char* image_path, int subimg_x,
 ; @func tb_build
 ;
 ; @brief
-;   Creates and places textures on certain OpenGL texture 2d arrays, units and
+;   Creates and places textures on certain OpenGL texture 2d arrays and
 ;   layers.
 ;
 -----------------------------------------------------------------------------**/
 void tb_build(void)
+{
+    /* Remove from video memory textures created during the previous call to the
+       'tb_build' function */
+    tb_destroy();
+
+    _begin_build_stats();
+    _build_start_time = glfwGetTime();
+    _build_arrays();
+    _finish_build();
+}
+
+
+/**-----------------------------------------------------------------------------
+; @func tb_build_async
+;
+; @brief
+;   Starts building the added textures on a background thread that uses the
+;   hidden shared context of the window (see 'window_init'), so the main loop
+;   keeps rendering while images are decoded and uploaded. Textures of the
+;   previous build are destroyed immediately. Neither the added textures nor
+;   other 'tb_*' functions may be used until 'tb_is_build_done' returns 1.
+;
+;   If there is no shared context, the textures are built synchronously.
+;
+-----------------------------------------------------------------------------**/
+void tb_build_async(void)
+{
+    extern stThread* _loader_thread;
+    extern volatile int _loader_is_done;
+
+    if (_loader_thread != NULL)
+    {
+        LOG_ERROR("Unable to start building textures. The previous build is "
+            "still in progress.");
+        return;
+    }
+
+    tb_destroy();
+
+    _begin_build_stats();
+    _build_start_time = glfwGetTime();
+
+    void* loader_window_ptr = window_get_glfw_loader_window_ptr();
+    if (loader_window_ptr != NULL)
+    {
+        th_atomic_store(&_loader_is_done, 0);
+        _loader_thread = th_create(_loader_thread_func, loader_window_ptr);
+        if (_loader_thread != NULL)
+            return;
+    }
+
+    LOG_WARNING("Textures are built on the main thread.");
+    _build_arrays();
+    _finish_build();
+}
+
+
+/**-----------------------------------------------------------------------------
+; @func tb_is_build_done
+;
+; @brief
+;   Checks whether the build started by 'tb_build_async' is complete, i.e. the
+;   loader thread has finished and the GPU has executed its uploads. Must be
+;   called from the main thread (for example once per frame); the first call
+;   that returns 1 makes the built textures available.
+;
+; @return
+;   1 if no build is in progress, 0 otherwise.
+;
+-----------------------------------------------------------------------------**/
+int tb_is_build_done(void)
+{
+    extern stThread* _loader_thread;
+    extern volatile int _loader_is_done;
+    extern GLsync _loader_fence;
+
+    if (NULL == _loader_thread)
+        return 1;
+
+    if (!th_atomic_load(&_loader_is_done))
+        return 0;
+
+    if (_loader_fence != NULL)
+    {
+        GLenum result = glClientWaitSync(_loader_fence, 0, 0);
+        if (GL_TIMEOUT_EXPIRED == result)
+            return 0;
+        if (GL_WAIT_FAILED == result)
+        {
+            LOG_ERROR("Unable to wait for the texture uploads.");
+        }
+        GL_CALL(glDeleteSync(_loader_fence));
+        _loader_fence = NULL;
+    }
+
+    th_join(_loader_thread);
+    _loader_thread = NULL;
+    _finish_build();
+    return 1;
+}
+
+
+/**-----------------------------------------------------------------------------
+; @func _build_arrays
+;
+; @brief
+;   Places the added textures on layers and arrays, creates the arrays and
+;   uploads the textures using the current OpenGL context.
+;
+-----------------------------------------------------------------------------**/
+static void _build_arrays(void)
 {
     extern list* _arrays_to_build;
     extern list* _textures_to_build;
     extern map* _texture_groups_to_build;
     extern list* _group_indices;
-    extern list* _created_textures;
-
-    /* Remove from video memory textures created during the previous call to the
-       'tb_build' function */
-    tb_destroy();
+    extern list* _created_arrays;
 
     _arrays_to_build = list_create();
 
+    /* Images decoded while placing the textures are not counted as placement
+       time */
+    double placement_start = glfwGetTime();
+    double decode_time = _stats.decode_time;
+
+    /* Remove fully transparent borders */
+    if (_build_flags & TB_BUILD_TRIM_TRANSPARENT)
+        _trim_textures();
+
+    /* Textures with the same pixels are placed once */
+    _deduplicate_textures();
 
     /* Find free space (array and layer) for the current texture */
     if (_textures_to_build != NULL)
@@ -243,7 +600,12 @@ void tb_build(void)
             _fit_texture_group(map_search(_texture_groups_to_build, group_index));
         }
     }
-   
+
+    _stats.placement_time += glfwGetTime() - placement_start -
+        (_stats.decode_time - decode_time);
+    _count_layers();
+    int layer_idx = 0;
+
     for (list_node* abd_node = _arrays_to_build->nodes; abd_node != NULL; abd_node = abd_node->next)
     {
         stArrayBuildData* abd = abd_node->data;
@@ -252,150 +614,625 @@ void tb_build(void)
         int array_h = -1;
 
         /* Calculate required array size */
+        double sizing_start = glfwGetTime();
         _calculate_array_size(abd, &array_w, &array_h);
         int array_z = list_get_size(abd->layers);
 
-        unsigned int texture_2d_array = _create_texture_2d_array(abd->unit, array_w, array_h, array_z);
+        unsigned int texture_2d_array = _create_texture_2d_array(
+            array_w, array_h, array_z, abd->format);
+        _stats.sizing_time += glfwGetTime() - sizing_start;
+
+        /* Save the created array to remove it in 'tb_destroy' */
+        if (texture_2d_array != 0)
+        {
+            if (NULL == _created_arrays)
+                _created_arrays = list_create();
+            list_push(_created_arrays, (void*)(size_t)texture_2d_array);
+        }
 
         int cur_z_offset = 0;
 
         for (list_node* lbd_node = abd->layers->nodes; lbd_node != NULL; lbd_node = lbd_node->next)
         {
             stLayerBuildData* lbd = lbd_node->data;
+            size_t covered_pixels = 0;
 
             for (list_node* tbd_node = lbd->textures->nodes; tbd_node != NULL; tbd_node = tbd_node->next)
             {
                 stTextureBuildData* tbd = tbd_node->data;
-
-                // TODO: In order not to open and close the same image several times,
-                //       create a tree in which the key is the path to the image and
-                //       process the textures in the correct order.
-                const stImage* img = load_image(tbd->image_path);
-                stTexture* loaded_txd = _load_texture_into_texture_2d_array(
-                    texture_2d_array, abd->unit, cur_z_offset,
+                covered_pixels += (size_t)tbd->subimg_w * tbd->subimg_h;
+
+                const stImage* img = _get_image(tbd->image_path);
+                if (NULL == img)
+                    continue;
+                double upload_start = glfwGetTime();
+                float vertices[8];
+                int result = _load_texture_into_texture_2d_array(
+                    texture_2d_array, cur_z_offset,
                     tbd->layer_offset_x, tbd->layer_offset_y,
                     tbd->subimg_w, tbd->subimg_h,
                     tbd->subimg_x, tbd->subimg_y,
                     img->data_ptr,
                     img->width, img->height,
-                    img->channels_count);
-                free_image(img);
-
-                loaded_txd->texture_info_ptr->unit -= GL_TEXTURE0;
-
-                memcpy(tbd->target->vertices, loaded_txd->vertices, sizeof(float) * 8);
-                memcpy(tbd->target->texture_info_ptr, loaded_txd->texture_info_ptr, sizeof(stTextureInfo));
-                m_free(loaded_txd->texture_info_ptr);
-                m_free(loaded_txd);
-                
-                /* Save the address of the created texture */
-                if (NULL == _created_textures)
-                    _created_textures = list_create();
-                list_push(_created_textures, tbd->target);
+                    img->channels_count,
+                    img->is_cooked,
+                    tbd->format,
+                    tbd->is_rotated,
+                    vertices);
+                _stats.upload_time += glfwGetTime() - upload_start;
+                if (result != 0)
+                    continue;
+
+                _stats.textures_uploaded++;
+                _stats.bytes_uploaded += (size_t)tbd->subimg_w *
+                    tbd->subimg_h * _formats[tbd->format].bytes_per_pixel;
+
+                _set_texture(tbd->handle, vertices, texture_2d_array,
+                    cur_z_offset, tbd->format);
+
+                /* Split the sprite sheet area into cells */
+                if (tbd->cells_count > 0)
+                    _set_cells_vertices(tbd);
+            }
+
+            if (_layers_occupancy != NULL && array_w > 0 && array_h > 0)
+            {
+                _layers_occupancy[layer_idx] =
+                    (float)covered_pixels / ((size_t)array_w * array_h);
             }
+            layer_idx++;
             cur_z_offset++;
         }
+
+        abd->array_id = texture_2d_array;
+        abd->width = array_w;
+        abd->height = array_h;
+        abd->depth = array_z;
     }
 
-    _cleanup_build_data();
+    /* Duplicates get the placement of the textures they share pixels with */
+    if (_duplicates != NULL)
+    {
+        size_t saved_bytes = 0;
+        for (list_node* tbd_node = _duplicates->nodes; tbd_node != NULL; tbd_node = tbd_node->next)
+        {
+            stTextureBuildData* tbd = tbd_node->data;
+            tb_handle original = tbd->duplicate_of->handle;
+
+            _set_texture(tbd->handle, _table.vertices[original],
+                _table.array_ids[original], _table.z_offsets[original],
+                _table.formats[original]);
+            saved_bytes += (size_t)tbd->subimg_w * tbd->subimg_h *
+                _formats[tbd->format].bytes_per_pixel;
+        }
+        _stats.duplicates_count = list_get_size(_duplicates) - 1;
+        LOG_MSG("Texture builder: %d duplicate textures share placement with "
+            "identical ones, %zu bytes of video memory saved.",
+            _stats.duplicates_count, saved_bytes);
+    }
 }
 
 
 /**-----------------------------------------------------------------------------
-; @func tb_destroy
+; @func _finish_build
 ;
 ; @brief
-;   Completely removes textures created by the last call to the 'tb_buIld'
-;   function:
-;     - Removes created textures (arrays of 2d textures) from video memory.
-;     - Frees memory allocated for each 'stTexture' object created in the
-;       'tb_create' function (all pointers that were returned by this function
-;       become invalid).
+;   Main thread part of the build: hands the created arrays over to the
+;   residency manager, marks the added handles as built, frees the build
+;   data and completes the build statistics.
 ;
 -----------------------------------------------------------------------------**/
-void tb_destroy(void)
+static void _finish_build(void)
 {
-    extern list* _created_textures;
+    extern list* _arrays_to_build;
+    extern stTextureTable _table;
+    extern unsigned char* _handle_states;
+    extern stTextureBuildStats _stats;
+    extern int _stats_are_final;
 
-    if (NULL == _created_textures)
-        return;
+    double cleanup_start = glfwGetTime();
+
+    for (list_node* abd_node = _arrays_to_build->nodes; abd_node != NULL; abd_node = abd_node->next)
+    {
+        stArrayBuildData* abd = abd_node->data;
 
-    for (list_node* texture_node = _created_textures->nodes;
-        texture_node != NULL;
-        texture_node = texture_node->next)
+        /* Let the residency manager evict the array when it is not used */
+        if (abd->array_id != 0)
+        {
+            tr_register(abd->array_id, abd->width, abd->height, abd->depth,
+                _formats[abd->format].internal_format,
+                _formats[abd->format].format,
+                _formats[abd->format].type,
+                _formats[abd->format].bytes_per_pixel);
+        }
+    }
+
+    /* Handles added after the previous build are released by the next
+       'tb_destroy' call */
+    for (unsigned int handle = 1; handle < _table.count; handle++)
     {
-        stTexture* texture_ptr = texture_node->data;
-        GL_CALL(glDeleteTextures(1, &(texture_ptr->texture_info_ptr->array_id)));
-        m_free(texture_ptr->texture_info_ptr);
-        m_free(texture_ptr);
+        if (HANDLE_PENDING == _handle_states[handle])
+            _handle_states[handle] = HANDLE_BUILT;
     }
-    list_destroy(_created_textures);
-    _created_textures = NULL;
+
+    _cleanup_build_data();
+
+    double now = glfwGetTime();
+    _stats.cleanup_time += now - cleanup_start;
+    _stats.total_time = now - _build_start_time;
+    _stats.average_occupancy = 0.0f;
+    for (int i = 0; i < _stats.layers_count; i++)
+        _stats.average_occupancy += _layers_occupancy[i] / _stats.layers_count;
+    _stats_are_final = 1;
+
+    if (_build_flags & TB_BUILD_LOG_STATS)
+        _log_build_stats();
 }
 
 
-static unsigned int _create_texture_2d_array(unsigned int unit,
-    int width, int height, int depth)
+static void _loader_thread_func(void* loader_window_ptr)
 {
-    unsigned int texture_2d_array = 0;
+    extern volatile int _loader_is_done;
+    extern GLsync _loader_fence;
+    extern volatile int _is_loader_thread;
+
+    glfwMakeContextCurrent(loader_window_ptr);
+    th_atomic_store(&_is_loader_thread, 1);
+
+    _build_arrays();
+
+    /* The main context may use the arrays only after the GPU has executed the
+       uploads */
+    _loader_fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    GL_CALL(glFlush());
+
+    th_atomic_store(&_is_loader_thread, 0);
+    glfwMakeContextCurrent(NULL);
+    th_atomic_store(&_loader_is_done, 1);
+}
+
+
+/**-----------------------------------------------------------------------------
+; @func _bind_array
+;
+; @brief
+;   Binds the texture 2d array to the active unit for filling. On the main
+;   context the unit is taken from the 'texture_units' module, so its cache of
+;   bound arrays stays valid. The loader context binds directly.
+;
+-----------------------------------------------------------------------------**/
+static void _bind_array(unsigned int array_id)
+{
+    extern volatile int _is_loader_thread;
 
-    GLenum max_texture_image_units = (GLenum)_get_max_texture_image_units();
-    if ((unit - GL_TEXTURE0) >= max_texture_image_units)
+    if (th_atomic_load(&_is_loader_thread))
     {
-        LOG_ERROR("Unable to create texture 2d array. Unit number [%d] is "
-            "greater than the maximum allowed on this device. Valid unit "
-            "range: [0...%d].",
-            unit - GL_TEXTURE0, max_texture_image_units - 1);
-        return 0;
+        GL_CALL(glBindTexture(GL_TEXTURE_2D_ARRAY, array_id));
+        return;
     }
 
-    int max_3d_texture_size = _get_max_3d_texture_size();
-    if (width > max_3d_texture_size || height > max_3d_texture_size)
+    tu_begin_batch();
+    GL_CALL(glActiveTexture(GL_TEXTURE0 + tu_bind(array_id)));
+}
+
+
+/* Adds the texture to the ungrouped textures or to its group */
+static void _add_texture_build_data(int group_idx,
+    stTextureBuildData* texture_build_data_ptr)
+{
+    extern list* _textures_to_build;
+    extern map* _texture_groups_to_build;
+    extern list* _group_indices;
+
+    if (group_idx == TB_NO_GROUP)
     {
-        LOG_ERROR("Unable to create texture 2d array. The maximum supported "
-            "texture image size [%d] has been exceeded.", max_3d_texture_size);
-        return 0;
+        if(NULL == _textures_to_build)
+            _textures_to_build = list_create();
+        list_push(_textures_to_build, texture_build_data_ptr);
     }
-
-    int max_array_texture_layers = _get_max_array_texture_layers();
-    if (depth > max_array_texture_layers)
+    else
     {
-        LOG_ERROR("Unable to create texture 2d array. The maximum number of "
-            "texture layers [%d] has been exceeded.", max_array_texture_layers);
-        return 0;
+        if (NULL == _texture_groups_to_build)
+            _texture_groups_to_build = map_create();
+
+        list* cur_group_textures = map_search(_texture_groups_to_build, group_idx);
+        if (NULL == cur_group_textures)
+        {
+            cur_group_textures = list_create();
+            if (NULL == _group_indices)
+                _group_indices = list_create();
+            list_push(_group_indices, (void*)group_idx);
+            map_insert(_texture_groups_to_build, group_idx, cur_group_textures);
+        }
+        else
+        {
+            /* All group textures are placed on one layer, so they must share
+               the storage format of the first texture of the group */
+            stTextureBuildData* first_tbd = cur_group_textures->nodes->data;
+            if (first_tbd->format != texture_build_data_ptr->format)
+            {
+                LOG_WARNING("Texture [%s] is converted to the format [%d] of "
+                    "the group [%d].", texture_build_data_ptr->image_path,
+                    first_tbd->format, group_idx);
+                texture_build_data_ptr->format = first_tbd->format;
+            }
+        }
+
+        list_push(cur_group_textures, texture_build_data_ptr);
     }
+}
 
-    /* Save the currently activated texture unit */
-    int used_unit = 0;
-    GL_CALL(glGetIntegerv(GL_ACTIVE_TEXTURE, &used_unit));
 
-    /* Save the currently bound texture 2d array */
-    //int bound_texture = 0;
-    //GL_CALL(glGetIntegerv(GL_TEXTURE_BINDING_2D_ARRAY, &bound_texture));
+/**-----------------------------------------------------------------------------
+; @func _set_cells_vertices
+;
+; @brief
+;   Calculates the vertices of each sprite sheet cell from the vertices of the
+;   whole sheet area (stored in the first cell). The cell corners are
+;   interpolated between the area corners, so rotated areas are handled too.
+;   All cells get the array, layer and format of the first cell.
+;
+-----------------------------------------------------------------------------**/
+static void _set_cells_vertices(stTextureBuildData* tbd)
+{
+    extern stTextureTable _table;
 
-    GL_CALL(glActiveTexture(unit));
+    float (*cells)[8] = _table.vertices + tbd->handle;
+    const float* area = cells[0];
 
-    /* Generate a 2d texture array object */
-    GL_CALL(glGenTextures(1, &texture_2d_array));
+    /* The top left corner of the area and the steps along its top and left
+       edges */
+    const float top_left[2] = { area[6], area[7] };
+    const float right[2] = { area[0] - area[6], area[1] - area[7] };
+    const float down[2] = { area[4] - area[6], area[5] - area[7] };
 
-    /* Set 'texture_2d_array' as the current vertex array object */
-    GL_CALL(glBindTexture(GL_TEXTURE_2D_ARRAY, texture_2d_array));
+    int columns = tbd->subimg_w / tbd->cell_w;
+    float cell_u = (float)tbd->cell_w / tbd->subimg_w;
+    float cell_v = (float)tbd->cell_h / tbd->subimg_h;
 
-    GL_CALL(glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST));
-    GL_CALL(glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST));
-    GL_CALL(glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT));
-    GL_CALL(glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT));
-    GL_CALL(glTexImage3D(
-        GL_TEXTURE_2D_ARRAY,            /* Target to which the texture is     */
-                                        /* bound                              */
+    /* The first cell is calculated last, since it stores the area vertices */
+    for (int i = tbd->cells_count - 1; i >= 0; i--)
+    {
+        float u0 = (i % columns) * cell_u;
+        float v0 = (i / columns) * cell_v;
+        float u1 = u0 + cell_u;
+        float v1 = v0 + cell_v;
+
+        /* Top right, bottom right, bottom left, top left */
+        const float corners[4][2] = { { u1, v0 }, { u1, v1 }, { u0, v1 },
+            { u0, v0 } };
+        for (int c = 0; c < 4; c++)
+        {
+            cells[i][c * 2] = top_left[0] +
+                corners[c][0] * right[0] + corners[c][1] * down[0];
+            cells[i][c * 2 + 1] = top_left[1] +
+                corners[c][0] * right[1] + corners[c][1] * down[1];
+        }
+
+        tb_handle cell = tbd->handle + i;
+        _table.array_ids[cell] = _table.array_ids[tbd->handle];
+        _table.z_offsets[cell] = _table.z_offsets[tbd->handle];
+        _table.formats[cell] = _table.formats[tbd->handle];
+    }
+}
+
+
+/**-----------------------------------------------------------------------------
+; @func _alloc_handles
+;
+; @brief
+;   Returns 'count' consecutive handles of the texture table. Single handles
+;   released by 'tb_destroy' are reused, runs of handles are always taken from
+;   the end of the table. The entries are reset to an unbuilt texture.
+;
+; @return
+;   tb_handle | The first handle or 'TB_INVALID_HANDLE' on failure.
+;
+-----------------------------------------------------------------------------**/
+static tb_handle _alloc_handles(unsigned int count)
+{
+    extern stTextureTable _table;
+    extern unsigned char* _handle_states;
+    extern unsigned int* _free_handles;
+    extern unsigned int _free_handles_count;
+
+    tb_handle handle;
+    if (1 == count && _free_handles_count > 0)
+    {
+        handle = _free_handles[--_free_handles_count];
+    }
+    else
+    {
+        /* Handle 0 is never used */
+        unsigned int first = (0 == _table.count) ? 1 : _table.count;
+        if (_grow_table(first + count) != 0)
+            return TB_INVALID_HANDLE;
+        handle = first;
+        _table.count = first + count;
+    }
+
+    for (tb_handle h = handle; h < handle + count; h++)
+    {
+        memset(_table.vertices[h], 0, sizeof(_table.vertices[h]));
+        _table.trims[h][0] = 0.0f;
+        _table.trims[h][1] = 0.0f;
+        _table.trims[h][2] = 1.0f;
+        _table.trims[h][3] = 1.0f;
+        _table.array_ids[h] = 0;
+        _table.z_offsets[h] = 0;
+        _table.formats[h] = 0;
+        _handle_states[h] = HANDLE_PENDING;
+    }
+    return handle;
+}
+
+
+/**-----------------------------------------------------------------------------
+; @func _grow_table
+;
+; @brief
+;   Makes the texture table arrays large enough for 'min_capacity' handles.
+;   The capacity is doubled, so adding textures one by one copies each entry
+;   a constant number of times on average.
+;
+; @return
+;   int | 0 on success, -1 if there is not enough memory.
+;
+-----------------------------------------------------------------------------**/
+static int _grow_table(unsigned int min_capacity)
+{
+    extern stTextureTable _table;
+    extern unsigned int _table_capacity;
+    extern unsigned char* _handle_states;
+    extern unsigned int* _free_handles;
+
+    if (min_capacity <= _table_capacity)
+        return 0;
+
+    unsigned int capacity = (_table_capacity > 0) ? _table_capacity : 64;
+    while (capacity < min_capacity)
+        capacity *= 2;
+
+    unsigned int n = _table.count;
+    void* vertices = _grow_array(_table.vertices, sizeof(float[8]), n, capacity);
+    void* trims = _grow_array(_table.trims, sizeof(float[4]), n, capacity);
+    void* array_ids = _grow_array(_table.array_ids, sizeof(unsigned int), n,
+        capacity);
+    void* z_offsets = _grow_array(_table.z_offsets, sizeof(int), n, capacity);
+    void* formats = _grow_array(_table.formats, sizeof(unsigned char), n,
+        capacity);
+    void* states = _grow_array(_handle_states, sizeof(unsigned char), n,
+        capacity);
+
+    /* The stack never holds more handles than the table */
+    void* free_handles = _grow_array(_free_handles, sizeof(unsigned int),
+        _table_capacity, capacity);
+
+    if (NULL == vertices || NULL == trims || NULL == array_ids ||
+        NULL == z_offsets || NULL == formats || NULL == states ||
+        NULL == free_handles)
+    {
+        LOG_ERROR("Unable to grow the texture table to [%u] handles.",
+            capacity);
+        m_free(vertices);
+        m_free(trims);
+        m_free(array_ids);
+        m_free(z_offsets);
+        m_free(formats);
+        m_free(states);
+        m_free(free_handles);
+        return -1;
+    }
+
+    m_free(_table.vertices);
+    m_free(_table.trims);
+    m_free(_table.array_ids);
+    m_free(_table.z_offsets);
+    m_free(_table.formats);
+    m_free(_handle_states);
+    m_free(_free_handles);
+
+    _table.vertices = vertices;
+    _table.trims = trims;
+    _table.array_ids = array_ids;
+    _table.z_offsets = z_offsets;
+    _table.formats = formats;
+    _handle_states = states;
+    _free_handles = free_handles;
+    _table_capacity = capacity;
+    return 0;
+}
+
+
+static void* _grow_array(void* old_array, size_t item_size,
+    unsigned int old_count, unsigned int new_capacity)
+{
+    void* new_array = m_malloc(item_size * new_capacity);
+    if (new_array != NULL && old_array != NULL)
+        memcpy(new_array, old_array, item_size * old_count);
+    return new_array;
+}
+
+
+static void _set_texture(tb_handle handle, const float* vertices,
+    unsigned int array_id, int z_offset, int format)
+{
+    extern stTextureTable _table;
+
+    memcpy(_table.vertices[handle], vertices, sizeof(_table.vertices[handle]));
+    _table.array_ids[handle] = array_id;
+    _table.z_offsets[handle] = z_offset;
+    _table.formats[handle] = (unsigned char)format;
+}
+
+
+/**-----------------------------------------------------------------------------
+; @func tb_destroy
+;
+; @brief
+;   Completely removes textures created by the last call to the 'tb_buIld'
+;   function:
+;     - Removes created textures (arrays of 2d textures) from video memory.
+;     - Releases the handles of the built textures (all handles that were
+;       returned by the 'tb_add_*' functions before the build become invalid).
+;
+-----------------------------------------------------------------------------**/
+void tb_destroy(void)
+{
+    extern list* _created_arrays;
+    extern stTextureTable _table;
+    extern unsigned char* _handle_states;
+    extern unsigned int* _free_handles;
+    extern unsigned int _free_handles_count;
+
+    if (_created_arrays != NULL)
+    {
+        for (list_node* array_node = _created_arrays->nodes;
+            array_node != NULL;
+            array_node = array_node->next)
+        {
+            unsigned int array_id = (unsigned int)(size_t)array_node->data;
+            tu_release(array_id);
+            tr_unregister(array_id);
+            GL_CALL(glDeleteTextures(1, &array_id));
+        }
+        list_destroy(_created_arrays);
+        _created_arrays = NULL;
+    }
+
+    int has_pending = 0;
+    for (unsigned int handle = 1; handle < _table.count; handle++)
+    {
+        if (HANDLE_BUILT == _handle_states[handle])
+        {
+            _handle_states[handle] = HANDLE_FREE;
+            _free_handles[_free_handles_count++] = handle;
+        }
+        else if (HANDLE_PENDING == _handle_states[handle])
+        {
+            has_pending = 1;
+        }
+    }
+
+    /* Without textures waiting for the next build the whole table is free */
+    if (!has_pending)
+    {
+        _table.count = 0;
+        _free_handles_count = 0;
+    }
+}
+
+
+/**-----------------------------------------------------------------------------
+; @func tb_get_texture_table
+;
+; @brief
+;   Returns the texture table. The entry of a texture is the one at the index
+;   equal to its handle.
+;
+-----------------------------------------------------------------------------**/
+const stTextureTable* tb_get_texture_table(void)
+{
+    extern stTextureTable _table;
+    return &_table;
+}
+
+
+/**-----------------------------------------------------------------------------
+; @func tb_get_build_stats
+;
+; @brief
+;   Returns the statistics of the last complete build ('tb_build' or
+;   'tb_build_async' + 'tb_is_build_done'). Set the 'TB_BUILD_LOG_STATS' flag
+;   to log them after each build.
+;
+-----------------------------------------------------------------------------**/
+void tb_get_build_stats(stTextureBuildStats* out_stats)
+{
+    extern stTextureBuildStats _stats;
+
+    *out_stats = _stats;
+}
+
+
+/**-----------------------------------------------------------------------------
+; @func tb_trim_rect
+;
+; @brief
+;   Adjusts the rectangle on which the whole (untrimmed) texture would be drawn
+;   to the part of it covered by the trimmed texture (see
+;   'stTextureTable.trims').
+;   The y-axis is expected to point down.
+;
+; @params
+;   texture | Handle of a built texture.
+;   pos     | [in/out] Position of the upper left corner of the rectangle.
+;   size    | [in/out] Size of the rectangle.
+;
+-----------------------------------------------------------------------------**/
+void tb_trim_rect(tb_handle texture, float* pos, float* size)
+{
+    extern stTextureTable _table;
+
+    const float* trim = _table.trims[texture];
+    pos[0] += trim[0] * size[0];
+    pos[1] += trim[1] * size[1];
+    size[0] *= trim[2];
+    size[1] *= trim[3];
+}
+
+
+static unsigned int _create_texture_2d_array(int width, int height,
+    int depth, int format)
+{
+    unsigned int texture_2d_array = 0;
+
+    int max_3d_texture_size = _get_max_3d_texture_size();
+    if (width > max_3d_texture_size || height > max_3d_texture_size)
+    {
+        LOG_ERROR("Unable to create texture 2d array. The maximum supported "
+            "texture image size [%d] has been exceeded.", max_3d_texture_size);
+        return 0;
+    }
+
+    int max_array_texture_layers = _get_max_array_texture_layers();
+    if (depth > max_array_texture_layers)
+    {
+        LOG_ERROR("Unable to create texture 2d array. The maximum number of "
+            "texture layers [%d] has been exceeded.", max_array_texture_layers);
+        return 0;
+    }
+
+    /* Save the currently activated texture unit */
+    int used_unit = 0;
+    GL_CALL(glGetIntegerv(GL_ACTIVE_TEXTURE, &used_unit));
+
+    /* Save the currently bound texture 2d array */
+    //int bound_texture = 0;
+    //GL_CALL(glGetIntegerv(GL_TEXTURE_BINDING_2D_ARRAY, &bound_texture));
+
+    /* Generate a 2d texture array object */
+    GL_CALL(glGenTextures(1, &texture_2d_array));
+
+    /* Bind 'texture_2d_array' to any unit and make the unit active */
+    _bind_array(texture_2d_array);
+
+    GL_CALL(glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST));
+    GL_CALL(glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST));
+    GL_CALL(glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT));
+    GL_CALL(glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT));
+    GL_CALL(glTexImage3D(
+        GL_TEXTURE_2D_ARRAY,            /* Target to which the texture is     */
+                                        /* bound                              */
         0,                              /* Level                              */
-        GL_RGBA8,                       /* Internal format                    */
+        _formats[format].internal_format,
+                                        /* Internal format                    */
         width,                          /* Width of the 2d texture array      */
         height,                         /* Heigh of the 2d texture array      */
         depth,                          /* Depth of the 2d texture array      */
         0,                              /* Border, must be 0                  */
-        GL_RGBA,                        /* Format of the pixel data           */
-        GL_UNSIGNED_BYTE,               /* Data type of the pixel data        */
+        _formats[format].format,        /* Format of the pixel data           */
+        _formats[format].type,          /* Data type of the pixel data        */
         NULL));                         /* A pointer to the image data        */
 
     /* Restore previous used texture unit */
@@ -404,69 +1241,566 @@ static unsigned int _create_texture_2d_array(unsigned int unit,
     /* Restore previous bound texture 2d array */
     //GL_CALL(glBindTexture(GL_TEXTURE_2D_ARRAY, bound_texture));
 
-    return texture_2d_array;
+    return texture_2d_array;
+}
+
+
+/**-----------------------------------------------------------------------------
+; @func _cleanup_build_data
+;
+; @brief
+;   Zeroes pointers and frees memory that was used to create textures and
+;   distribute them across OpenGL texture 2d arrays and layers.
+;
+-----------------------------------------------------------------------------**/
+static void _cleanup_build_data(void)
+{
+    extern list* _arrays_to_build;
+    extern list* _textures_to_build;
+    extern map* _texture_groups_to_build;
+    extern list* _group_indices;
+    extern list* _duplicates;
+    extern map* _images;
+
+    for (list_node* abd_node = _arrays_to_build->nodes; abd_node != NULL; abd_node = abd_node->next)
+    {
+        stArrayBuildData* abd = abd_node->data;
+        for (list_node* lbd_node = abd->layers->nodes; lbd_node != NULL; lbd_node = lbd_node->next)
+        {
+            stLayerBuildData* lbd = lbd_node->data;
+
+            for (list_node* tbd_node = lbd->textures->nodes; tbd_node != NULL; tbd_node = tbd_node->next)
+            {
+                m_free(tbd_node->data);
+            }
+            list_destroy(lbd->textures);
+            sq_destroy(lbd->square);
+            m_free(lbd);
+        }
+        list_destroy(abd->layers);
+        m_free(abd);
+    }
+    list_destroy(_arrays_to_build);     // TODO: if(NULL == _arrays_to_build)
+    list_destroy(_textures_to_build);   // TODO: if(NULL != _textures_to_build)
+
+    /* Duplicates are not placed on any layer, so they are freed separately */
+    if (_duplicates != NULL)
+    {
+        for (list_node* tbd_node = _duplicates->nodes; tbd_node != NULL; tbd_node = tbd_node->next)
+            m_free(tbd_node->data);
+        list_destroy(_duplicates);
+        _duplicates = NULL;
+    }
+
+    /* Free all images decoded during the build */
+    if (_images != NULL)
+    {
+        map_for_each_item(_images, _free_image_cache_entries);
+        map_destroy(_images);
+        _images = NULL;
+    }
+
+    _arrays_to_build = NULL;
+    _textures_to_build = NULL;
+
+    if (_texture_groups_to_build != NULL)
+    {
+        for (list_node* group_index_node = _group_indices->nodes; group_index_node != NULL; group_index_node = group_index_node->next)
+        {
+            int group_index = (int)(group_index_node->data);
+            list_destroy(map_search(_texture_groups_to_build, group_index));
+        }
+        map_destroy(_texture_groups_to_build);
+        list_destroy(_group_indices);
+        _texture_groups_to_build = NULL;
+        _group_indices = NULL;
+    }
+
+    /* The decoded images are freed, so their pooled blocks are not needed */
+    m_pool_trim();
+}
+
+
+/**-----------------------------------------------------------------------------
+; @func _begin_build_stats
+;
+; @brief
+;   Starts new build statistics unless they are already being collected. The
+;   statistics are collected from the first image decoded for the build (see
+;   'tb_add_sprite_sheet') until the end of the build.
+;
+-----------------------------------------------------------------------------**/
+static void _begin_build_stats(void)
+{
+    extern stTextureBuildStats _stats;
+    extern float* _layers_occupancy;
+    extern int _stats_are_final;
+
+    if (!_stats_are_final)
+        return;
+
+    if (_layers_occupancy != NULL)
+    {
+        m_free(_layers_occupancy);
+        _layers_occupancy = NULL;
+    }
+    memset(&_stats, 0, sizeof(stTextureBuildStats));
+    _stats_are_final = 0;
+}
+
+
+static void _count_layers(void)
+{
+    extern list* _arrays_to_build;
+    extern stTextureBuildStats _stats;
+    extern float* _layers_occupancy;
+
+    for (list_node* abd_node = _arrays_to_build->nodes; abd_node != NULL; abd_node = abd_node->next)
+    {
+        stArrayBuildData* abd = abd_node->data;
+        _stats.arrays_count++;
+        for (list_node* lbd_node = abd->layers->nodes; lbd_node != NULL; lbd_node = lbd_node->next)
+            _stats.layers_count++;
+    }
+
+    if (_stats.layers_count > 0)
+        _layers_occupancy = m_calloc(_stats.layers_count, sizeof(float));
+    _stats.layers_occupancy = _layers_occupancy;
+}
+
+
+static void _log_build_stats(void)
+{
+    extern stTextureBuildStats _stats;
+
+    LOG_MSG("Texture builder: built in %.3f s (placement %.3f s, sizing %.3f "
+        "s, decoding %.3f s, uploading %.3f s, cleanup %.3f s).",
+        _stats.total_time, _stats.placement_time, _stats.sizing_time,
+        _stats.decode_time, _stats.upload_time, _stats.cleanup_time);
+    LOG_MSG("Texture builder: %d images decoded, %d textures (%d duplicates) "
+        "uploaded, %zu bytes, %d arrays, %d layers, %.1f%% average layer "
+        "occupancy.", _stats.images_decoded, _stats.textures_uploaded,
+        _stats.duplicates_count, _stats.bytes_uploaded, _stats.arrays_count,
+        _stats.layers_count, _stats.average_occupancy * 100.0f);
+    for (int i = 0; i < _stats.layers_count; i++)
+    {
+        LOG_MSG("Texture builder: layer %d is %.1f%% occupied.", i,
+            _stats.layers_occupancy[i] * 100.0f);
+    }
+}
+
+
+/**-----------------------------------------------------------------------------
+; @func _get_image
+;
+; @brief
+;   Returns the image located at 'image_path', decoding it on the first call
+;   during the current build. All decoded images are freed in the
+;   '_cleanup_build_data' function.
+;
+-----------------------------------------------------------------------------**/
+static const stImage* _get_image(const char* image_path)
+{
+    extern map* _images;
+    extern stTextureBuildStats _stats;
+
+    if (NULL == _images)
+        _images = map_create();
+
+    size_t key = (size_t)_hash_bytes(0, image_path, strlen(image_path));
+    stImageCacheEntry* first_ice = map_search(_images, key);
+
+    for (stImageCacheEntry* ice = first_ice; ice != NULL; ice = ice->next)
+    {
+        if (0 == strcmp(ice->image_path, image_path))
+            return ice->image;
+    }
+
+    _begin_build_stats();
+    double decode_start = glfwGetTime();
+    const stImage* image = load_image(image_path);
+    _stats.decode_time += glfwGetTime() - decode_start;
+    if (NULL == image)
+        return NULL;
+    _stats.images_decoded++;
+
+    stImageCacheEntry* ice = m_malloc(sizeof(stImageCacheEntry));
+    ice->image_path = image_path;
+    ice->image = image;
+    ice->next = NULL;
+
+    if (NULL == first_ice)
+    {
+        map_insert(_images, key, ice);
+    }
+    else
+    {
+        /* Another image with the same path hash */
+        ice->next = first_ice->next;
+        first_ice->next = ice;
+    }
+    return image;
+}
+
+
+static void _free_image_cache_entries(size_t key, void* data)
+{
+    (void)key;
+    stImageCacheEntry* ice = data;
+    while (ice)
+    {
+        stImageCacheEntry* next = ice->next;
+        free_image(ice->image);
+        m_free(ice);
+        ice = next;
+    }
+}
+
+
+/* FNV-1a. Pass 0 as 'hash' to start a new hash */
+static unsigned long long _hash_bytes(unsigned long long hash,
+    const void* data, size_t size)
+{
+    const unsigned char* bytes = data;
+
+    if (0 == hash)
+        hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < size; i++)
+    {
+        hash ^= bytes[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+
+/**-----------------------------------------------------------------------------
+; @func _get_subimage_row
+;
+; @brief
+;   Returns the address of the first pixel of the 'y' row of the texture
+;   subimage, where row 0 is the top of the subimage. Rows of cooked images
+;   go from the bottom to the top, so their rows are counted from the end.
+;
+-----------------------------------------------------------------------------**/
+static const unsigned char* _get_subimage_row(const stImage* img,
+    const stTextureBuildData* tbd, int y)
+{
+    int image_y = tbd->subimg_y + y;
+    if (img->is_cooked)
+        image_y = img->height - 1 - image_y;
+    return (const unsigned char*)img->data_ptr +
+        ((size_t)image_y * img->width + tbd->subimg_x) * img->channels_count;
+}
+
+
+/**-----------------------------------------------------------------------------
+; @func _hash_texture
+;
+; @brief
+;   Calculates the hash of the texture pixels (and of its size and format) and
+;   writes it to 'tbd->hash'.
+;
+; @return
+;   int | 0 on success. -1 if the image can't be loaded, the subimage is out
+;       | of its bounds or the texture is a sprite sheet. Such textures are not
+;       | deduplicated.
+;
+-----------------------------------------------------------------------------**/
+static int _hash_texture(stTextureBuildData* tbd)
+{
+    if (tbd->cells_count > 0)           /* Sprite sheets are not deduplicated */
+        return -1;
+
+    const stImage* img = _get_image(tbd->image_path);
+    if (NULL == img)
+        return -1;
+
+    if (tbd->subimg_x < 0 || tbd->subimg_y < 0 ||
+        tbd->subimg_x + tbd->subimg_w > img->width ||
+        tbd->subimg_y + tbd->subimg_h > img->height)
+    {
+        LOG_ERROR("The [%dx%d] subimage at the [%dx%d] offset is out of the "
+            "[%s] image bounds.", tbd->subimg_w, tbd->subimg_h, tbd->subimg_x,
+            tbd->subimg_y, tbd->image_path);
+        return -1;
+    }
+
+    int header[4] = { tbd->format, tbd->subimg_w, tbd->subimg_h,
+        img->channels_count };
+    unsigned long long hash = _hash_bytes(0, header, sizeof(header));
+
+    size_t row_size = (size_t)tbd->subimg_w * img->channels_count;
+    for (int y = 0; y < tbd->subimg_h; y++)
+        hash = _hash_bytes(hash, _get_subimage_row(img, tbd, y), row_size);
+    tbd->hash = hash;
+    return 0;
+}
+
+
+/* Compares the pixels of two textures with equal hashes */
+static int _is_same_texture(const stTextureBuildData* a,
+    const stTextureBuildData* b)
+{
+    if (a->hash != b->hash || a->format != b->format ||
+        a->subimg_w != b->subimg_w || a->subimg_h != b->subimg_h)
+        return 0;
+
+    const stImage* img_a = _get_image(a->image_path);
+    const stImage* img_b = _get_image(b->image_path);
+    if (img_a->channels_count != img_b->channels_count)
+        return 0;
+
+    size_t row_size = (size_t)a->subimg_w * img_a->channels_count;
+    for (int y = 0; y < a->subimg_h; y++)
+    {
+        if (0 != memcmp(_get_subimage_row(img_a, a, y),
+            _get_subimage_row(img_b, b, y), row_size))
+            return 0;
+    }
+    return 1;
+}
+
+
+/* 'textures' is a map of 'stTextureBuildData' lists with the same hash */
+static stTextureBuildData* _find_same_texture(map* textures,
+    const stTextureBuildData* tbd)
+{
+    list* same_hash = map_search(textures, (size_t)tbd->hash);
+    if (NULL == same_hash)
+        return NULL;
+
+    for (list_node* node = same_hash->nodes; node != NULL; node = node->next)
+    {
+        if (_is_same_texture(node->data, tbd))
+            return node->data;
+    }
+    return NULL;
+}
+
+
+static void _remember_texture(map* textures, stTextureBuildData* tbd)
+{
+    list* same_hash = map_search(textures, (size_t)tbd->hash);
+    if (NULL == same_hash)
+    {
+        same_hash = list_create();
+        map_insert(textures, (size_t)tbd->hash, same_hash);
+    }
+    list_push(same_hash, tbd);
+}
+
+
+static void _destroy_list_item(size_t key, void* data)
+{
+    (void)key;
+    list_destroy(data);
+}
+
+
+/**-----------------------------------------------------------------------------
+; @func _deduplicate_textures
+;
+; @brief
+;   Finds textures with identical pixels and removes them from the textures to
+;   be placed, so they share the placement (and UVs) of the first such texture:
+;     - textures of a group share placement only within the group, because
+;       each group must fit on its own layer;
+;     - ungrouped textures share placement with any identical texture,
+;       grouped or not.
+;   Removed textures are moved to the '_duplicates' list.
+;
+-----------------------------------------------------------------------------**/
+static void _deduplicate_textures(void)
+{
+    extern list* _textures_to_build;
+    extern map* _texture_groups_to_build;
+    extern list* _group_indices;
+    extern list* _duplicates;
+
+    /* Textures placed by themselves */
+    map* placed = map_create();         /* Map of 'stTextureBuildData' lists  */
+
+    if (_texture_groups_to_build != NULL)
+    {
+        for (list_node* group_index_node = _group_indices->nodes; group_index_node != NULL; group_index_node = group_index_node->next)
+        {
+            int group_index = (int)(intptr_t)(group_index_node->data);
+            list* group_textures = map_search(_texture_groups_to_build, group_index);
+            map* group_placed = map_create();
+
+            list_node* tbd_node = group_textures->nodes;
+            while (tbd_node)
+            {
+                list_node* next = tbd_node->next;
+                stTextureBuildData* tbd = tbd_node->data;
+
+                if (0 == _hash_texture(tbd))
+                {
+                    tbd->duplicate_of = _find_same_texture(group_placed, tbd);
+                    if (tbd->duplicate_of != NULL)
+                    {
+                        if (NULL == _duplicates)
+                            _duplicates = list_create();
+                        list_push(_duplicates, tbd);
+                        list_erase(group_textures, tbd_node);
+                    }
+                    else
+                    {
+                        _remember_texture(group_placed, tbd);
+                        _remember_texture(placed, tbd);
+                    }
+                }
+                tbd_node = next;
+            }
+            map_for_each_item(group_placed, _destroy_list_item);
+            map_destroy(group_placed);
+        }
+    }
+
+    if (_textures_to_build != NULL)
+    {
+        list_node* tbd_node = _textures_to_build->nodes;
+        while (tbd_node)
+        {
+            list_node* next = tbd_node->next;
+            stTextureBuildData* tbd = tbd_node->data;
+
+            if (0 == _hash_texture(tbd))
+            {
+                tbd->duplicate_of = _find_same_texture(placed, tbd);
+                if (tbd->duplicate_of != NULL)
+                {
+                    if (NULL == _duplicates)
+                        _duplicates = list_create();
+                    list_push(_duplicates, tbd);
+                    list_erase(_textures_to_build, tbd_node);
+                }
+                else
+                {
+                    _remember_texture(placed, tbd);
+                }
+            }
+            tbd_node = next;
+        }
+    }
+
+    map_for_each_item(placed, _destroy_list_item);
+    map_destroy(placed);
 }
 
 
 /**-----------------------------------------------------------------------------
-; @func _cleanup_build_data
+; @func _trim_texture
 ;
 ; @brief
-;   Zeroes pointers and frees memory that was used to create textures and
-;   distribute them across OpenGL texture 2d arrays and layers.
+;   Shrinks the subimage of the texture to the smallest rectangle containing
+;   all its pixels with non-zero alpha and stores the removed borders in
+;   the 'trims' entry of the texture handle. Images without an alpha channel
+;   and textures whose format does not store alpha are not trimmed. A fully
+;   transparent subimage is shrunk to its upper left pixel.
 ;
 -----------------------------------------------------------------------------**/
-static void _cleanup_build_data(void)
+static void _trim_texture(stTextureBuildData* tbd)
+{
+    extern stTextureTable _table;
+
+    if (tbd->cells_count > 0)           /* Cells must keep the grid layout    */
+        return;
+
+    const stImage* img = _get_image(tbd->image_path);
+    if (NULL == img)
+        return;
+    if (!_is_alpha_stored(tbd->format, img->channels_count))
+        return;                         /* Transparent pixels are drawn       */
+    if (tbd->subimg_x < 0 || tbd->subimg_y < 0 ||
+        tbd->subimg_x + tbd->subimg_w > img->width ||
+        tbd->subimg_y + tbd->subimg_h > img->height)
+        return;                         /* Reported by '_hash_texture'        */
+
+    const int ch = img->channels_count;
+    int min_x = tbd->subimg_w;
+    int min_y = tbd->subimg_h;
+    int max_x = -1;
+    int max_y = -1;
+
+    for (int y = 0; y < tbd->subimg_h; y++)
+    {
+        const unsigned char* px = _get_subimage_row(img, tbd, y);
+
+        for (int x = 0; x < tbd->subimg_w; x++, px += ch)
+        {
+            if (0 == px[ch - 1])        /* Alpha is the last channel          */
+                continue;
+            if (x < min_x)
+                min_x = x;
+            if (x > max_x)
+                max_x = x;
+            if (y < min_y)
+                min_y = y;
+            max_y = y;
+        }
+    }
+
+    if (max_x < 0)                      /* Fully transparent                  */
+    {
+        min_x = min_y = 0;
+        max_x = max_y = 0;
+    }
+
+    int trimmed_w = max_x - min_x + 1;
+    int trimmed_h = max_y - min_y + 1;
+
+    _table.trims[tbd->handle][0] = (float)min_x / tbd->subimg_w;
+    _table.trims[tbd->handle][1] = (float)min_y / tbd->subimg_h;
+    _table.trims[tbd->handle][2] = (float)trimmed_w / tbd->subimg_w;
+    _table.trims[tbd->handle][3] = (float)trimmed_h / tbd->subimg_h;
+
+    tbd->subimg_x += min_x;
+    tbd->subimg_y += min_y;
+    tbd->subimg_w = trimmed_w;
+    tbd->subimg_h = trimmed_h;
+}
+
+
+static void _trim_textures(void)
 {
-    extern list* _arrays_to_build;
     extern list* _textures_to_build;
     extern map* _texture_groups_to_build;
     extern list* _group_indices;
 
-    for (list_node* abd_node = _arrays_to_build->nodes; abd_node != NULL; abd_node = abd_node->next)
+    size_t pixels_before = 0;
+    size_t pixels_after = 0;
+
+    if (_textures_to_build != NULL)
     {
-        stArrayBuildData* abd = abd_node->data;
-        for (list_node* lbd_node = abd->layers->nodes; lbd_node != NULL; lbd_node = lbd_node->next)
+        for (list_node* tbd_node = _textures_to_build->nodes; tbd_node != NULL; tbd_node = tbd_node->next)
         {
-            stLayerBuildData* lbd = lbd_node->data;
-
-            for (list_node* tbd_node = lbd->textures->nodes; tbd_node != NULL; tbd_node = tbd_node->next)
-            {
-                stTextureBuildData* tbd = tbd_node->data;
-                // TODO: Uncomment after module 'sprite' implemented.
-                //stTexture* t = tbd->target;
-                //stTextureInfo* ti = t->texture_info_ptr;
-                //glDeleteTextures(1, &ti->array_id);
-                //m_free(ti);
-                //m_free(t);
-
-                m_free(tbd);
-            }
-            list_destroy(lbd->textures);
-            sq_destroy(lbd->square);
-            m_free(lbd);
+            stTextureBuildData* tbd = tbd_node->data;
+            pixels_before += (size_t)tbd->subimg_w * tbd->subimg_h;
+            _trim_texture(tbd);
+            pixels_after += (size_t)tbd->subimg_w * tbd->subimg_h;
         }
-        list_destroy(abd->layers);
-        m_free(abd);
     }
-    list_destroy(_arrays_to_build);     // TODO: if(NULL == _arrays_to_build)
-    list_destroy(_textures_to_build);   // TODO: if(NULL != _textures_to_build)
-
-    _arrays_to_build = NULL;
-    _textures_to_build = NULL;
 
     if (_texture_groups_to_build != NULL)
     {
         for (list_node* group_index_node = _group_indices->nodes; group_index_node != NULL; group_index_node = group_index_node->next)
         {
-            int group_index = (int)(group_index_node->data);
-            list_destroy(map_search(_texture_groups_to_build, group_index));
+            int group_index = (int)(intptr_t)(group_index_node->data);
+            list* group_textures = map_search(_texture_groups_to_build, group_index);
+            for (list_node* tbd_node = group_textures->nodes; tbd_node != NULL; tbd_node = tbd_node->next)
+            {
+                stTextureBuildData* tbd = tbd_node->data;
+                pixels_before += (size_t)tbd->subimg_w * tbd->subimg_h;
+                _trim_texture(tbd);
+                pixels_after += (size_t)tbd->subimg_w * tbd->subimg_h;
+            }
         }
-        map_destroy(_texture_groups_to_build);
-        list_destroy(_group_indices);
-        _texture_groups_to_build = NULL;
-        _group_indices = NULL;
     }
+
+    LOG_MSG("Texture builder: trimming removed %zu of %zu texture pixels.",
+        pixels_before - pixels_after, pixels_before);
 }
 
 
@@ -476,6 +1810,8 @@ static void _fit_texture(stTextureBuildData* tbd)
     for (list_node* abd_node = _arrays_to_build->nodes; abd_node != NULL; abd_node = abd_node->next)
     {
         stArrayBuildData* abd = abd_node->data;
+        if (abd->format != tbd->format)
+            continue;
         int iter = 0;
         /* For each layer */
         for (list_node* lbd_node = abd->layers->nodes; lbd_node != NULL; lbd_node = lbd_node->next)
@@ -486,8 +1822,8 @@ static void _fit_texture(stTextureBuildData* tbd)
                 return;
         }
     }
-    _create_layer_bd(); // TODO: Stupid solution.
-    _fit_texture(tbd);  // TODO: Stupid solution.
+    _create_layer_bd(tbd->format); // TODO: Stupid solution.
+    _fit_texture(tbd);             // TODO: Stupid solution.
 }
 
 
@@ -495,10 +1831,15 @@ static void _fit_texture_group(list* group_textures)
 {
     static int is_new_layer_created = 0;
 
+    /* All group textures have the same format (see 'tb_add_texture') */
+    int group_format = ((stTextureBuildData*)group_textures->nodes->data)->format;
+
     /* For each array */
     for (list_node* abd_node = _arrays_to_build->nodes; abd_node != NULL; abd_node = abd_node->next)
     {
         stArrayBuildData* abd = abd_node->data;
+        if (abd->format != group_format)
+            continue;
 
         /* For each layer */
         for (list_node* lbd_node = abd->layers->nodes; lbd_node != NULL; lbd_node = lbd_node->next)
@@ -529,7 +1870,7 @@ static void _fit_texture_group(list* group_textures)
     }
 
     int result = 0;
-    stLayerBuildData* new_lbd = _create_layer_bd();
+    stLayerBuildData* new_lbd = _create_layer_bd(group_format);
     /* Try to fit all group textures on it */
     for (list_node* tbd_node = group_textures->nodes; tbd_node != NULL; tbd_node = tbd_node->next)
     {
@@ -558,16 +1899,22 @@ static void _fit_texture_group(list* group_textures)
 
 static int _try_add_texture_on_layer(stTextureBuildData* tbd_what, stLayerBuildData* lbd_where)
 {
+    extern unsigned int _build_flags;
+
     // TOOD: NULL-checks?
-    sq_get_free_rect(lbd_where->square, tbd_what->subimg_w, tbd_what->subimg_h,
-        &tbd_what->layer_offset_x, &tbd_what->layer_offset_y);
+    sq_get_free_rect_rotatable(lbd_where->square,
+        tbd_what->subimg_w, tbd_what->subimg_h,
+        (_build_flags & TB_BUILD_ALLOW_ROTATION) != 0,
+        &tbd_what->layer_offset_x, &tbd_what->layer_offset_y,
+        &tbd_what->is_rotated);
     if ((tbd_what->layer_offset_x != SQ_FAIL) &&
         (tbd_what->layer_offset_y != SQ_FAIL))
     {
         sq_use_rect(
             lbd_where->square,
             tbd_what->layer_offset_x, tbd_what->layer_offset_y,
-            tbd_what->subimg_w, tbd_what->subimg_h);
+            tbd_what->is_rotated ? tbd_what->subimg_h : tbd_what->subimg_w,
+            tbd_what->is_rotated ? tbd_what->subimg_w : tbd_what->subimg_h);
         list_push(lbd_where->textures, tbd_what);
         return 0;
     }
@@ -583,7 +1930,8 @@ static void _remove_texture_from_lyer(stTextureBuildData* tbd, stLayerBuildData*
         if (_tbd == tbd)
         {
             sq_unuse_rect(lbd->square, tbd->layer_offset_x, tbd->layer_offset_y,
-                tbd->subimg_w, tbd->subimg_h);
+                tbd->is_rotated ? tbd->subimg_h : tbd->subimg_w,
+                tbd->is_rotated ? tbd->subimg_w : tbd->subimg_h);
             list_erase(lbd->textures, lbd_texture);
             return;
         }
@@ -591,7 +1939,7 @@ static void _remove_texture_from_lyer(stTextureBuildData* tbd, stLayerBuildData*
 }
 
 
-static stLayerBuildData* _create_layer_bd(void)
+static stLayerBuildData* _create_layer_bd(int format)
 {
     extern list* _arrays_to_build;
 
@@ -603,6 +1951,9 @@ static stLayerBuildData* _create_layer_bd(void)
     {
         stArrayBuildData* abd = abd_node->data;
 
+        if (abd->format != format)
+            continue;
+
         if (list_get_size(abd->layers) >= max_depth)
             continue; // TODO: Call '_create_texture_array' function?
 
@@ -613,35 +1964,33 @@ static stLayerBuildData* _create_layer_bd(void)
         return layer;
     }
 
-    _create_array_bd();        // TODO: Stupid solution.
-    return _create_layer_bd(); // TODO: Stupid solution.
+    _create_array_bd(format);        // TODO: Stupid solution.
+    return _create_layer_bd(format); // TODO: Stupid solution.
 }
 
 
-static stArrayBuildData* _create_array_bd(void)
+static stArrayBuildData* _create_array_bd(int format)
 {
     extern list* _arrays_to_build;
 
-    int arrays_to_build_size = list_get_size(_arrays_to_build);
-
-    if (arrays_to_build_size > _get_max_texture_image_units())
-    {
-        LOG_ERROR("Unable to create a new 2D texture array. All units are used up.");
-        return NULL; // TODO: Implement re-bind arrays on units logic system.
-    }
 
+    /* Arrays are bound to units on demand (see 'texture_units.h'), so their
+       number is not limited by the number of units */
     stArrayBuildData* abd = m_malloc(sizeof(stArrayBuildData));
-    abd->unit = GL_TEXTURE0 + arrays_to_build_size;
+    abd->format = format;
     abd->layers = list_create(); // TODO: Remove.
+    abd->array_id = 0;                  /* Will be filled in build()          */
+    abd->width = 0;
+    abd->height = 0;
+    abd->depth = 0;
     list_push(_arrays_to_build, abd);
 
     return abd;
 }
 
 
-static stTexture* _load_texture_into_texture_2d_array(
+static int _load_texture_into_texture_2d_array(
     unsigned int array_id,
-    unsigned int unit,
     int z_offset,
     int subimage_x_offset,              // TODO: Use cglm.
     int subimage_y_offset,              // TODO: Use cglm.
@@ -652,26 +2001,36 @@ static stTexture* _load_texture_into_texture_2d_array(
     unsigned char const* image_bytes,
     int image_width,                    // TODO: Use cglm.
     int image_height,                   // TODO: Use cglm.
-    int image_channels_count)
+    int image_channels_count,
+    int is_bottom_up,
+    int format,
+    int is_rotated,
+    float* out_vertices)
 {
+    extern unsigned int _build_flags;
+
+    /* Size of the area occupied on the layer */
+    int placed_width = is_rotated ? subimage_height : subimage_width;
+    int placed_height = is_rotated ? subimage_width : subimage_height;
+
     if (glIsTexture(array_id) == GL_FALSE)
     {
         LOG_ERROR("Texture 2d array with id [%d] was not created.", array_id);
-        return NULL;
+        return -1;
     }
 
     int texture_array_width = _get_texture_2d_array_width(array_id);
     int texture_array_height = _get_texture_2d_array_height(array_id);
 
-    if (((subimage_x_offset + subimage_width) > texture_array_width) ||
-        ((subimage_y_offset + subimage_height) > texture_array_height))
+    if (((subimage_x_offset + placed_width) > texture_array_width) ||
+        ((subimage_y_offset + placed_height) > texture_array_height))
     {
         LOG_ERROR("The [%dx%d] texture cannot fit on the [%dx%d] array layer "
             "at the [%dx%d] offset. Going beyond the boundaries of the layer.",
-            subimage_width, subimage_height,
+            placed_width, placed_height,
             texture_array_width, texture_array_height,
             subimage_x_offset, subimage_y_offset);
-        return NULL;
+        return -1;
     }
 
     int texture_array_depth = _get_texture_2d_array_depth(array_id);
@@ -680,22 +2039,62 @@ static stTexture* _load_texture_into_texture_2d_array(
         LOG_ERROR("The texture cannot be placed on layer with index [%d] "
             "because there are only [%d] layers in the texture array.",
             z_offset, texture_array_depth);
-        return NULL;
+        return -1;
     }
 
-    GLenum format = 0;
-    switch (image_channels_count)
+    if (image_channels_count < 1 || image_channels_count > 4)
     {
-    case 4:                             /* If 4 bytes per pixel               */
-        format = GL_RGBA;               /* It's RGBA                          */
-        break;
-    case 3:                             /* if 3 bytes per pixel               */
-        format = GL_RGB;                /* it's RGB                           */
-        break;
-    default:                            /* Otherwise, log an error            */
-        // TODO: Provide functionality for other formats.
         LOG_ERROR("Undefined image format.");
-        return NULL;
+        return -1;
+    }
+
+    const void* pixels = NULL;
+    unsigned char* staging = NULL;
+    int row_length = 0;                 /* 0 - rows are tightly packed        */
+
+    int is_premultiplied = (_build_flags & TB_BUILD_PREMULTIPLY_ALPHA) &&
+        (format == TB_FORMAT_RGBA8);
+    if (is_bottom_up && !is_rotated && !is_premultiplied &&
+        _is_same_layout(format, image_channels_count))
+    {
+        /* Rows of cooked images already go from the bottom to the top, so the
+           subimage is uploaded straight from the image memory */
+        pixels = image_bytes + ((long long)(image_height - image_y_offset -
+            subimage_height) * image_width + image_x_offset) *
+            image_channels_count;
+        row_length = image_width;
+    }
+    else
+    {
+        /* Convert the subimage pixels to the storage format of the array */
+        staging = m_malloc((size_t)subimage_width * subimage_height
+            * _formats[format].bytes_per_pixel);
+        if (NULL == staging)
+            return -1;
+        _convert_subimage(staging, format, image_bytes, image_width,
+            image_height, image_channels_count, is_bottom_up,
+            image_x_offset,             /* Subimage x-offset (from the        */
+                                        /* beginning of the image).           */
+            image_y_offset,             /* Subimage y-offset (from the        */
+                                        /* beginning of the image).           */
+            subimage_width, subimage_height);
+        pixels = staging;
+    }
+
+    if (is_rotated)
+    {
+        unsigned char* rotated = m_malloc((size_t)subimage_width *
+            subimage_height * _formats[format].bytes_per_pixel);
+        if (NULL == rotated)
+        {
+            m_free(staging);
+            return -1;
+        }
+        _rotate_pixels(rotated, staging, subimage_width, subimage_height,
+            _formats[format].bytes_per_pixel);
+        m_free(staging);
+        staging = rotated;
+        pixels = staging;
     }
 
     /* Save the currently activated texture unit */
@@ -706,18 +2105,11 @@ static stTexture* _load_texture_into_texture_2d_array(
     //int bound_texture = 0;
     //glGetIntegerv(GL_TEXTURE_BINDING_2D_ARRAY, &bound_texture);
 
-    GL_CALL(glActiveTexture(unit));
-    GL_CALL(glBindTexture(GL_TEXTURE_2D_ARRAY, array_id));
+    _bind_array(array_id);
 
-    GL_CALL(glPixelStorei(GL_UNPACK_ROW_LENGTH, image_width));
-                                        /* The full width of the image from   */
-                                        /* which the texture is created       */
-    GL_CALL(glPixelStorei(GL_UNPACK_SKIP_PIXELS, image_x_offset));
-                                        /* Subimage x-offset (from the        */
-                                        /* beginning of the image).           */
-    GL_CALL(glPixelStorei(GL_UNPACK_SKIP_ROWS, image_height - image_y_offset
-        - subimage_height));            /* Subimage y-offset (from the        */
-                                        /* beginning of the image).           */
+    /* Rows of 1 and 2 bytes per pixel formats are not 4-byte aligned */
+    GL_CALL(glPixelStorei(GL_UNPACK_ALIGNMENT, 1));
+    GL_CALL(glPixelStorei(GL_UNPACK_ROW_LENGTH, row_length));
 
     GL_CALL(glTexSubImage3D(
         GL_TEXTURE_2D_ARRAY,            /* Target to which the texture is     */
@@ -736,12 +2128,18 @@ static stTexture* _load_texture_into_texture_2d_array(
         //       exactly :)
 
         z_offset,                       /* Z offset (layer)                   */
-        subimage_width,                 /* Width of the texture subimage      */
-        subimage_height,                /* Height of the texture subimage     */
+        placed_width,                   /* Width of the texture subimage      */
+        placed_height,                  /* Height of the texture subimage     */
         1,                              /* Depth of the texture subimage      */
-        format,                         /* Format of the pixel data           */
-        GL_UNSIGNED_BYTE,               /* Data type of the pixel data        */
-        (const void*)image_bytes));     /* Image pixels data pointer          */
+        _formats[format].format,        /* Format of the pixel data           */
+        _formats[format].type,          /* Data type of the pixel data        */
+        pixels));                       /* Converted pixels data pointer      */
+
+    /* Restore the default unpack alignment and row length */
+    GL_CALL(glPixelStorei(GL_UNPACK_ALIGNMENT, 4));
+    GL_CALL(glPixelStorei(GL_UNPACK_ROW_LENGTH, 0));
+
+    m_free(staging);
 
     /* Restore previous used texture unit */
     GL_CALL(glActiveTexture(used_unit));
@@ -749,33 +2147,236 @@ static stTexture* _load_texture_into_texture_2d_array(
     /* Restore previous bound texture 2d array */
     //GL_CALL(glBindTexture(GL_TEXTURE_2D_ARRAY, bound_texture));
 
-    stTexture* texture_ptr = m_malloc(sizeof(stTexture));
-    stTextureInfo* texture_info = m_malloc(sizeof(stTextureInfo));
-    texture_ptr->texture_info_ptr = texture_info;
-    if (NULL == texture_ptr)
-        return NULL;
-
     /* Calculate the size and coordinates of the texture in relation to the
        dimensions of the layer. */
     float x = (float)subimage_x_offset / texture_array_width;
     float y = (float)subimage_y_offset / texture_array_height;
-    float w = (float)subimage_width / texture_array_width;
-    float h = (float)subimage_height / texture_array_height;
+    float w = (float)placed_width / texture_array_width;
+    float h = (float)placed_height / texture_array_height;
 
     /* Construct texture vertices based on the calculated coordinates */
-    texture_ptr->vertices[0] = x + w;   /* Top right                          */
-    texture_ptr->vertices[1] = y + h;
-    texture_ptr->vertices[2] = x + w;   /* Bottom right                       */
-    texture_ptr->vertices[3] = y;
-    texture_ptr->vertices[4] = x;       /* Bottom left                        */
-    texture_ptr->vertices[5] = y;
-    texture_ptr->vertices[6] = x;       /* Top left                           */
-    texture_ptr->vertices[7] = y + h;
+    if (!is_rotated)
+    {
+        out_vertices[0] = x + w;          /* Top right                        */
+        out_vertices[1] = y + h;
+        out_vertices[2] = x + w;          /* Bottom right                     */
+        out_vertices[3] = y;
+        out_vertices[4] = x;              /* Bottom left                      */
+        out_vertices[5] = y;
+        out_vertices[6] = x;              /* Top left                         */
+        out_vertices[7] = y + h;
+    }
+    else
+    {
+        /* The texture top is stored along the left edge of the placed area
+           (see '_rotate_pixels') */
+        out_vertices[0] = x;              /* Top right                        */
+        out_vertices[1] = y + h;
+        out_vertices[2] = x + w;          /* Bottom right                     */
+        out_vertices[3] = y + h;
+        out_vertices[4] = x + w;          /* Bottom left                      */
+        out_vertices[5] = y;
+        out_vertices[6] = x;              /* Top left                         */
+        out_vertices[7] = y;
+    }
+
+    return 0;
+}
+
+
+/**-----------------------------------------------------------------------------
+; @func _rotate_pixels
+;
+; @brief
+;   Rotates the 'w' x 'h' pixels of 'src' by 90 degrees clockwise (rows go
+;   from bottom to top, as in '_convert_subimage'), so 'dst' is 'h' pixels
+;   wide and 'w' pixels high. The top row of 'src' becomes the left column of
+;   'dst'.
+;
+-----------------------------------------------------------------------------**/
+static void _rotate_pixels(unsigned char* dst, const unsigned char* src,
+    int w, int h, int bytes_per_pixel)
+{
+    for (int v = 0; v < w; v++)         /* For each 'dst' row                 */
+    {
+        unsigned char* out = dst + (size_t)v * h * bytes_per_pixel;
+        for (int u = 0; u < h; u++)     /* For each 'dst' pixel               */
+        {
+            const unsigned char* in = src +
+                ((size_t)(h - 1 - u) * w + v) * bytes_per_pixel;
+            memcpy(out + (size_t)u * bytes_per_pixel, in, bytes_per_pixel);
+        }
+    }
+}
+
+
+/* Formats with byte components and the same number of channels as the
+   image */
+static int _is_same_layout(int format, int image_channels_count)
+{
+    return (format == TB_FORMAT_RGBA8 && image_channels_count == 4) ||
+        (format == TB_FORMAT_RG8 && image_channels_count == 2) ||
+        (format == TB_FORMAT_R8 && image_channels_count == 1);
+}
+
+
+/* Formats that keep the alpha of the image. 'TB_FORMAT_RG8' keeps it only for
+   2-channel images, which are copied as is */
+static int _is_alpha_stored(int format, int image_channels_count)
+{
+    if (image_channels_count != 2 && image_channels_count != 4)
+        return 0;
+    return format == TB_FORMAT_RGBA8 || format == TB_FORMAT_RGBA4444 ||
+        (format == TB_FORMAT_RG8 && image_channels_count == 2);
+}
+
+
+/**-----------------------------------------------------------------------------
+; @func _convert_subimage
+;
+; @brief
+;   Copies the ('x', 'y', 'w', 'h') part of the image into 'dst', converting
+;   each pixel to the 'format' storage format. Rows of 'dst' are tightly
+;   packed and go from the bottom of the subimage to its top, as OpenGL
+;   expects, so the image is flipped on the y-axis during the copy (unless its
+;   rows already go from the bottom to the top, see 'is_bottom_up').
+;
+;   Before packing, each pixel is expanded to RGBA:
+;     - 1 channel  (gray)       -> (gray, gray, gray, 255);
+;     - 2 channels (gray+alpha) -> (gray, gray, gray, alpha);
+;     - 3 channels (RGB)        -> (r, g, b, 255).
+;   If the image already has the layout of the storage format (for example,
+;   2-channel images stored as 'TB_FORMAT_RG8'), rows are copied as is.
+;
+;   Colors are multiplied by alpha if the 'TB_BUILD_PREMULTIPLY_ALPHA' build
+;   flag is set and the format stores alpha.
+;
+-----------------------------------------------------------------------------**/
+static void _convert_subimage(unsigned char* dst, int format,
+    unsigned char const* image_bytes, int image_width, int image_height,
+    int image_channels_count, int is_bottom_up, int x, int y, int w, int h)
+{
+    extern unsigned int _build_flags;
+
+    const int bpp = _formats[format].bytes_per_pixel;
+    const long long dst_row_size = (long long)w * bpp;
+    const long long src_stride = (long long)image_width * image_channels_count;
+    int is_premultiplied = (_build_flags & TB_BUILD_PREMULTIPLY_ALPHA) != 0;
+
+    /* The first row to copy is the last row of the subimage */
+    unsigned char const* src_row;
+    long long src_step;
+    if (is_bottom_up)
+    {
+        src_row = image_bytes + (image_height - y - h) * src_stride +
+            (long long)x * image_channels_count;
+        src_step = src_stride;
+    }
+    else
+    {
+        src_row = image_bytes + (y + h - 1) * src_stride +
+            (long long)x * image_channels_count;
+        src_step = -src_stride;
+    }
+
+    if (_is_same_layout(format, image_channels_count))
+    {
+        px_copy_rect(dst, dst_row_size, src_row, src_step, (int)dst_row_size, h);
+    }
+    else if (format == TB_FORMAT_RGBA8 && image_channels_count == 3)
+    {
+        for (int row = 0; row < h; row++, src_row += src_step)
+            px_expand_rgb_to_rgba(dst + row * dst_row_size, src_row, w);
+        is_premultiplied = 0;           /* Opaque, nothing to multiply        */
+    }
+    else
+    {
+        /* Rows are expanded to RGBA in chunks, which are premultiplied and
+           packed into the storage format */
+        unsigned char rgba[CONVERT_CHUNK_SIZE * 4];
+        for (int row = 0; row < h; row++, src_row += src_step)
+        {
+            unsigned char* out = dst + row * dst_row_size;
+            for (int i = 0; i < w; i += CONVERT_CHUNK_SIZE)
+            {
+                int count = (w - i < CONVERT_CHUNK_SIZE) ?
+                    w - i : CONVERT_CHUNK_SIZE;
+                _expand_to_rgba(rgba, src_row +
+                    (long long)i * image_channels_count,
+                    image_channels_count, count);
+                if (is_premultiplied && format == TB_FORMAT_RGBA4444)
+                    px_premultiply_rgba(rgba, count);
+                _pack_rgba(out + (long long)i * bpp, format, rgba, count);
+            }
+        }
+        if (format != TB_FORMAT_RGBA8)
+            is_premultiplied = 0;       /* Done while packing                 */
+    }
+
+    if (is_premultiplied && format == TB_FORMAT_RGBA8)
+        px_premultiply_rgba(dst, w * h);
+}
+
+
+/* Expands 'count' pixels of the image to RGBA, see '_convert_subimage' */
+static void _expand_to_rgba(unsigned char* dst, const unsigned char* src,
+    int channels_count, int count)
+{
+    if (4 == channels_count)
+    {
+        memcpy(dst, src, (size_t)count * 4);
+        return;
+    }
+    if (3 == channels_count)
+    {
+        px_expand_rgb_to_rgba(dst, src, count);
+        return;
+    }
+    for (int i = 0; i < count; i++, src += channels_count, dst += 4)
+    {
+        dst[0] = dst[1] = dst[2] = src[0];
+        dst[3] = (2 == channels_count) ? src[1] : 0xFF;
+    }
+}
+
 
-    texture_ptr->texture_info_ptr->array_id = array_id;
-    texture_ptr->texture_info_ptr->unit = unit;
-    texture_ptr->texture_info_ptr->z_offset = z_offset;
-    return texture_ptr;
+/* Packs 'count' RGBA pixels into the 'format' storage format */
+static void _pack_rgba(unsigned char* dst, int format,
+    const unsigned char* rgba, int count)
+{
+    for (int i = 0; i < count; i++, rgba += 4)
+    {
+        unsigned char r = rgba[0], g = rgba[1], b = rgba[2], a = rgba[3];
+        unsigned short packed;          /* 'dst' may be unaligned             */
+        switch (format)
+        {
+        case TB_FORMAT_RGBA8:
+            memcpy(dst, rgba, 4);
+            dst += 4;
+            break;
+        case TB_FORMAT_RGBA4444:
+            packed = (unsigned short)(((r >> 4) << 12) | ((g >> 4) << 8) |
+                ((b >> 4) << 4) | (a >> 4));
+            memcpy(dst, &packed, sizeof(packed));
+            dst += 2;
+            break;
+        case TB_FORMAT_RGB565:
+            packed = (unsigned short)(((r >> 3) << 11) | ((g >> 2) << 5) |
+                (b >> 3));
+            memcpy(dst, &packed, sizeof(packed));
+            dst += 2;
+            break;
+        case TB_FORMAT_RG8:
+            dst[0] = r;
+            dst[1] = g;
+            dst += 2;
+            break;
+        case TB_FORMAT_R8:
+            dst[0] = r;
+            dst += 1;
+            break;
+        }
+    }
 }
 
 
@@ -800,19 +2401,6 @@ static void _calculate_array_size(stArrayBuildData* tabd,
 }
 
 
-static int _get_max_texture_image_units(void)
-{
-    static int res = -1;
-    if (res != -1)
-        return res;
-
-    /* Get the maximum supported texture image units that can be used to access
-       texture maps from the fragment shader */
-    GL_CALL(glGetIntegerv(GL_MAX_TEXTURE_IMAGE_UNITS, &res));
-    return res;
-}
-
-
 static int _get_max_3d_texture_size(void)
 {
     static int res = -1;
@@ -889,3 +2477,266 @@ static int _get_texture_2d_array_depth(unsigned int id)
 
     return res;
 }
+
+
+
+/** @tests-------------------------------------------------------------------**/
+//#define TEST_RUN
+//#define TEXTURE_BUILDER_TEST
+//#define TEST_MODULE TEXTURE_BUILDER
+
+#ifdef TEST_RUN
+#ifdef TEXTURE_BUILDER_TEST
+
+#include <stdio.h> /* remove */
+
+#include "../image_cooker.h"
+#include "../../../test.h"
+
+
+#define __TEST_TEXTURES_COUNT       4
+#define __TEST_TRIM_TEXTURES_COUNT  5
+#define __TEST_TRIM_IMAGE_PATH      "__test_trim.tga"
+#define __TEST_COOKED_IMAGE_PATH    "__test_trim.tga.cimg"
+#define __TEST_TRIM_IMAGE_SIZE      64
+
+
+/* Placement of the textures of a build */
+typedef struct
+{
+    float vertices[__TEST_TEXTURES_COUNT][8];
+    int z_offsets[__TEST_TEXTURES_COUNT];
+    unsigned char formats[__TEST_TEXTURES_COUNT];
+    int is_array_created[__TEST_TEXTURES_COUNT];
+}stTestPlacement;
+
+
+static void _add_test_textures(tb_handle* handles)
+{
+    handles[0] = tb_add_texture(TB_NO_GROUP,
+        "resources/img/512x512_transp.png", 0, 0, 512, 512, TB_FORMAT_RGBA8);
+    handles[1] = tb_add_texture(TB_NO_GROUP, "resources/img/256x256.jpg", 0,
+        0, 256, 256, TB_FORMAT_RGBA8);
+    handles[2] = tb_add_texture(1, "resources/img/512x512_transp.png", 0, 0,
+        256, 256, TB_FORMAT_RGBA8);
+    handles[3] = tb_add_texture(1, "resources/img/256x256.jpg", 128, 128,
+        128, 128, TB_FORMAT_RGB565);
+}
+
+
+/* Parts of the image written by '_write_trim_test_image' at different
+   heights, the last one repeats the first */
+static void _add_trim_test_textures(const char* image_path,
+    tb_handle* handles)
+{
+    handles[0] = tb_add_texture(TB_NO_GROUP, image_path, 0, 0, 64, 64,
+        TB_FORMAT_RGBA8);
+    handles[1] = tb_add_texture(TB_NO_GROUP, image_path, 0, 0, 32, 32,
+        TB_FORMAT_RGBA8);
+    handles[2] = tb_add_texture(TB_NO_GROUP, image_path, 32, 32, 32, 32,
+        TB_FORMAT_RGBA8);
+    handles[3] = tb_add_texture(TB_NO_GROUP, image_path, 0, 32, 64, 32,
+        TB_FORMAT_RGBA8);
+    handles[4] = tb_add_texture(TB_NO_GROUP, image_path, 0, 0, 64, 64,
+        TB_FORMAT_RGBA8);
+}
+
+
+/* Writes an uncompressed 32-bit TGA image that is transparent except for two
+   opaque rectangles at different heights. Colors depend on the position */
+static int _write_trim_test_image(const char* path)
+{
+    const int size = __TEST_TRIM_IMAGE_SIZE;
+    unsigned char header[18] = { 0 };
+    header[2] = 2;                      /* Uncompressed true-color image      */
+    header[12] = (unsigned char)size;
+    header[14] = (unsigned char)size;
+    header[16] = 32;
+    header[17] = 0x28;                  /* 8 alpha bits, top-left origin      */
+
+    FILE* file = fopen(path, "wb");
+    if (NULL == file)
+        return -1;
+    fwrite(header, 1, sizeof(header), file);
+    for (int y = 0; y < size; y++)
+    {
+        for (int x = 0; x < size; x++)
+        {
+            int is_opaque = (x >= 10 && x < 30 && y >= 5 && y < 41) ||
+                (x >= 40 && x < 56 && y >= 44 && y < 60);
+            unsigned char bgra[4] = { (unsigned char)(x * 4),
+                (unsigned char)(y * 4), 0x80, is_opaque ? 0xFF : 0 };
+            fwrite(bgra, 1, sizeof(bgra), file);
+        }
+    }
+    fclose(file);
+    return 0;
+}
+
+
+static void _get_test_placement(const tb_handle* handles,
+    stTestPlacement* out_placement)
+{
+    const stTextureTable* table = tb_get_texture_table();
+    for (int i = 0; i < __TEST_TEXTURES_COUNT; i++)
+    {
+        memcpy(out_placement->vertices[i], table->vertices[handles[i]],
+            sizeof(out_placement->vertices[i]));
+        out_placement->z_offsets[i] = table->z_offsets[handles[i]];
+        out_placement->formats[i] = table->formats[handles[i]];
+        out_placement->is_array_created[i] =
+            table->array_ids[handles[i]] != 0;
+    }
+}
+
+
+/**-----------------------------------------------------------------------------
+; @unit_test
+;
+; @brief
+;   A build on the loader thread places the textures exactly like a build on
+;   the main thread.
+;
+-----------------------------------------------------------------------------**/
+TEST_BEGIN(test_async_build_matches_sync_build)
+{
+    EXPECT_ZERO(window_init("test", 1, 1, 0, 0));
+
+    tb_handle handles[__TEST_TEXTURES_COUNT];
+    stTestPlacement async_placement;
+    stTestPlacement sync_placement;
+
+    _add_test_textures(handles);
+    tb_build_async();
+    double start = glfwGetTime();
+    while (!tb_is_build_done() && glfwGetTime() - start < 10.0)
+        glfwPollEvents();
+    EXPECT(tb_is_build_done(), 1);
+    _get_test_placement(handles, &async_placement);
+    tb_destroy();
+
+    _add_test_textures(handles);
+    tb_build();
+    _get_test_placement(handles, &sync_placement);
+    tb_destroy();
+
+    EXPECT_ZERO(memcmp(&async_placement, &sync_placement,
+        sizeof(stTestPlacement)));
+    for (int i = 0; i < __TEST_TEXTURES_COUNT; i++)
+        EXPECT(async_placement.is_array_created[i], 1);
+
+    window_terminate();
+    TEST_END
+}
+
+
+/**-----------------------------------------------------------------------------
+; @unit_test
+;
+; @brief
+;   Trimming and deduplication give the same result for a source image and
+;   its cooked copy, whose rows go from the bottom to the top.
+;
+-----------------------------------------------------------------------------**/
+TEST_BEGIN(test_cooked_image_trims_like_source_image)
+{
+    EXPECT_ZERO(window_init("test", 1, 1, 0, 0));
+    EXPECT_ZERO(_write_trim_test_image(__TEST_TRIM_IMAGE_PATH));
+
+    tb_handle handles[__TEST_TRIM_TEXTURES_COUNT];
+    float source_trims[__TEST_TRIM_TEXTURES_COUNT][4];
+    float cooked_trims[__TEST_TRIM_TEXTURES_COUNT][4];
+    stTextureBuildStats source_stats;
+    stTextureBuildStats cooked_stats;
+
+    tb_set_build_flags(TB_BUILD_TRIM_TRANSPARENT);
+
+    _add_trim_test_textures(__TEST_TRIM_IMAGE_PATH, handles);
+    tb_build();
+    for (int i = 0; i < __TEST_TRIM_TEXTURES_COUNT; i++)
+        memcpy(source_trims[i], tb_get_texture_table()->trims[handles[i]],
+            sizeof(source_trims[i]));
+    tb_get_build_stats(&source_stats);
+    tb_destroy();
+
+    /* Cooked after the first build, since 'load_image' prefers the cooked
+       copy of the source image */
+    EXPECT_ZERO(ic_cook_image(__TEST_TRIM_IMAGE_PATH,
+        __TEST_COOKED_IMAGE_PATH, 0));
+    _add_trim_test_textures(__TEST_COOKED_IMAGE_PATH, handles);
+    tb_build();
+    for (int i = 0; i < __TEST_TRIM_TEXTURES_COUNT; i++)
+        memcpy(cooked_trims[i], tb_get_texture_table()->trims[handles[i]],
+            sizeof(cooked_trims[i]));
+    tb_get_build_stats(&cooked_stats);
+    tb_destroy();
+
+    tb_set_build_flags(0);
+    remove(__TEST_TRIM_IMAGE_PATH);
+    remove(__TEST_COOKED_IMAGE_PATH);
+
+    EXPECT_ZERO(memcmp(source_trims, cooked_trims, sizeof(source_trims)));
+    /* The transparent top border of the third texture is trimmed */
+    EXPECT((source_trims[2][1] > 0.0f), 1);
+    EXPECT(source_stats.duplicates_count, 1);
+    EXPECT(cooked_stats.duplicates_count, 1);
+
+    window_terminate();
+    TEST_END
+}
+
+
+/**-----------------------------------------------------------------------------
+; @unit_test
+;
+; @brief
+;   A texture stored in a format without alpha keeps its transparent border,
+;   since the border is drawn opaque.
+;
+-----------------------------------------------------------------------------**/
+TEST_BEGIN(test_format_without_alpha_is_not_trimmed)
+{
+    EXPECT_ZERO(window_init("test", 1, 1, 0, 0));
+
+    EXPECT_ZERO(_write_trim_test_image(__TEST_TRIM_IMAGE_PATH));
+
+    tb_set_build_flags(TB_BUILD_TRIM_TRANSPARENT);
+    tb_handle rgb565 = tb_add_texture(TB_NO_GROUP, __TEST_TRIM_IMAGE_PATH,
+        0, 0, __TEST_TRIM_IMAGE_SIZE, __TEST_TRIM_IMAGE_SIZE,
+        TB_FORMAT_RGB565);
+    tb_handle rgba8 = tb_add_texture(TB_NO_GROUP, __TEST_TRIM_IMAGE_PATH,
+        0, 0, __TEST_TRIM_IMAGE_SIZE, __TEST_TRIM_IMAGE_SIZE,
+        TB_FORMAT_RGBA8);
+    tb_build();
+
+    const float untrimmed[4] = { 0.0f, 0.0f, 1.0f, 1.0f };
+    float pos[2] = { 10.0f, 20.0f };
+    float size[2] = { 64.0f, 32.0f };
+    tb_trim_rect(rgb565, pos, size);
+    EXPECT_ZERO(memcmp(tb_get_texture_table()->trims[rgb565], untrimmed,
+        sizeof(untrimmed)));
+    EXPECT((pos[0] == 10.0f && pos[1] == 20.0f), 1);
+    EXPECT((size[0] == 64.0f && size[1] == 32.0f), 1);
+
+    /* The same subimage stored with alpha loses its transparent border */
+    EXPECT_NOT_ZERO(memcmp(tb_get_texture_table()->trims[rgba8], untrimmed,
+        sizeof(untrimmed)));
+
+    tb_destroy();
+    tb_set_build_flags(0);
+    remove(__TEST_TRIM_IMAGE_PATH);
+    window_terminate();
+    TEST_END
+}
+
+
+RUN_TESTS
+(
+    test_async_build_matches_sync_build,
+    test_cooked_image_trims_like_source_image,
+    test_format_without_alpha_is_not_trimmed
+)
+
+
+#endif /* TEXTURE_BUILDER_TEST */
+#endif /* TEST_RUN */
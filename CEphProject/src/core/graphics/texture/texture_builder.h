@@ -3,34 +3,57 @@
 ;
 ; @brief
 ;   This module implements the logic for creating and placing textures in video
-;   memory on certain OpenGL texture 2d arrays, units and layers.
+;   memory on certain OpenGL texture 2d arrays and layers.
 ;
 ; @usage:
 ;   - specify images (or parts of them) that should be used as textures using
-;     the 'tb_add_texture' function;
+;     the 'tb_add_texture' function (or all cells of a grid image using the
+;     'tb_add_sprite_sheet' function);
 ;   - load this images into video memory using the 'tb_build' function;
+;   - or start loading them in the background using 'tb_build_async' and
+;     wait until 'tb_is_build_done' returns 1;
+;   - call 'tb_get_build_stats' to find out where the build time goes;
 ;   - remove the created textures after use using the 'tb_destroy' function.
 ;     This function will remove all 2d texture arrays created with
 ;     'tb_add_texture' + 'tb_build' from video memory and free their associated
 ;     data from RAM.
 ;
 ; @notes:
-;   Each texture has an OpenGL texture id, texture 2d array, texture unit and
-;   texture 2d array z-offset. There are situations when for several textures
-;   all these values must be the same (for example, if several dozen textures
-;   are used to draw the map, it would be logical to place them all on one layer
-;   so that the map can be drawn with one call of the corresponding OpenGL
+;   Each texture has an OpenGL texture id, texture 2d array and texture 2d
+;   array z-offset. There are situations when for several textures all these
+;   values must be the same (for example, if several dozen textures are used
+;   to draw the map, it would be logical to place them all on one layer so
+;   that the map can be drawn with one call of the corresponding OpenGL
 ;   function). To solve this problem, the 'group_idx' argument is implemented in
 ;   the 'tb_add_texture' function. All textures with the same 'group_idx', not
 ;   equal to 'TB_NO_GROUP', are guaranteed to be placed on the same layer of the
-;   same unit of the same 2d texture array (provided that the graphics card has
-;   the necessary resource for this).
+;   same 2d texture array (provided that the graphics card has the necessary
+;   resource for this).
 ;
-;   The data pointed to by the pointer returned from 'tb_add_texture' becomes
-;   valid only after calling the 'tb_build' function.
+;   Arrays do not own texture units, so any number of arrays can be created.
+;   Use the 'texture_units' module to bind an array to a unit before drawing.
 ;
-;   After calling 'tb_destroy', all 'stTexture*' returned from 'tb_add_texture'
-;   become invalid. 
+;   Each texture is stored in one of the 'TB_FORMAT_*' formats. Image pixels
+;   are converted to the requested format on the CPU side during the build, so
+;   single-channel masks, distance fields and lookup tables can be stored as
+;   'TB_FORMAT_R8' and take a quarter of the 'TB_FORMAT_RGBA8' memory. Missing
+;   color channels of grayscale images are replicated from the gray channel,
+;   a missing alpha channel is treated as opaque. All textures of one group
+;   share the format of the first texture added to the group.
+;
+;   Textures with identical pixels (for example, the same tile requested under
+;   different groups) are placed in video memory only once and get the same
+;   UVs. Textures of a group share placement only with textures of the same
+;   group; ungrouped textures share placement with any identical texture.
+;
+;   Textures are addressed by handles returned from 'tb_add_texture'. The data
+;   of a texture is stored in the texture table ('tb_get_texture_table') at
+;   the index equal to the handle and becomes valid only after calling the
+;   'tb_build' function. The table arrays are reallocated when textures are
+;   added, so pointers into them must not be kept across 'tb_add_*' calls.
+;
+;   After calling 'tb_destroy', all handles returned from 'tb_add_texture'
+;   become invalid and may be returned again by the next 'tb_add_*' calls.
 ;
 ; @date   October 2021
 ; @author Eph
@@ -46,42 +69,104 @@
 
 #define TB_NO_GROUP 0
 
+/* Storage formats of the texture 2d arrays. Textures with different formats
+   are never placed on the same array. */
+#define TB_FORMAT_RGBA8     0           /* 4 bytes per pixel                  */
+#define TB_FORMAT_RGBA4444  1           /* 2 bytes per pixel                  */
+#define TB_FORMAT_RGB565    2           /* 2 bytes per pixel, no alpha        */
+#define TB_FORMAT_RG8       3           /* 2 bytes per pixel                  */
+#define TB_FORMAT_R8        4           /* 1 byte per pixel                   */
+#define TB_FORMATS_COUNT    5
+
+/* 'tb_build' flags */
+#define TB_BUILD_PREMULTIPLY_ALPHA  0x01 /* Multiply colors by alpha. Such    */
+                                        /* textures must be blended with the  */
+                                        /* (GL_ONE, GL_ONE_MINUS_SRC_ALPHA)   */
+                                        /* blend function                     */
+#define TB_BUILD_TRIM_TRANSPARENT   0x02 /* Remove fully transparent borders  */
+                                        /* before placement (see 'trim')      */
+#define TB_BUILD_ALLOW_ROTATION     0x04 /* Allow placing textures rotated by */
+                                        /* 90 degrees. 'vertices' of such     */
+                                        /* textures are rotated accordingly   */
+#define TB_BUILD_LOG_STATS          0x08 /* Log 'stTextureBuildStats' when    */
+                                        /* the build is complete              */
+
 /** @types -------------------------------------------------------------------*/
 
-typedef struct
-{
-    int array_id; // TODO: Remove this field?
-    unsigned int unit;
-    int z_offset;
-}stTextureInfo;
+typedef unsigned int tb_handle;
+#define TB_INVALID_HANDLE 0
 
 
+/* Built textures as a structure of arrays indexed by handles. Handle 0 is
+   never used. */
 typedef struct
 {
-    /* It should be a separate object, because after loading textures into video
-       memory, information about vertices ('vertices' array) should be removed
-       as unnecessary, but the other fields will be used for rendering. */
-    stTextureInfo* texture_info_ptr;
-    // TODO: After implementing the 'sprite' module:
-    //          1. Use the 'stTextureInfo' object instead of a pointer to it.
-    //          2. At the stage of sprite creation - copy this 'stTextureInfo'
-    //             object into the memory area next to the sprite (this will
-    //             increase the rendering speed, since both texture information
-    //             and sprite information will be accessed from approximately
-    //             the same place).
+    /* Texture coordinates of the top right, bottom right, bottom left and top
+       left corners of the texture */
+    float (*vertices)[8];
+
+    /* Part of the requested subimage that is actually stored in video memory,
+       as fractions of the subimage size: { left, top, width, height }. It is
+       { 0, 0, 1, 1 } unless the 'TB_BUILD_TRIM_TRANSPARENT' flag removed fully
+       transparent borders. Use 'tb_trim_rect' to adjust the quad on which the
+       texture is drawn, so the rendering stays identical. */
+    float (*trims)[4];
 
-    float vertices[8];
-}stTexture;
+    /* Texture 2d array. Bind it with 'tu_bind' to get the texture unit for
+       drawing */
+    unsigned int* array_ids;
 
+    int* z_offsets;                     /* Layer of the array                 */
+    unsigned char* formats;             /* One of the 'TB_FORMAT_*' values    */
 
+    unsigned int count;                 /* Handles are less than 'count'      */
+}stTextureTable;
 
-stTexture* tb_add_texture(int group_idx,  const char* image_path, int subimg_x,
-    int subimg_y, int subimg_w, int subimg_h);
 
+/* Statistics of the last build. Times are in seconds. Images decoded by
+   'tb_add_sprite_sheet' before the build are counted too. */
+typedef struct
+{
+    double placement_time;              /* Trimming, deduplication, fitting   */
+    double sizing_time;                 /* Array size calculation, creation   */
+    double decode_time;                 /* Image decoding                     */
+    double upload_time;                 /* Pixel conversion and uploading     */
+    double cleanup_time;                /* Hand-over to the residency manager */
+                                        /* and freeing the build data         */
+    double total_time;                  /* From the start of the build until  */
+                                        /* the textures are available         */
+
+    int images_decoded;
+    int textures_uploaded;              /* Sprite sheets are uploaded at once */
+    int duplicates_count;               /* Textures sharing another placement */
+    size_t bytes_uploaded;
+    int arrays_count;
+    int layers_count;
+
+    /* Part of the layer pixels covered by textures, one value per layer in the
+       order of arrays and their layers. Valid until the next build */
+    const float* layers_occupancy;
+    float average_occupancy;
+}stTextureBuildStats;
+
+
+
+tb_handle tb_add_texture(int group_idx,  const char* image_path, int subimg_x,
+    int subimg_y, int subimg_w, int subimg_h, int format);
+tb_handle tb_add_sprite_sheet(int group_idx, const char* image_path,
+    int cell_w, int cell_h, int count, int format);
+
+void tb_set_build_flags(unsigned int flags);
 void tb_build(void);
+void tb_build_async(void);
+int tb_is_build_done(void);
 
 void tb_destroy(void);
 
+const stTextureTable* tb_get_texture_table(void);
+void tb_get_build_stats(stTextureBuildStats* out_stats);
+void tb_trim_rect(tb_handle texture, float* pos, float* size);
+
 
 
 #endif /* !TEXTURE_BUILDER_H */
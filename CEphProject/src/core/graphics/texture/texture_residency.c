@@ -0,0 +1,505 @@
+/**-----------------------------------------------------------------------------
+; @file texture_residency.c
+;
+; @brief
+;   The file implements the functionality of the 'texture_residency' module.
+;
+;   tr - texture residency
+;
+; @date   October 2021
+; @author Eph
+;
+-----------------------------------------------------------------------------**/
+
+
+
+/** @includes ----------------------------------------------------------------*/
+#include <glad/glad.h>
+
+#include "texture_residency.h"
+#include "../../memory.h"
+#include "../../../containers/list.h"
+#include "../../../log.h"
+
+
+
+/** @types -------------------------------------------------------------------*/
+
+typedef struct
+{
+    unsigned int array_id;
+    int width;
+    int height;
+    int depth;
+    GLenum internal_format;
+    GLenum format;
+    GLenum type;
+    size_t size;                        /* Bytes of video memory              */
+    unsigned int last_used_frame;
+    int is_resident;
+    unsigned char* cpu_copy;            /* Pixels of all layers, NULL until   */
+                                        /* the first eviction                 */
+}stResidentArray;
+
+
+
+/** @static_data -------------------------------------------------------------*/
+static list* _arrays = NULL;            /* List of 'stResidentArray' objects  */
+static size_t _budget = 0;
+static size_t _resident_bytes = 0;
+static unsigned int _frame = 0;
+static unsigned int _frame_evictions = 0;
+static unsigned int _frame_uploads = 0;
+static unsigned int _total_evictions = 0;
+static unsigned int _total_uploads = 0;
+
+
+
+/** @internal_prototypes -----------------------------------------------------*/
+static list_node* _find_array_node(unsigned int array_id);
+static void _make_room(size_t bytes);
+static int _evict(stResidentArray* ra);
+static void _upload(stResidentArray* ra);
+
+
+
+/** @functions ---------------------------------------------------------------*/
+
+/**-----------------------------------------------------------------------------
+; @func tr_set_budget
+;
+; @brief
+;   Sets the maximum number of bytes of video memory the registered arrays may
+;   occupy. 0 - no limit. The budget is applied at the next 'tr_begin_frame'.
+;
+-----------------------------------------------------------------------------**/
+void tr_set_budget(size_t bytes)
+{
+    extern size_t _budget;
+
+    _budget = bytes;
+}
+
+
+/**-----------------------------------------------------------------------------
+; @func tr_register
+;
+; @brief
+;   Starts tracking a filled texture 2d array. The array is considered used in
+;   the current frame.
+;
+; @params
+;   array_id        | Texture 2d array created with 'glTexImage3D'.
+;   width           | Width of the array.
+;   height          | Height of the array.
+;   depth           | Number of layers.
+;   internal_format | Internal format of the array.
+;   format          | Format of the pixel data used to copy the array to RAM.
+;   type            | Data type of the pixel data.
+;   bytes_per_pixel | Size of a pixel of the 'format' + 'type' data.
+;
+-----------------------------------------------------------------------------**/
+void tr_register(unsigned int array_id, int width, int height, int depth,
+    unsigned int internal_format, unsigned int format, unsigned int type,
+    int bytes_per_pixel)
+{
+    extern list* _arrays;
+    extern size_t _resident_bytes;
+    extern unsigned int _frame;
+
+    if (_find_array_node(array_id) != NULL)
+        tr_unregister(array_id);
+
+    stResidentArray* ra = m_calloc(1, sizeof(stResidentArray));
+    if (NULL == ra)
+        return;
+    ra->array_id = array_id;
+    ra->width = width;
+    ra->height = height;
+    ra->depth = depth;
+    ra->internal_format = internal_format;
+    ra->format = format;
+    ra->type = type;
+    ra->size = (size_t)width * height * depth * bytes_per_pixel;
+    ra->last_used_frame = _frame;
+    ra->is_resident = 1;
+
+    if (NULL == _arrays)
+        _arrays = list_create();
+    list_push(_arrays, ra);
+    _resident_bytes += ra->size;
+
+    _make_room(0);
+}
+
+
+/**-----------------------------------------------------------------------------
+; @func tr_unregister
+;
+; @brief
+;   Stops tracking the array and frees its copy in RAM. Must be called before
+;   the array is deleted.
+;
+-----------------------------------------------------------------------------**/
+void tr_unregister(unsigned int array_id)
+{
+    extern list* _arrays;
+    extern size_t _resident_bytes;
+
+    list_node* node = _find_array_node(array_id);
+    if (NULL == node)
+        return;
+
+    stResidentArray* ra = node->data;
+    if (ra->is_resident)
+        _resident_bytes -= ra->size;
+    m_free(ra->cpu_copy);
+    m_free(ra);
+    list_erase(_arrays, node);
+
+    if (list_is_empty(_arrays))
+    {
+        list_destroy(_arrays);
+        _arrays = NULL;
+    }
+}
+
+
+/**-----------------------------------------------------------------------------
+; @func tr_begin_frame
+;
+; @brief
+;   Starts a new frame and evicts the least recently used arrays while the
+;   budget is exceeded.
+;
+-----------------------------------------------------------------------------**/
+void tr_begin_frame(void)
+{
+    extern unsigned int _frame;
+    extern unsigned int _frame_evictions;
+    extern unsigned int _frame_uploads;
+
+    _frame++;
+    _frame_evictions = 0;
+    _frame_uploads = 0;
+    _make_room(0);
+}
+
+
+/**-----------------------------------------------------------------------------
+; @func tr_touch
+;
+; @brief
+;   Marks the array as used in the current frame. An evicted array is uploaded
+;   to video memory again; arrays not used in the current frame are evicted to
+;   make room for it if needed.
+;
+-----------------------------------------------------------------------------**/
+void tr_touch(unsigned int array_id)
+{
+    extern unsigned int _frame;
+
+    list_node* node = _find_array_node(array_id);
+    if (NULL == node)
+        return;
+
+    stResidentArray* ra = node->data;
+    ra->last_used_frame = _frame;
+    if (!ra->is_resident)
+    {
+        _make_room(ra->size);
+        _upload(ra);
+    }
+}
+
+
+void tr_get_stats(stTextureResidencyStats* out_stats)
+{
+    extern list* _arrays;
+    extern size_t _budget;
+    extern size_t _resident_bytes;
+    extern unsigned int _frame_evictions;
+    extern unsigned int _frame_uploads;
+    extern unsigned int _total_evictions;
+    extern unsigned int _total_uploads;
+
+    out_stats->budget = _budget;
+    out_stats->resident_bytes = _resident_bytes;
+    out_stats->evicted_bytes = 0;
+    out_stats->cpu_copy_bytes = 0;
+    out_stats->resident_arrays_count = 0;
+    out_stats->evicted_arrays_count = 0;
+    out_stats->frame_evictions = _frame_evictions;
+    out_stats->frame_uploads = _frame_uploads;
+    out_stats->total_evictions = _total_evictions;
+    out_stats->total_uploads = _total_uploads;
+
+    if (NULL == _arrays)
+        return;
+
+    for (list_node* node = _arrays->nodes; node != NULL; node = node->next)
+    {
+        stResidentArray* ra = node->data;
+        if (ra->is_resident)
+        {
+            out_stats->resident_arrays_count++;
+        }
+        else
+        {
+            out_stats->evicted_arrays_count++;
+            out_stats->evicted_bytes += ra->size;
+        }
+        if (ra->cpu_copy != NULL)
+            out_stats->cpu_copy_bytes += ra->size;
+    }
+}
+
+
+/**-----------------------------------------------------------------------------
+; @func tr_destroy
+;
+; @brief
+;   Stops tracking all arrays and frees their copies in RAM. The arrays
+;   themselves are not deleted.
+;
+-----------------------------------------------------------------------------**/
+void tr_destroy(void)
+{
+    extern list* _arrays;
+    extern size_t _budget;
+    extern size_t _resident_bytes;
+
+    if (_arrays != NULL)
+    {
+        for (list_node* node = _arrays->nodes; node != NULL;
+            node = node->next)
+        {
+            stResidentArray* ra = node->data;
+            m_free(ra->cpu_copy);
+            m_free(ra);
+        }
+        list_destroy(_arrays);
+        _arrays = NULL;
+    }
+    _budget = 0;
+    _resident_bytes = 0;
+}
+
+
+static list_node* _find_array_node(unsigned int array_id)
+{
+    extern list* _arrays;
+
+    if (NULL == _arrays)
+        return NULL;
+
+    for (list_node* node = _arrays->nodes; node != NULL; node = node->next)
+    {
+        stResidentArray* ra = node->data;
+        if ((ra != NULL) && (ra->array_id == array_id))
+            return node;
+    }
+    return NULL;
+}
+
+
+/**-----------------------------------------------------------------------------
+; @func _make_room
+;
+; @brief
+;   Evicts the least recently used arrays until 'bytes' more bytes fit into
+;   the budget. Arrays used in the current frame are never evicted, so the
+;   budget may stay exceeded.
+;
+-----------------------------------------------------------------------------**/
+static void _make_room(size_t bytes)
+{
+    extern list* _arrays;
+    extern size_t _budget;
+    extern size_t _resident_bytes;
+    extern unsigned int _frame;
+
+    if ((0 == _budget) || (NULL == _arrays))
+        return;
+
+    while (_resident_bytes + bytes > _budget)
+    {
+        stResidentArray* victim = NULL;
+        for (list_node* node = _arrays->nodes; node != NULL; node = node->next)
+        {
+            stResidentArray* ra = node->data;
+            if ((NULL == ra) || !ra->is_resident ||
+                (ra->last_used_frame == _frame))
+            {
+                continue;
+            }
+            if ((NULL == victim) ||
+                (ra->last_used_frame < victim->last_used_frame))
+            {
+                victim = ra;
+            }
+        }
+        if ((NULL == victim) || (_evict(victim) != 0))
+            return;
+    }
+}
+
+
+static int _evict(stResidentArray* ra)
+{
+    extern size_t _resident_bytes;
+    extern unsigned int _frame_evictions;
+    extern unsigned int _total_evictions;
+
+    int bound_texture = 0;
+    GL_CALL(glGetIntegerv(GL_TEXTURE_BINDING_2D_ARRAY, &bound_texture));
+    GL_CALL(glBindTexture(GL_TEXTURE_2D_ARRAY, ra->array_id));
+
+    /* The arrays are not changed after they are built, so the copy made on the
+       first eviction stays valid */
+    if (NULL == ra->cpu_copy)
+    {
+        ra->cpu_copy = m_malloc(ra->size);
+        if (NULL == ra->cpu_copy)
+        {
+            LOG_ERROR("Unable to evict the texture 2d array [%u]. Not enough "
+                "memory for a copy of [%zu] bytes.", ra->array_id, ra->size);
+            GL_CALL(glBindTexture(GL_TEXTURE_2D_ARRAY, bound_texture));
+            return -1;
+        }
+        GL_CALL(glPixelStorei(GL_PACK_ALIGNMENT, 1));
+        GL_CALL(glGetTexImage(GL_TEXTURE_2D_ARRAY, 0, ra->format, ra->type,
+            ra->cpu_copy));
+        GL_CALL(glPixelStorei(GL_PACK_ALIGNMENT, 4));
+    }
+
+    /* Release the video memory, the texture name and parameters are kept */
+    GL_CALL(glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, ra->internal_format,
+        0, 0, 0, 0, ra->format, ra->type, NULL));
+
+    GL_CALL(glBindTexture(GL_TEXTURE_2D_ARRAY, bound_texture));
+
+    ra->is_resident = 0;
+    _resident_bytes -= ra->size;
+    _frame_evictions++;
+    _total_evictions++;
+    return 0;
+}
+
+
+static void _upload(stResidentArray* ra)
+{
+    extern size_t _resident_bytes;
+    extern unsigned int _frame_uploads;
+    extern unsigned int _total_uploads;
+
+    int bound_texture = 0;
+    GL_CALL(glGetIntegerv(GL_TEXTURE_BINDING_2D_ARRAY, &bound_texture));
+    GL_CALL(glBindTexture(GL_TEXTURE_2D_ARRAY, ra->array_id));
+
+    GL_CALL(glPixelStorei(GL_UNPACK_ALIGNMENT, 1));
+    GL_CALL(glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, ra->internal_format,
+        ra->width, ra->height, ra->depth, 0, ra->format, ra->type,
+        ra->cpu_copy));
+    GL_CALL(glPixelStorei(GL_UNPACK_ALIGNMENT, 4));
+
+    GL_CALL(glBindTexture(GL_TEXTURE_2D_ARRAY, bound_texture));
+
+    ra->is_resident = 1;
+    _resident_bytes += ra->size;
+    _frame_uploads++;
+    _total_uploads++;
+}
+
+
+
+/** @tests-------------------------------------------------------------------**/
+//#define TEST_RUN
+//#define TEXTURE_RESIDENCY_TEST
+//#define TEST_MODULE TEXTURE_RESIDENCY
+
+#ifdef TEST_RUN
+#ifdef TEXTURE_RESIDENCY_TEST
+
+#include <string.h> /* memcmp */
+
+#include <GLFW/glfw3.h>
+
+#include "../../window.h"
+#include "../../../test.h"
+
+
+static unsigned int _create_filled_array(unsigned char value)
+{
+    static unsigned char pixels[16 * 16 * 2 * 4];
+    memset(pixels, value, sizeof(pixels));
+
+    unsigned int array_id = 0;
+    glGenTextures(1, &array_id);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, array_id);
+    glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA8, 16, 16, 2, 0, GL_RGBA,
+        GL_UNSIGNED_BYTE, pixels);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+    tr_register(array_id, 16, 16, 2, GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE, 4);
+    return array_id;
+}
+
+
+/**-----------------------------------------------------------------------------
+; @unit_test
+;
+; @brief
+;   With a budget of one array, using the arrays in turn evicts the other one
+;   and uploads the used one again with the same pixels.
+;
+-----------------------------------------------------------------------------**/
+TEST_BEGIN(test_evict_and_upload_again)
+{
+    EXPECT_ZERO(window_init("test", 1, 1, 0, 0));
+
+    const size_t array_size = 16 * 16 * 2 * 4;
+    tr_set_budget(array_size);
+    unsigned int a = _create_filled_array(0x11);
+    unsigned int b = _create_filled_array(0x22);
+
+    stTextureResidencyStats stats;
+    tr_begin_frame();
+    tr_touch(b);
+    tr_get_stats(&stats);
+    EXPECT(stats.resident_arrays_count, 1);
+    EXPECT(stats.evicted_arrays_count, 1);
+    EXPECT(stats.resident_bytes, array_size);
+    EXPECT(stats.frame_evictions, 1u);
+
+    tr_begin_frame();
+    tr_touch(a);
+    tr_get_stats(&stats);
+    EXPECT(stats.frame_uploads, 1u);
+    EXPECT(stats.frame_evictions, 1u);
+    EXPECT(stats.resident_bytes, array_size);
+    EXPECT(stats.cpu_copy_bytes, array_size * 2);
+
+    static unsigned char pixels[16 * 16 * 2 * 4];
+    static unsigned char expected[16 * 16 * 2 * 4];
+    memset(expected, 0x11, sizeof(expected));
+    glBindTexture(GL_TEXTURE_2D_ARRAY, a);
+    glGetTexImage(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+    EXPECT_ZERO(memcmp(pixels, expected, sizeof(pixels)));
+
+    tr_unregister(a);
+    tr_destroy();
+    glDeleteTextures(1, &a);
+    glDeleteTextures(1, &b);
+    glfwTerminate();
+    TEST_END
+}
+
+
+RUN_TESTS
+(
+    test_evict_and_upload_again
+)
+
+
+#endif /* TEXTURE_RESIDENCY_TEST */
+#endif /* TEST_RUN */
@@ -0,0 +1,71 @@
+/**-----------------------------------------------------------------------------
+; @file texture_residency.h
+;
+; @brief
+;   This module keeps the video memory used by texture 2d arrays within a
+;   budget. Each array remembers the last frame in which it was used. When the
+;   resident arrays exceed the budget, the least recently used arrays (not
+;   used in the current frame) are evicted: their pixels are copied to RAM and
+;   their video memory is released, but the OpenGL texture name stays valid.
+;   An evicted array is uploaded again as soon as it is used.
+;
+; @usage:
+;   - set the budget with 'tr_set_budget' (0 - unlimited, the default);
+;   - register each filled array with 'tr_register' (the texture builder does
+;     it for the arrays it creates);
+;   - call 'tr_begin_frame' once per frame (the main loop does it) and
+;     'tr_touch' for each array used by the frame ('tu_bind' does it);
+;   - call 'tr_unregister' before deleting an array;
+;   - call 'tr_destroy' at exit to free the copies of the remaining arrays.
+;
+; @notes:
+;   OpenGL cannot release the memory of a single layer of an array, so whole
+;   arrays are evicted.
+;
+; @date   October 2021
+; @author Eph
+;
+-----------------------------------------------------------------------------**/
+
+
+
+#ifndef TEXTURE_RESIDENCY_H
+#define TEXTURE_RESIDENCY_H
+
+
+
+#include <stddef.h> /* size_t */
+
+
+
+/** @types -------------------------------------------------------------------*/
+
+typedef struct
+{
+    size_t budget;                      /* Bytes, 0 - unlimited               */
+    size_t resident_bytes;              /* Video memory used by the arrays    */
+    size_t evicted_bytes;               /* Video memory released by eviction  */
+    size_t cpu_copy_bytes;              /* RAM used by copies of the arrays   */
+    int resident_arrays_count;
+    int evicted_arrays_count;
+    unsigned int frame_evictions;       /* Arrays evicted this frame          */
+    unsigned int frame_uploads;         /* Arrays uploaded again this frame   */
+    unsigned int total_evictions;
+    unsigned int total_uploads;
+}stTextureResidencyStats;
+
+
+
+void tr_set_budget(size_t bytes);
+void tr_register(unsigned int array_id, int width, int height, int depth,
+    unsigned int internal_format, unsigned int format, unsigned int type,
+    int bytes_per_pixel);
+void tr_unregister(unsigned int array_id);
+void tr_begin_frame(void);
+void tr_touch(unsigned int array_id);
+void tr_get_stats(stTextureResidencyStats* out_stats);
+void tr_destroy(void);
+
+
+
+#endif /* !TEXTURE_RESIDENCY_H */
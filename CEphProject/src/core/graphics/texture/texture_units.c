@@ -0,0 +1,426 @@
+/**-----------------------------------------------------------------------------
+; @file texture_units.c
+;
+; @brief
+;   The file implements the functionality of the 'texture_units' module.
+;
+;   tu - texture units
+;
+; @date   October 2021
+; @author Eph
+;
+-----------------------------------------------------------------------------**/
+
+
+
+/** @includes ----------------------------------------------------------------*/
+#include <stdlib.h> /* qsort */
+
+#include <glad/glad.h>
+
+#include "texture_units.h"
+#include "texture_residency.h"
+#include "../../memory.h"
+#include "../../../log.h"
+
+
+
+/** @types -------------------------------------------------------------------*/
+
+typedef struct
+{
+    unsigned int array_id;              /* 0 - the unit is free               */
+    unsigned int batch;                 /* Last batch that used the unit      */
+    unsigned long long last_use;        /* Last 'tu_bind' call that used the  */
+                                        /* unit                               */
+}stUnitSlot;
+
+
+
+/** @static_data -------------------------------------------------------------*/
+static stUnitSlot* _slots = NULL;
+static int _units_count = 0;
+static unsigned int _batch = 1;
+static unsigned long long _uses = 0;
+static unsigned int _binds = 0;
+static unsigned int _last_frame_binds = 0;
+
+
+
+/** @internal_prototypes -----------------------------------------------------*/
+static int _init(void);
+static int _find_slot(unsigned int array_id);
+static int _find_victim_slot(void);
+static int _compare_batches(const void* a, const void* b);
+
+
+
+/** @functions ---------------------------------------------------------------*/
+
+/**-----------------------------------------------------------------------------
+; @func tu_begin_frame
+;
+; @brief
+;   Starts counting texture binds of a new frame.
+;
+-----------------------------------------------------------------------------**/
+void tu_begin_frame(void)
+{
+    extern unsigned int _binds;
+    extern unsigned int _last_frame_binds;
+
+    _last_frame_binds = _binds;
+    _binds = 0;
+    tu_begin_batch();
+}
+
+
+/**-----------------------------------------------------------------------------
+; @func tu_begin_batch
+;
+; @brief
+;   Starts a new draw batch. Units bound in the previous batches can be reused
+;   by the arrays of the new one.
+;
+-----------------------------------------------------------------------------**/
+void tu_begin_batch(void)
+{
+    extern unsigned int _batch;
+
+    _batch++;
+}
+
+
+/**-----------------------------------------------------------------------------
+; @func tu_bind
+;
+; @brief
+;   Makes the texture 2d array available to the current draw batch. If the
+;   array is not bound to any unit yet, it is bound to a free unit or to the
+;   least recently used unit that is not used by the current batch. The
+;   active texture unit is changed in this case.
+;
+; @params
+;   array_id | Texture 2d array.
+;
+; @return
+;   Index of the unit (0 for 'GL_TEXTURE0') to which the array is bound or
+;   'TU_FAIL' if all units are used by the current batch.
+;
+-----------------------------------------------------------------------------**/
+int tu_bind(unsigned int array_id)
+{
+    extern stUnitSlot* _slots;
+    extern unsigned int _batch;
+    extern unsigned long long _uses;
+    extern unsigned int _binds;
+
+    if (_init() != 0)
+        return TU_FAIL;
+
+    /* Upload the array again if it was evicted from video memory */
+    tr_touch(array_id);
+
+    int slot = _find_slot(array_id);
+    if (TU_FAIL == slot)
+    {
+        slot = _find_victim_slot();
+        if (TU_FAIL == slot)
+        {
+            LOG_ERROR("Unable to bind the texture 2d array [%u]. All texture "
+                "units are used by the current batch.", array_id);
+            return TU_FAIL;
+        }
+        GL_CALL(glActiveTexture(GL_TEXTURE0 + slot));
+        GL_CALL(glBindTexture(GL_TEXTURE_2D_ARRAY, array_id));
+        _slots[slot].array_id = array_id;
+        _binds++;
+    }
+    _slots[slot].batch = _batch;
+    _slots[slot].last_use = ++_uses;
+    return slot;
+}
+
+
+/**-----------------------------------------------------------------------------
+; @func tu_release
+;
+; @brief
+;   Forgets the unit of the texture 2d array. Must be called before the array
+;   is deleted, since OpenGL may reuse its name for a new texture.
+;
+-----------------------------------------------------------------------------**/
+void tu_release(unsigned int array_id)
+{
+    extern stUnitSlot* _slots;
+
+    if (NULL == _slots)
+        return;
+
+    int slot = _find_slot(array_id);
+    if (slot != TU_FAIL)
+    {
+        _slots[slot].array_id = 0;
+        _slots[slot].batch = 0;
+        _slots[slot].last_use = 0;
+    }
+}
+
+
+/**-----------------------------------------------------------------------------
+; @func tu_sort_batches
+;
+; @brief
+;   Sorts the draw batches so batches of the same array follow each other and
+;   arrays that are already bound come first. Drawing the batches in this
+;   order binds each array at most once per frame.
+;
+-----------------------------------------------------------------------------**/
+void tu_sort_batches(stTextureBatch* batches, int count)
+{
+    if (_init() != 0)
+        return;
+
+    for (int i = 0; i < count; i++)
+    {
+        int is_bound = (_find_slot(batches[i].array_id) != TU_FAIL);
+        batches[i].sort_key = ((unsigned long long)!is_bound << 32) |
+            batches[i].array_id;
+    }
+    qsort(batches, count, sizeof(stTextureBatch), _compare_batches);
+}
+
+
+void tu_get_stats(stTextureUnitsStats* out_stats)
+{
+    extern stUnitSlot* _slots;
+    extern int _units_count;
+    extern unsigned int _binds;
+    extern unsigned int _last_frame_binds;
+
+    out_stats->units_count = _units_count;
+    out_stats->bound_arrays_count = 0;
+    out_stats->binds = _binds;
+    out_stats->last_frame_binds = _last_frame_binds;
+    for (int i = 0; i < _units_count; i++)
+    {
+        if (_slots[i].array_id != 0)
+            out_stats->bound_arrays_count++;
+    }
+}
+
+
+void tu_destroy(void)
+{
+    extern stUnitSlot* _slots;
+    extern int _units_count;
+
+    m_free(_slots);
+    _slots = NULL;
+    _units_count = 0;
+}
+
+
+static int _init(void)
+{
+    extern stUnitSlot* _slots;
+    extern int _units_count;
+
+    if (_slots != NULL)
+        return 0;
+
+    /* Get the maximum supported texture image units that can be used to access
+       texture maps from the fragment shader */
+    GL_CALL(glGetIntegerv(GL_MAX_TEXTURE_IMAGE_UNITS, &_units_count));
+    if (_units_count <= 0)
+    {
+        LOG_ERROR("Unable to get the number of texture units.");
+        _units_count = 0;
+        return -1;
+    }
+    if (_units_count > TU_MAX_UNITS)
+        _units_count = TU_MAX_UNITS;
+
+    _slots = m_calloc(_units_count, sizeof(stUnitSlot));
+    if (NULL == _slots)
+    {
+        _units_count = 0;
+        return -1;
+    }
+    return 0;
+}
+
+
+static int _find_slot(unsigned int array_id)
+{
+    extern stUnitSlot* _slots;
+    extern int _units_count;
+
+    for (int i = 0; i < _units_count; i++)
+    {
+        if (_slots[i].array_id == array_id)
+            return i;
+    }
+    return TU_FAIL;
+}
+
+
+static int _find_victim_slot(void)
+{
+    extern stUnitSlot* _slots;
+    extern int _units_count;
+    extern unsigned int _batch;
+
+    int victim = TU_FAIL;
+    for (int i = 0; i < _units_count; i++)
+    {
+        if (0 == _slots[i].array_id)
+            return i;
+        if (_slots[i].batch == _batch)
+            continue;
+        if ((TU_FAIL == victim) ||
+            (_slots[i].last_use < _slots[victim].last_use))
+        {
+            victim = i;
+        }
+    }
+    return victim;
+}
+
+
+static int _compare_batches(const void* a, const void* b)
+{
+    unsigned long long key_a = ((const stTextureBatch*)a)->sort_key;
+    unsigned long long key_b = ((const stTextureBatch*)b)->sort_key;
+    return (key_a > key_b) - (key_a < key_b);
+}
+
+
+
+/** @tests-------------------------------------------------------------------**/
+//#define TEST_RUN
+//#define TEXTURE_UNITS_TEST
+//#define TEST_MODULE TEXTURE_UNITS
+
+#ifdef TEST_RUN
+#ifdef TEXTURE_UNITS_TEST
+
+#include <GLFW/glfw3.h>
+
+#include "../../window.h"
+#include "../../../test.h"
+
+
+static unsigned int* _create_arrays(int count)
+{
+    unsigned int* arrays = m_malloc(sizeof(unsigned int) * count);
+    glGenTextures(count, arrays);
+    return arrays;
+}
+
+
+/**-----------------------------------------------------------------------------
+; @unit_test
+;
+; @brief
+;   Draws twice as many arrays as there are units per frame. The first frame
+;   binds every array, the next sorted frames rebind only the arrays that did
+;   not fit on the units.
+;
+-----------------------------------------------------------------------------**/
+TEST_BEGIN(test_more_arrays_than_units)
+{
+    EXPECT_ZERO(window_init("test", 1, 1, 0, 0));
+
+    int units_count = 0;
+    glGetIntegerv(GL_MAX_TEXTURE_IMAGE_UNITS, &units_count);
+    if (units_count > TU_MAX_UNITS)
+        units_count = TU_MAX_UNITS;
+    int arrays_count = units_count * 2;
+    unsigned int* arrays = _create_arrays(arrays_count);
+    stTextureBatch* batches = m_malloc(sizeof(stTextureBatch) * arrays_count);
+
+    for (int frame = 0; frame < 3; frame++)
+    {
+        tu_begin_frame();
+        for (int i = 0; i < arrays_count; i++)
+        {
+            batches[i].array_id = arrays[(i * 7) % arrays_count];
+            batches[i].data = NULL;
+        }
+        tu_sort_batches(batches, arrays_count);
+        for (int i = 0; i < arrays_count; i++)
+        {
+            tu_begin_batch();
+            EXPECT((tu_bind(batches[i].array_id) == TU_FAIL), 0);
+        }
+
+        stTextureUnitsStats stats;
+        tu_get_stats(&stats);
+        EXPECT(stats.bound_arrays_count, units_count);
+        OUTPUT("Frame %d: %d arrays, %d units, %u binds.", frame,
+            arrays_count, units_count, stats.binds);
+        if (0 == frame)
+            EXPECT(stats.binds, (unsigned int)arrays_count);
+        else
+            EXPECT(stats.binds, (unsigned int)(arrays_count - units_count));
+    }
+
+    for (int i = 0; i < arrays_count; i++)
+        tu_release(arrays[i]);
+    glDeleteTextures(arrays_count, arrays);
+    m_free(batches);
+    m_free(arrays);
+    tu_destroy();
+    glfwTerminate();
+    TEST_END
+}
+
+
+/**-----------------------------------------------------------------------------
+; @unit_test
+;
+; @brief
+;   Units used by the current batch are never reused by the same batch.
+;
+-----------------------------------------------------------------------------**/
+TEST_BEGIN(test_batch_pins_units)
+{
+    EXPECT_ZERO(window_init("test", 1, 1, 0, 0));
+
+    int units_count = 0;
+    glGetIntegerv(GL_MAX_TEXTURE_IMAGE_UNITS, &units_count);
+    if (units_count > TU_MAX_UNITS)
+        units_count = TU_MAX_UNITS;
+    unsigned int* arrays = _create_arrays(units_count + 1);
+
+    tu_begin_frame();
+    for (int i = 0; i < units_count; i++)
+        EXPECT(tu_bind(arrays[i]), i);
+    EXPECT(tu_bind(arrays[units_count]), TU_FAIL);
+
+    /* Binding an already bound array does not bind it again */
+    EXPECT(tu_bind(arrays[0]), 0);
+
+    tu_begin_batch();
+    EXPECT((tu_bind(arrays[units_count]) == TU_FAIL), 0);
+
+    for (int i = 0; i <= units_count; i++)
+        tu_release(arrays[i]);
+    glDeleteTextures(units_count + 1, arrays);
+    m_free(arrays);
+    tu_destroy();
+    glfwTerminate();
+    TEST_END
+}
+
+
+RUN_TESTS
+(
+    test_more_arrays_than_units,
+    test_batch_pins_units
+)
+
+
+#endif /* TEXTURE_UNITS_TEST */
+#endif /* TEST_RUN */
@@ -0,0 +1,70 @@
+/**-----------------------------------------------------------------------------
+; @file texture_units.h
+;
+; @brief
+;   This module maps any number of texture 2d arrays onto the texture units
+;   available on the device. Arrays do not own units: an array is bound to a
+;   unit when it is needed by a draw batch and stays there until the unit is
+;   required by another array (the least recently used unit is reused).
+;
+; @usage:
+;   - call 'tu_begin_frame' once per frame (the main loop does it);
+;   - optionally sort the draw batches of the frame with 'tu_sort_batches', so
+;     each array is bound at most once and resident arrays are used first;
+;   - call 'tu_begin_batch' before each draw batch and 'tu_bind' for each
+;     array used by the batch. The returned unit index is the value for the
+;     sampler uniform. Units bound in the current batch are never reused until
+;     the next 'tu_begin_batch' call;
+;   - call 'tu_release' before deleting an array.
+;
+; @date   October 2021
+; @author Eph
+;
+-----------------------------------------------------------------------------**/
+
+
+
+#ifndef TEXTURE_UNITS_H
+#define TEXTURE_UNITS_H
+
+
+
+#define TU_FAIL (-1)
+
+/* Units used at most, even if the device has more. Shaders that select the
+   unit of a draw from a sampler array declare arrays of this size */
+#define TU_MAX_UNITS 16
+
+
+
+/** @types -------------------------------------------------------------------*/
+
+typedef struct
+{
+    unsigned int array_id;              /* Texture 2d array of the batch      */
+    void* data;                         /* User data of the batch             */
+    unsigned long long sort_key;        /* Filled by 'tu_sort_batches'        */
+}stTextureBatch;
+
+
+typedef struct
+{
+    int units_count;                    /* Texture units available            */
+    int bound_arrays_count;             /* Arrays currently bound to units    */
+    unsigned int binds;                 /* 'glBindTexture' calls this frame   */
+    unsigned int last_frame_binds;      /* 'glBindTexture' calls last frame   */
+}stTextureUnitsStats;
+
+
+
+void tu_begin_frame(void);
+void tu_begin_batch(void);
+int tu_bind(unsigned int array_id);
+void tu_release(unsigned int array_id);
+void tu_sort_batches(stTextureBatch* batches, int count);
+void tu_get_stats(stTextureUnitsStats* out_stats);
+void tu_destroy(void);
+
+
+
+#endif /* !TEXTURE_UNITS_H */
@@ -14,33 +14,134 @@
 ;
 -----------------------------------------------------------------------------**/
 
+#include <stddef.h> /* offsetof */
+#include <stdlib.h> /* qsort */
+#include <string.h> /* memcmp, memcpy */
+
 #include <glad/glad.h>
 
 #include "vertex_array.h"
-#include "../../containers/list.h"
 #include "../../containers/map.h"
 #include "../memory.h"
 #include "../../log.h"
 
 
 
-#define VERTICES_PER_RECTANGLE 8
-#define TEXTURE_VERTICES_PER_RECTANGLE VERTICES_PER_RECTANGLE
+#define VERTICES_PER_RECTANGLE 4
 #define INDICES_PER_RECTANGLE 6
-#define INDICES_USAGE_PER_RECTANGLE 4
+#define MIN_QUAD_INDICES_CAPACITY 1024  /* Quads                              */
+#define MIN_DYNAMIC_RECTS 64            /* Minimal rectangles of a region     */
+#define MIN_DYNAMIC_SHAPES 64           /* Minimal shapes of a dynamic array  */
+#define COMPACT_MOVES_PER_FRAME 16      /* Slots moved by 'va_begin_frame'    */
+#define RING_WAIT_TIMEOUT 1000000       /* Nanoseconds of one region wait     */
+#define MAX_UPLOAD_GAP 4                /* Clean objects uploaded to join two */
+                                        /* runs of dirty objects              */
 
 
 
 /** @types -------------------------------------------------------------------*/
 
+/* Record of 'GL_DRAW_INDIRECT_BUFFER' read by 'glMultiDrawElementsIndirect' */
+typedef struct
+{
+    unsigned int count;
+    unsigned int instance_count;
+    unsigned int first_index;
+    int base_vertex;
+    unsigned int base_instance;
+}stDrawElementsIndirectCommand;
+
+
+/* Vertex of 'VA_FORMAT_FLOAT' */
+typedef struct
+{
+    float pos[2];
+    unsigned short txd_pos[2];          /* Normalized                         */
+}stFloatVertex;
+
+
+/* Vertex of 'VA_FORMAT_SHORT' */
+typedef struct
+{
+    short pos[2];                       /* Normalized                         */
+    unsigned short txd_pos[2];          /* Normalized                         */
+}stShortVertex;
+
+
+/* Place of a shape in the regions of a dynamic vertex array */
+typedef struct
+{
+    int first_rect;                     /* First rectangle of the slot        */
+    int rects_capacity;                 /* Rectangles of the slot             */
+    unsigned char dirty_regions;        /* Bit per region to copy the shape   */
+                                        /* into                               */
+    int drawn_first_rect;               /* Rectangles that the region of the  */
+    int drawn_rects_count;              /* frame holds for the shape          */
+}stVaShapeSlot;
+
+
+/* Free rectangles of the regions of a dynamic vertex array */
+typedef struct
+{
+    int first_rect;
+    int rects_count;
+}stVaFreeRange;
+
+
+/* Vertex ring of a dynamic vertex array */
+typedef struct
+{
+    unsigned char* vertices;            /* Vertices of one region, copied to  */
+                                        /* the regions of the ring            */
+    unsigned char* mapped_ring;         /* Persistently mapped vertex buffer, */
+                                        /* NULL before OpenGL 4.4             */
+    GLsync fences[VA_RING_REGIONS];     /* Frame that last read each region   */
+    int region;                         /* Region of the current frame        */
+    int is_region_drawn;                /* The region is read by this frame   */
+    size_t region_size;                 /* Bytes                              */
+    int rects_capacity;                 /* Rectangles of a region             */
+    stVaFreeRange* free_ranges;         /* Sorted by 'first_rect', not        */
+                                        /* adjacent to each other             */
+    int free_count;                     /* Number of 'free_ranges' items      */
+    int is_compacted;                   /* No slot can move to a lower range  */
+    stVaShapeSlot* slots;               /* Indexed by 'stIndicesInfo.idx'     */
+    unsigned int* free_shapes;          /* Indices of removed shapes          */
+    int free_shapes_count;              /* Number of 'free_shapes' items      */
+    unsigned int* dirty_shapes;         /* Shapes with 'dirty_regions'        */
+    int dirty_count;                    /* Number of 'dirty_shapes' items     */
+    int are_commands_dirty;             /* 'va_draw_all' commands are stale   */
+}stVaRing;
+
+
 /* Information about created vertex array */
 typedef struct stVertexArray
 {
     unsigned int vertex_array;          /* OpenGL vertex array object id      */
     unsigned int vertex_buffer;         /* OpenGL GL_ARRAY_BUFFER  object id  */
-    unsigned int txd_vertex_buffer;     /* OpenGL GL_ARRAY_BUFFER  object id  */
-    unsigned int indices_buffer;        /* OpenGL GL_ELEMENT_ARRAY_BUFFER id  */
-    list* ii_list;                      /* List of 'stIndicesInfo'            */
+    unsigned int format;                /* 'VA_FORMAT_*'                      */
+    int vertex_size;                    /* Bytes per vertex of the format     */
+    int is_dynamic;                     /* Created with 'VA_DYNAMIC'          */
+    stVaRing* ring;                     /* Created by 'va_build' if dynamic   */
+    unsigned int index_type;            /* Type of the shared quad indices    */
+    stIndicesInfo** shapes;             /* Indexed by 'stIndicesInfo.idx',    */
+                                        /* NULL for removed shapes            */
+    int shapes_count;                   /* Number of 'shapes' items           */
+    int shapes_capacity;                /* Items 'shapes' and the objects can */
+                                        /* hold                               */
+
+    /* Objects, created by 'va_build' */
+    stVaObjectData* objects;            /* Copy of 'objects_buffer'           */
+    unsigned int* dirty_objects;        /* Objects changed since last upload  */
+    unsigned char* is_object_dirty;     /* Flag per object                    */
+    int dirty_count;                    /* Number of 'dirty_objects' items    */
+    unsigned int objects_buffer;        /* 'stVaObjectData'                   */
+    unsigned int object_ids_buffer;     /* 0, 1, 2, ... per instance          */
+    unsigned int all_indirect_buffer;   /* Commands of 'va_draw_all'          */
+
+    /* Commands of 'va_draw_list', created by its first call */
+    unsigned int indirect_buffer;       /* 'stDrawElementsIndirectCommand'    */
+    stDrawElementsIndirectCommand* commands;
+    int draws_capacity;                 /* Draws the buffer can hold          */
 }stVertexArray;
 
 
@@ -48,23 +149,22 @@ typedef struct stVertexArray
 typedef struct stVaBuildData
 {
     stVertexArray* va;
-    list* vasbd_list;                   /* List of 'stVaShapeBuildData'       */
-
+    struct stVaShapeBuildData* shapes;  /* Indexed by 'stIndicesInfo.idx'     */
+    int shapes_count;                   /* Number of 'shapes' items           */
+    int shapes_capacity;                /* Items 'shapes' can hold            */
+    int reserved_shapes;                /* Capacities of a dynamic array set  */
+    int reserved_rects;                 /* by 'va_reserve'                    */
 }stVaBuildData;
 
 
 /* Information about a shape to add to the vertex array */
 typedef struct stVaShapeBuildData
 {
-    float* vertices;                    /* Shape vertices                     */
-    float* txd_vertices;                /* Shape texture vertices             */
-    unsigned int* indices;              /* Shape indices                      */
-
-    int vertices_number;                /* Number of 'vertices' items         */
-    int txd_vertices_number;            /* Number of 'txd_vertices' items     */
-    int indices_number;                 /* Number of 'indices' items          */
-
-    unsigned int indices_offset;        /* Next free index number             */
+    unsigned char* vertices;            /* Shape vertices in the format of    */
+                                        /* the vertex array                   */
+    int vertices_number;                /* Number of vertices                 */
+    int rects_count;                    /* Number of added rectangles         */
+    int rects_capacity;                 /* Rectangles 'vertices' can hold     */
 
     stIndicesInfo* target;              /* The memory address at which
                                         /* information for rendering this     */
@@ -73,6 +173,15 @@ typedef struct stVaShapeBuildData
 }stVaShapeBuildData;
 
 
+/* Quad index buffer shared by all vertex arrays */
+typedef struct stQuadIndexBuffer
+{
+    unsigned int buffer;                /* OpenGL GL_ELEMENT_ARRAY_BUFFER id  */
+    int quads_capacity;                 /* Quads the buffer covers            */
+    int users_count;                    /* Built vertex arrays that use it    */
+}stQuadIndexBuffer;
+
+
 
 /** @static_data -------------------------------------------------------------*/
 
@@ -82,19 +191,82 @@ static map* _va_to_build = NULL;        /* Map of 'stVaBuildData'             */
 /* Information about all created vertex arrays */
 static map* _built_va = NULL;           /* Map of 'stVertexArray'             */
 
+/* Quad index buffers of 16-bit and 32-bit indices */
+static stQuadIndexBuffer _short_quad_indices = { 0 };
+static stQuadIndexBuffer _int_quad_indices = { 0 };
+
 
 
 /** @internal_prototypes -----------------------------------------------------*/
+static stVaBuildData* _get_build_data(unsigned int va_idx);
+static stVaShapeBuildData* _get_shape_build_data(unsigned int va_idx,
+    const stIndicesInfo* shape);
 static void _destroy_build_data(unsigned int va_idx);
+static void _create_buffer(unsigned int target, unsigned int* buffer,
+    size_t size, const void* data, unsigned int flags);
+static void _write_vertex(const stVertexArray* va, unsigned char* dst,
+    const float* pos, const float* txd_pos);
+static int _round_up_to_power_of_two(int value);
+static stVaRing* _create_ring(int shapes_capacity, int rects_capacity,
+    size_t rect_size);
+static void _create_ring_buffer(stVertexArray* va);
+static stVaShapeSlot* _get_dynamic_slot(unsigned int va_idx,
+    const stIndicesInfo* shape, stVertexArray** out_va);
+static void _mark_shape_dirty(stVaRing* ring, unsigned int shape_idx);
+static int _find_free_range(const stVaRing* ring, int rects_count,
+    int limit);
+static int _alloc_rects(stVaRing* ring, int rects_count, int limit);
+static void _free_rects(stVaRing* ring, int first_rect, int rects_count);
+static void _move_slot(stVertexArray* va, unsigned int shape_idx,
+    int first_rect, int rects_capacity);
+static void _compact_ring(stVertexArray* va, int max_moves);
+static int _get_dynamic_capacity(int count, int reserved, int minimal);
+static void _advance_ring(size_t va_idx, void* va_ptr);
+static void _sync_ring(stVertexArray* va);
+static void _write_ring(stVertexArray* va, size_t offset, size_t size,
+    const void* data);
+static void _delete_ring(stVertexArray* va);
+static unsigned short _to_unorm16(float value);
+static short _to_snorm16(float value);
+static stQuadIndexBuffer* _get_quad_indices(unsigned int type);
+static int _reserve_quad_indices(unsigned int type, int quads_count);
+static void _release_quad_indices(unsigned int type);
+static stVertexArray* _get_built_va(unsigned int va_idx);
+static int _create_objects(stVertexArray* va);
+static void _upload_dirty_objects(stVertexArray* va);
+static int _compare_indices(const void* a, const void* b);
+static int _reserve_draws(stVertexArray* va, int count);
+static void _set_command(const stVertexArray* va,
+    stDrawElementsIndirectCommand* command, unsigned int shape_idx);
+static void _draw_objects(stVertexArray* va, int count);
+static void _delete_objects(stVertexArray* va);
 
 
 
 /** @functions ---------------------------------------------------------------*/
 
-unsigned int va_create(void)
+/**-----------------------------------------------------------------------------
+; @func va_create
+;
+; @params
+;   format | 'VA_FORMAT_FLOAT' or 'VA_FORMAT_SHORT', combined with
+;          | 'VA_DYNAMIC' to update the shapes after 'va_build'.
+;
+; @return
+;   unsigned int | Vertex array, 0 on failure.
+;
+-----------------------------------------------------------------------------**/
+unsigned int va_create(unsigned int format)
 {
     extern map* _va_to_build;
 
+    unsigned int vertex_format = format & ~VA_DYNAMIC;
+    if (vertex_format != VA_FORMAT_FLOAT && vertex_format != VA_FORMAT_SHORT)
+    {
+        LOG_ERROR("Unknown vertex array format %u.", format);
+        return 0;
+    }
+
     /* Init va-to-build storage if not inited */
     if (NULL == _va_to_build)
         _va_to_build = map_create();
@@ -108,9 +280,11 @@ unsigned int va_create(void)
     stVaBuildData* vabd = m_calloc(1, sizeof(stVaBuildData));
     stVertexArray* va = m_calloc(1, sizeof(stVertexArray));
     va->vertex_array = va_idx;
-    va->ii_list = list_create();
+    va->format = vertex_format;
+    va->vertex_size = (VA_FORMAT_FLOAT == vertex_format) ?
+        sizeof(stFloatVertex) : sizeof(stShortVertex);
+    va->is_dynamic = (format & VA_DYNAMIC) != 0;
     vabd->va = va;
-    vabd->vasbd_list = list_create();
 
     /* Store this va data in va-to-build storage*/
     map_insert(_va_to_build, va_idx, vabd);
@@ -119,99 +293,134 @@ unsigned int va_create(void)
 }
 
 
+/**-----------------------------------------------------------------------------
+; @func va_shape_create
+;
+; @brief
+;   Creates an empty shape. The returned pointer is the handle of the shape:
+;   its 'idx' addresses the shape directly, so adding rectangles to it does
+;   not search the shapes of the array.
+;
+-----------------------------------------------------------------------------**/
 stIndicesInfo* va_shape_create(unsigned int va_idx)
 {
-    extern map* _va_to_build;
-
-    if (NULL == _va_to_build)
-    {
-        LOG_ERROR("Vertex array with index %d does not exist.", va_idx);
+    stVaBuildData* vabd = _get_build_data(va_idx);
+    if (NULL == vabd)
         return NULL;
-    }
 
-    stVaBuildData* vabd = map_search(_va_to_build, va_idx);
-    if (NULL == vabd)
+    if (vabd->shapes_count == vabd->shapes_capacity)
     {
-        LOG_ERROR("Vertex array with index %d does not exist.", va_idx);
-        return NULL;
+        int capacity = (vabd->shapes_capacity > 0) ?
+            vabd->shapes_capacity * 2 : 16;
+        stVaShapeBuildData* shapes = m_realloc(vabd->shapes,
+            sizeof(stVaShapeBuildData) * capacity);
+        if (NULL == shapes)
+            return NULL;
+        vabd->shapes = shapes;
+        vabd->shapes_capacity = capacity;
     }
 
-    stVaShapeBuildData* vasbd = m_calloc(1, sizeof(stVaShapeBuildData));
-    vasbd->target = m_calloc(1, sizeof(stIndicesInfo));
-
-    list_push(vabd->vasbd_list, vasbd);
+    stIndicesInfo* target = m_calloc(1, sizeof(stIndicesInfo));
+    if (NULL == target)
+        return NULL;
+    target->idx = vabd->shapes_count;
 
-    return vasbd->target;
+    stVaShapeBuildData* vasbd = &vabd->shapes[vabd->shapes_count++];
+    memset(vasbd, 0, sizeof(stVaShapeBuildData));
+    vasbd->target = target;
 
+    return target;
 }
 
 
 void va_shape_add_textured_rect(unsigned int va_idx, stIndicesInfo* shape,
     float* vertices, float* txd_vertices)
 {
-    extern map* _va_to_build;
+    va_shape_add_textured_rects(va_idx, shape, 1, vertices, txd_vertices);
+}
 
-    if (NULL == _va_to_build)
-    {
-        LOG_ERROR("Vertex array with index %d does not exist.", va_idx);
-        return;
-    }
 
-    stVaBuildData* vabd = map_search(_va_to_build, va_idx);
+/**-----------------------------------------------------------------------------
+; @func va_reserve
+;
+; @brief
+;   Sets the least number of shapes and rectangles that the dynamic vertex
+;   array holds after 'va_build'. By default it holds twice the shapes and
+;   the rectangles it is built with. Must be called before 'va_build'.
+;
+; @params
+;   va_idx       | Vertex array created with 'VA_DYNAMIC'.
+;   shapes_count | Shapes of the array, built and added by 'va_shape_add'.
+;   rects_count  | Rectangles of a region of the ring.
+;
+-----------------------------------------------------------------------------**/
+void va_reserve(unsigned int va_idx, int shapes_count, int rects_count)
+{
+    stVaBuildData* vabd = _get_build_data(va_idx);
     if (NULL == vabd)
-    {
-        LOG_ERROR("Vertex array with index %d does not exist.", va_idx);
         return;
-    }
-
-    stVaShapeBuildData* vabd_sbd = NULL;
-    for (list_node* vabd_sbd_node = vabd->vasbd_list->nodes; vabd_sbd_node != NULL; vabd_sbd_node = vabd_sbd_node->next)
-    {
-        stVaShapeBuildData* cur_vsbd = vabd_sbd_node->data;
-        if (cur_vsbd->target == shape)
-        {
-            vabd_sbd = cur_vsbd;
-            break;
-        }
-    }
-    if (NULL == vabd_sbd)
+    if (!vabd->va->is_dynamic)
     {
-        LOG_ERROR("Vertex array %d does not contain shape '%p'.", va_idx, shape);
+        LOG_ERROR("Vertex array %d is not dynamic.", va_idx);
         return;
     }
 
-    vabd_sbd->vertices_number += VERTICES_PER_RECTANGLE;
-    vabd_sbd->txd_vertices_number += TEXTURE_VERTICES_PER_RECTANGLE;
-    vabd_sbd->indices_number += INDICES_PER_RECTANGLE;
-
-    if (NULL == vabd_sbd->vertices)
-        vabd_sbd->vertices = m_malloc(vabd_sbd->vertices_number * sizeof(float));
-    else
-        vabd_sbd->vertices = m_realloc(vabd_sbd->vertices, vabd_sbd->vertices_number * sizeof(float));
+    vabd->reserved_shapes = shapes_count;
+    vabd->reserved_rects = rects_count;
+}
 
-    if (NULL == vabd_sbd->txd_vertices)
-        vabd_sbd->txd_vertices = m_malloc(vabd_sbd->txd_vertices_number * sizeof(float));
-    else
-        vabd_sbd->txd_vertices = m_realloc(vabd_sbd->txd_vertices, vabd_sbd->txd_vertices_number * sizeof(float));
 
-    if (NULL == vabd_sbd->indices)
-        vabd_sbd->indices = m_malloc(vabd_sbd->indices_number * sizeof(unsigned int));
-    else
-        vabd_sbd->indices = m_realloc(vabd_sbd->indices, vabd_sbd->indices_number * sizeof(unsigned int));
+/**-----------------------------------------------------------------------------
+; @func va_shape_add_textured_rects
+;
+; @brief
+;   Adds rectangles to the shape. The vertices of the shape grow once per call
+;   (by doubling), so adding rectangles one by one or in batches takes linear
+;   time.
+;
+; @params
+;   va_idx       | Vertex array that is not built yet.
+;   shape        | Shape of this vertex array.
+;   count        | Number of rectangles.
+;   vertices     | 8 floats (4 positions) per rectangle.
+;   txd_vertices | 8 floats (4 texture coordinates) per rectangle.
+;
+-----------------------------------------------------------------------------**/
+void va_shape_add_textured_rects(unsigned int va_idx, stIndicesInfo* shape,
+    int count, const float* vertices, const float* txd_vertices)
+{
+    stVaShapeBuildData* vabd_sbd = _get_shape_build_data(va_idx, shape);
+    if (NULL == vabd_sbd || count <= 0)
+        return;
 
-    for (int i = 0; i < VERTICES_PER_RECTANGLE; i++) // TODO: Use memcpy.
+    /* The vertices are converted to the format of the array right away, so
+       the build data is as large as the video memory it fills */
+    stVertexArray* va = _get_build_data(va_idx)->va;
+    size_t rect_size = (size_t)va->vertex_size * VERTICES_PER_RECTANGLE;
+    int rects_count = vabd_sbd->rects_count + count;
+    if (rects_count > vabd_sbd->rects_capacity)
     {
-        vabd_sbd->vertices[i + vabd_sbd->vertices_number - VERTICES_PER_RECTANGLE] = vertices[i];
-        vabd_sbd->txd_vertices[i + vabd_sbd->txd_vertices_number - TEXTURE_VERTICES_PER_RECTANGLE] = txd_vertices[i];
+        int capacity = (vabd_sbd->rects_capacity > 0) ?
+            vabd_sbd->rects_capacity : 1;
+        while (capacity < rects_count)
+            capacity *= 2;
+        unsigned char* shape_vertices = m_realloc(vabd_sbd->vertices,
+            rect_size * capacity);
+        if (NULL == shape_vertices)
+            return;
+        vabd_sbd->vertices = shape_vertices;
+        vabd_sbd->rects_capacity = capacity;
     }
 
-    vabd_sbd->indices[vabd_sbd->indices_number - INDICES_PER_RECTANGLE + 0] = vabd_sbd->indices_offset + 0;
-    vabd_sbd->indices[vabd_sbd->indices_number - INDICES_PER_RECTANGLE + 1] = vabd_sbd->indices_offset + 1;
-    vabd_sbd->indices[vabd_sbd->indices_number - INDICES_PER_RECTANGLE + 2] = vabd_sbd->indices_offset + 3;
-    vabd_sbd->indices[vabd_sbd->indices_number - INDICES_PER_RECTANGLE + 3] = vabd_sbd->indices_offset + 1;
-    vabd_sbd->indices[vabd_sbd->indices_number - INDICES_PER_RECTANGLE + 4] = vabd_sbd->indices_offset + 2;
-    vabd_sbd->indices[vabd_sbd->indices_number - INDICES_PER_RECTANGLE + 5] = vabd_sbd->indices_offset + 3;
-    vabd_sbd->indices_offset += INDICES_USAGE_PER_RECTANGLE;
+    unsigned char* dst = vabd_sbd->vertices +
+        rect_size * vabd_sbd->rects_count;
+    for (int i = 0; i < count * VERTICES_PER_RECTANGLE; i++)
+    {
+        _write_vertex(va, dst, &vertices[i * 2], &txd_vertices[i * 2]);
+        dst += va->vertex_size;
+    }
+    vabd_sbd->vertices_number += count * VERTICES_PER_RECTANGLE;
+    vabd_sbd->rects_count = rects_count;
 }
 
 
@@ -247,19 +456,29 @@ void va_build(unsigned int va_idx)
         return;
     }
 
-    size_t total_vertices = 0;
-    size_t total_txd_vertices = 0;
-    size_t total_indices = 0;
+    stVertexArray* va = vabd->va;
+    int total_rects = 0;
 
-    /* Count the number of vertices to add to the vertex array */
-    for (list_node* shape_node = vabd->vasbd_list->nodes; shape_node != NULL; shape_node = shape_node->next)
+    /* Count the number of rectangles to add to the vertex array. A shape of
+       a dynamic array takes a slot of a power of two rectangles, and a region
+       of its ring holds twice the rectangles of the slots (and the array
+       twice the shapes) unless 'va_reserve' asks for more */
+    for (int shape_idx = 0; shape_idx < vabd->shapes_count; shape_idx++)
+    {
+        stVaShapeBuildData* vsbd = &vabd->shapes[shape_idx];
+        total_rects += va->is_dynamic ?
+            _round_up_to_power_of_two(vsbd->rects_count) : vsbd->rects_count;
+    }
+    int rects_capacity = total_rects;
+    va->shapes_capacity = vabd->shapes_count;
+    if (va->is_dynamic)
     {
-        stVaShapeBuildData* vsbd = shape_node->data;
-        total_vertices += vsbd->vertices_number;
-        total_txd_vertices += vsbd->txd_vertices_number;
-        total_indices += vsbd->indices_number;
+        rects_capacity = _get_dynamic_capacity(total_rects,
+            vabd->reserved_rects, MIN_DYNAMIC_RECTS);
+        va->shapes_capacity = _get_dynamic_capacity(vabd->shapes_count,
+            vabd->reserved_shapes, MIN_DYNAMIC_SHAPES);
     }
-    //if ((total_vertices == 0) || (total_txd_vertices == 0) || (total_indices == 0))
+    //if ((total_vertices == 0) || (total_indices == 0))
     //{
     //
     //}
@@ -269,76 +488,145 @@ void va_build(unsigned int va_idx)
     //va->vertex_array = va_idx;
     //va->shapes_indices_info = list_create();
     //vabd->va = va;
-    stVertexArray* va = vabd->va;
+
+    /* The vertices of all shapes are staged contiguously and uploaded by a
+       single call. A dynamic array keeps them as the source of its ring */
+    size_t rect_size = (size_t)va->vertex_size * VERTICES_PER_RECTANGLE;
+    size_t vertices_size = rect_size * rects_capacity;
+    unsigned char* staged_vertices = NULL;
+    if (va->is_dynamic)
+    {
+        va->ring = _create_ring(va->shapes_capacity, rects_capacity,
+            rect_size);
+        if (va->ring != NULL)
+            staged_vertices = va->ring->vertices;
+    }
+    else
+    {
+        staged_vertices = m_malloc(vertices_size);
+    }
+    va->shapes = m_malloc(sizeof(stIndicesInfo*) * va->shapes_capacity);
+    if ((NULL == staged_vertices && vertices_size > 0) ||
+        (NULL == va->shapes && va->shapes_capacity > 0) ||
+        (va->is_dynamic && NULL == va->ring))
+    {
+        LOG_ERROR("Unable to build vertex array with index %d.", va_idx);
+        if (va->is_dynamic)
+            _delete_ring(va);
+        else
+            m_free(staged_vertices);
+        _destroy_build_data(va_idx);
+        return;
+    }
 
     /* Set 'va->vertex_array' as the current vertex array object */
     GL_CALL(glBindVertexArray(va->vertex_array));
 
-    /* Generate a buffer object to store the positions of the vertices */
-    GL_CALL(glGenBuffers(1, &va->vertex_buffer));
-    GL_CALL(glBindBuffer(GL_ARRAY_BUFFER, va->vertex_buffer));
-    GL_CALL(glBufferData(GL_ARRAY_BUFFER, sizeof(float) * total_vertices, NULL, GL_STATIC_DRAW));
-
-    /* Generate a buffer object to store the texture coordinates */
-    GL_CALL(glGenBuffers(1, &va->txd_vertex_buffer));
-    GL_CALL(glBindBuffer(GL_ARRAY_BUFFER, va->txd_vertex_buffer));
-    GL_CALL(glBufferData(GL_ARRAY_BUFFER, sizeof(float) * total_txd_vertices, NULL, GL_STATIC_DRAW));
-
-    /* Generate a buffer object to store the vertex indices */
-    GL_CALL(glGenBuffers(1, &va->indices_buffer));
-    GL_CALL(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, va->indices_buffer));
-    GL_CALL(glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(unsigned int) * total_indices, NULL, GL_STATIC_DRAW));
-
-    size_t va_vertices_offset = 0;
-    size_t va_txd_vertices_offset = 0;
-    size_t va_indices_offset = 0;
+    /* Bind the shared quad indices that cover all rectangles of the array */
+    va->index_type = (rects_capacity <= VA_MAX_SHORT_INDEX_QUADS) ?
+        GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+    if (_reserve_quad_indices(va->index_type, rects_capacity) != 0)
+    {
+        LOG_ERROR("Unable to build vertex array with index %d.", va_idx);
+        if (va->is_dynamic)
+            _delete_ring(va);
+        else
+            m_free(staged_vertices);
+        _destroy_build_data(va_idx);
+        return;
+    }
+    size_t index_size = (GL_UNSIGNED_SHORT == va->index_type) ?
+        sizeof(unsigned short) : sizeof(unsigned int);
 
-    unsigned int cur_shape_indices_usage = 0;
+    int va_rects_offset = 0;
 
     /* For each shape to be added to the vertex array */
-    for (list_node* shape_node = vabd->vasbd_list->nodes; shape_node != NULL; shape_node = shape_node->next)
+    for (int shape_idx = 0; shape_idx < vabd->shapes_count; shape_idx++)
     {
-        stVaShapeBuildData* vsbd = shape_node->data;
-
-        for (int i = 0; i < vsbd->indices_number; i++)
-            vsbd->indices[i] += cur_shape_indices_usage;
-
-        /* Send vertex information to video memory */
-        GL_CALL(glBindBuffer(GL_ARRAY_BUFFER, va->vertex_buffer));
-        GL_CALL(glBufferSubData(GL_ARRAY_BUFFER, va_vertices_offset, sizeof(float) * vsbd->vertices_number, vsbd->vertices));
+        stVaShapeBuildData* vsbd = &vabd->shapes[shape_idx];
 
-        GL_CALL(glBindBuffer(GL_ARRAY_BUFFER, va->txd_vertex_buffer));
-        GL_CALL(glBufferSubData(GL_ARRAY_BUFFER, va_txd_vertices_offset, sizeof(float) * vsbd->txd_vertices_number, vsbd->txd_vertices));
-
-        GL_CALL(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, va->indices_buffer));
-        GL_CALL(glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, va_indices_offset, sizeof(unsigned int) * vsbd->indices_number, vsbd->indices));
+        if (vsbd->vertices_number > 0)
+        {
+            memcpy(staged_vertices + rect_size * va_rects_offset,
+                vsbd->vertices, rect_size * vsbd->rects_count);
+        }
 
-        /* Fill in information about vertices */
+        /* Fill in information about vertices. The rectangles of the shape
+           follow the rectangles of the previous shapes, so their indices are
+           the next range of the quad indices */
         vsbd->target->mode = GL_TRIANGLES;
-        vsbd->target->count = vsbd->indices_number;
-        vsbd->target->offset = (void*)va_indices_offset;
-        /* Push it in va's vertices storage */
-        list_push(va->ii_list, vsbd->target);
-
-        va_vertices_offset += vsbd->vertices_number * sizeof(float);
-        va_txd_vertices_offset += vsbd->txd_vertices_number * sizeof(float);
-        va_indices_offset += vsbd->indices_number * sizeof(unsigned int);
-
-        cur_shape_indices_usage += vsbd->indices_offset;
+        vsbd->target->count = vsbd->rects_count * INDICES_PER_RECTANGLE;
+        vsbd->target->type = va->index_type;
+        vsbd->target->offset = (void*)((size_t)va_rects_offset *
+            INDICES_PER_RECTANGLE * index_size);
+        /* Put it in va's vertices storage */
+        va->shapes[va->shapes_count++] = vsbd->target;
+
+        int slot_rects = vsbd->rects_count;
+        if (va->is_dynamic)
+        {
+            slot_rects = _round_up_to_power_of_two(vsbd->rects_count);
+            stVaShapeSlot* slot = &va->ring->slots[shape_idx];
+            slot->first_rect = va_rects_offset;
+            slot->rects_capacity = slot_rects;
+            slot->drawn_first_rect = va_rects_offset;
+            slot->drawn_rects_count = vsbd->rects_count;
+        }
+        va_rects_offset += slot_rects;
     }
 
-    /* Bind 'va->vertex_buffer' to 'va->vertex_array' at index 0 */
-    GL_CALL(glBindVertexBuffer(0, va->vertex_buffer, 0, sizeof(GLfloat) * 2));
+    /* Generate a buffer object to store the interleaved vertices */
+    if (va->is_dynamic)
+    {
+        /* The rest of the region is free for the shapes that are added or
+           grow later */
+        if (va_rects_offset < rects_capacity)
+        {
+            va->ring->free_ranges[0].first_rect = va_rects_offset;
+            va->ring->free_ranges[0].rects_count =
+                rects_capacity - va_rects_offset;
+            va->ring->free_count = 1;
+        }
+        _create_ring_buffer(va);
+    }
+    else
+    {
+        _create_buffer(GL_ARRAY_BUFFER, &va->vertex_buffer, vertices_size,
+            staged_vertices, 0);
+        m_free(staged_vertices);
+    }
 
-    /* Bind 'va->txd_vertex_buffer' to 'va->vertex_array' at index 1 */
-    GL_CALL(glBindVertexBuffer(1, va->txd_vertex_buffer, 0, sizeof(GLfloat) * 2));
+    /* Bind 'va->vertex_buffer' to 'va->vertex_array' at index 0, both the
+       positions (attribute 0) and the texture coordinates (attribute 1) are
+       read from it */
+    GL_CALL(glBindVertexBuffer(0, va->vertex_buffer, 0, va->vertex_size));
+    if (VA_FORMAT_FLOAT == va->format)
+    {
+        GL_CALL(glVertexAttribFormat(0, 2, GL_FLOAT, GL_FALSE,
+            offsetof(stFloatVertex, pos)));
+        GL_CALL(glVertexAttribFormat(1, 2, GL_UNSIGNED_SHORT, GL_TRUE,
+            offsetof(stFloatVertex, txd_pos)));
+    }
+    else
+    {
+        GL_CALL(glVertexAttribFormat(0, 2, GL_SHORT, GL_TRUE,
+            offsetof(stShortVertex, pos)));
+        GL_CALL(glVertexAttribFormat(1, 2, GL_UNSIGNED_SHORT, GL_TRUE,
+            offsetof(stShortVertex, txd_pos)));
+    }
+    GL_CALL(glVertexAttribBinding(0, 0));
+    GL_CALL(glVertexAttribBinding(1, 0));
 
     GL_CALL(glEnableVertexAttribArray(0));
     GL_CALL(glEnableVertexAttribArray(1));
 
-    /* 'va->vertex_buffer' and 'va->txd_vertex_buffer' can be unbound since they
-        are bound to 'va->vertex_array' as the vertex attributes at indices 0
-        and 1 */
+    if (_create_objects(va) != 0)
+    {
+        LOG_ERROR("Unable to create objects of vertex array %d.", va_idx);
+    }
+
+    /* 'va->vertex_buffer' can be unbound since it is bound to
+        'va->vertex_array' as the vertex attributes at indices 0 and 1 */
     GL_CALL(glBindBuffer(GL_ARRAY_BUFFER, 0));
 
     /* Create a built vertex array storage */
@@ -353,140 +641,1574 @@ void va_build(unsigned int va_idx)
 
 
 /**-----------------------------------------------------------------------------
-; @func va_destroy
+; @func va_shape_set_data
 ;
 ; @brief
-;   Completely removes vertex array with index 'va_idx' if one was created using
-;   the 'va_create' function:
-;     - Removes created vertices, texture vertices and indices buffers, vertices 
-;       arrays from video memory.
-;     - Frees memory allocated for each 'stIndicesData' object created in the
-;       'va_shape_create' function (all pointers that were returned by this
-;       function become invalid).
-;     - Erases 'stIndicesData' objects related to the removed vertex array from
-;       created vertex arrays storage '_built_va'.
-;     - Removes the '_built_va' storage if there are no items left in it.
+;   Sets the data of the object of the shape. The data is uploaded to video
+;   memory by the next 'va_draw_*' call, setting the same data again does not
+;   upload anything.
+;
+; @params
+;   va_idx | Built vertex array.
+;   shape  | Shape of this vertex array.
+;   data   | Position, size, layer and unit of the shape.
 ;
 -----------------------------------------------------------------------------**/
-void va_destroy(unsigned int va_idx)
+void va_shape_set_data(unsigned int va_idx, const stIndicesInfo* shape,
+    const stVaObjectData* data)
 {
-    extern map* _built_va;
-
-    if (NULL == _built_va)
-        return;
-
-    stVertexArray* va = map_search(_built_va, va_idx);
+    stVertexArray* va = _get_built_va(va_idx);
     if (NULL == va)
         return;
-
-    /* Remove OpenGL objects */
-    GL_CALL(glDeleteVertexArrays(1, &va->vertex_array));
-    GL_CALL(glDeleteBuffers(1, &va->vertex_buffer));
-    GL_CALL(glDeleteBuffers(1, &va->txd_vertex_buffer));
-    GL_CALL(glDeleteBuffers(1, &va->indices_buffer));
-
-    /* Remove indices info for each va's shape */
-    for (list_node* vasii_node = va->ii_list->nodes; vasii_node != NULL; vasii_node = vasii_node->next)
+    if (NULL == va->objects || shape->idx >= (unsigned int)va->shapes_count)
     {
-        stIndicesInfo* ii = vasii_node->data;
-        m_free(ii);
+        LOG_ERROR("Vertex array %d does not contain shape '%p'.", va_idx, shape);
+        return;
     }
 
-    /* Destroy indices' list */
-    list_destroy(va->ii_list);
-    
-    /* Remove va object */
-    m_free(va);
-
-    /* Remove va object ptr from created va's storage */
-    map_erase(_built_va, va_idx);
+    stVaObjectData* object = &va->objects[shape->idx];
+    if (0 == memcmp(object, data, sizeof(stVaObjectData)))
+        return;
+    *object = *data;
 
-    if (0 == map_get_size(_built_va))
+    if (!va->is_object_dirty[shape->idx])
     {
-        map_destroy(_built_va);
-        _built_va = NULL;
+        va->is_object_dirty[shape->idx] = 1;
+        va->dirty_objects[va->dirty_count++] = shape->idx;
     }
 }
 
 
 /**-----------------------------------------------------------------------------
-; @func _destroy_build_data
+; @func va_begin_frame
 ;
 ; @brief
-;   Zeroes pointers and frees memory that was used to create vertex array with
-;   index 'va_idx'.
-;   Deletes 'stIndicesInfo' and frees the video memory filled with data related
-;   to the 'va_idx' array.
+;   Moves the rings of the dynamic vertex arrays to their next regions. A
+;   region drawn by the frame is fenced, and the region of the new frame is
+;   waited for until the GPU no longer reads it (three frames ago).
 ;
 -----------------------------------------------------------------------------**/
-static void _destroy_build_data(unsigned int va_idx)
+void va_begin_frame(void)
 {
-    extern map* _va_to_build;
     extern map* _built_va;
 
-    if (NULL == _va_to_build)
-        return;
-
-    stVaBuildData* vabd = map_search(_va_to_build, va_idx);
-    if (NULL == vabd)
-        return;
+    if (_built_va != NULL)
+        map_for_each_item(_built_va, _advance_ring);
+}
 
-    int is_this_va_built_successfully = 0;
 
-    if (NULL != _built_va)
-        if (map_search(_built_va, va_idx) != 0)
-            is_this_va_built_successfully = 1;
+/**-----------------------------------------------------------------------------
+; @func va_shape_update
+;
+; @brief
+;   Rewrites the rectangles of the shape of the built dynamic vertex array.
+;   The vertices are copied into the region of the ring that a 'va_draw_*'
+;   call reads next, the other regions get them in the following frames.
+;
+; @params
+;   va_idx       | Built vertex array created with 'VA_DYNAMIC'.
+;   shape        | Shape of this vertex array.
+;   first_rect   | First rectangle of the shape to rewrite.
+;   count        | Number of rectangles to rewrite.
+;   vertices     | Positions of the rectangles, 4 'vec2' per rectangle.
+;   txd_vertices | Texture coordinates of the rectangles, 4 'vec2' per
+;                | rectangle.
+;
+; @return
+;   int | 0 on success, -1 on failure.
+;
+-----------------------------------------------------------------------------**/
+int va_shape_update(unsigned int va_idx, const stIndicesInfo* shape,
+    int first_rect, int count, const float* vertices,
+    const float* txd_vertices)
+{
+    stVertexArray* va = NULL;
+    stVaShapeSlot* slot = _get_dynamic_slot(va_idx, shape, &va);
+    if (NULL == slot)
+        return -1;
 
-    /* For each shape build data of current va */
-    for (list_node* vasbd_node = vabd->vasbd_list->nodes; vasbd_node != NULL; vasbd_node = vasbd_node->next)
+    int rects_count = shape->count / INDICES_PER_RECTANGLE;
+    if (first_rect < 0 || count < 0 || first_rect + count > rects_count)
     {
-        stVaShapeBuildData* vasbd = vasbd_node->data;
+        LOG_ERROR("Rectangles [%d, %d) are out of shape '%p' of %d rectangles.",
+            first_rect, first_rect + count, shape, rects_count);
+        return -1;
+    }
 
-        /* Remove vertices, texture vertices, indices */
-        if (vasbd->vertices != NULL)
-            m_free(vasbd->vertices);
-        if(vasbd->txd_vertices != NULL)
-            m_free(vasbd->txd_vertices);
-        if (vasbd->indices != NULL)
-            m_free(vasbd->indices);
+    stVaRing* ring = va->ring;
+    size_t rect_size = (size_t)va->vertex_size * VERTICES_PER_RECTANGLE;
+    unsigned char* dst = ring->vertices +
+        rect_size * ((size_t)slot->first_rect + first_rect);
+    for (int vertex_idx = 0; vertex_idx < VERTICES_PER_RECTANGLE * count;
+        vertex_idx++)
+    {
+        _write_vertex(va, dst + (size_t)va->vertex_size * vertex_idx,
+            &vertices[vertex_idx * 2], &txd_vertices[vertex_idx * 2]);
+    }
 
-        // TODO: Remove empty shapes.
+    _mark_shape_dirty(ring, shape->idx);
+    return 0;
+}
 
-        m_free(vasbd);
-    }
-    list_destroy(vabd->vasbd_list);
 
-    /* If this va was not built successfully */
-    if (!is_this_va_built_successfully)
+/**-----------------------------------------------------------------------------
+; @func va_shape_resize
+;
+; @brief
+;   Changes the number of rectangles of the shape of the built dynamic vertex
+;   array. The shape keeps its slot while the rectangles fit in it, otherwise
+;   it is moved to a slot of the next power of two rectangles allocated from
+;   the free ranges of the region, and its old slot is freed. If no range is
+;   large enough, the region is compacted first. The kept rectangles are
+;   preserved, the added ones are zeroed until 'va_shape_update' writes them.
+;
+; @params
+;   va_idx      | Built vertex array created with 'VA_DYNAMIC'.
+;   shape       | Shape of this vertex array, its count and offset are
+;               | updated.
+;   rects_count | New number of rectangles of the shape.
+;
+; @return
+;   int | 0 on success, -1 if the region has no space for the shape.
+;
+-----------------------------------------------------------------------------**/
+int va_shape_resize(unsigned int va_idx, stIndicesInfo* shape,
+    int rects_count)
+{
+    stVertexArray* va = NULL;
+    stVaShapeSlot* slot = _get_dynamic_slot(va_idx, shape, &va);
+    if (NULL == slot)
+        return -1;
+    if (rects_count < 0)
     {
-        stVertexArray* va = vabd->va;
+        LOG_ERROR("Invalid number of rectangles %d.", rects_count);
+        return -1;
+    }
 
-        /* Remove OpenGL objects */
-        GL_CALL(glDeleteVertexArrays(1, &va->vertex_array));
-        GL_CALL(glDeleteBuffers(1, &va->vertex_buffer));
-        GL_CALL(glDeleteBuffers(1, &va->txd_vertex_buffer));
-        GL_CALL(glDeleteBuffers(1, &va->indices_buffer));
+    stVaRing* ring = va->ring;
+    size_t rect_size = (size_t)va->vertex_size * VERTICES_PER_RECTANGLE;
+    int old_rects_count = shape->count / INDICES_PER_RECTANGLE;
 
-        /* Remove indices info for each va's shape */
-        for (list_node* vasii_node = va->ii_list->nodes; vasii_node != NULL; vasii_node = vasii_node->next)
+    if (rects_count > slot->rects_capacity)
+    {
+        int capacity = _round_up_to_power_of_two(rects_count);
+        int first_rect = _alloc_rects(ring, capacity, ring->rects_capacity);
+        if (first_rect < 0)
+        {
+            _compact_ring(va, ring->rects_capacity);
+            first_rect = _alloc_rects(ring, capacity, ring->rects_capacity);
+        }
+        if (first_rect < 0)
         {
-            stIndicesInfo* ii = vasii_node->data;
-            m_free(ii);
+            LOG_ERROR("Vertex array %d has no space for %d rectangles.",
+                va_idx, rects_count);
+            return -1;
         }
+        _move_slot(va, shape->idx, first_rect, capacity);
+    }
+    if (rects_count > old_rects_count)
+    {
+        memset(ring->vertices +
+            rect_size * ((size_t)slot->first_rect + old_rects_count), 0,
+            rect_size * ((size_t)rects_count - old_rects_count));
+    }
 
-        /* Destroy indices' list */
-        list_destroy(va->ii_list);
+    shape->count = rects_count * INDICES_PER_RECTANGLE;
+    _mark_shape_dirty(ring, shape->idx);
+    return 0;
+}
 
-        /* Remove va object */
-        m_free(va);
+
+/**-----------------------------------------------------------------------------
+; @func va_shape_add
+;
+; @brief
+;   Adds an empty shape to the built dynamic vertex array. Give it rectangles
+;   with 'va_shape_resize' and 'va_shape_update'. The shape takes the index
+;   of a removed shape if there is one, its object is reset to the default
+;   data.
+;
+; @return
+;   stIndicesInfo* | The shape, NULL if the array holds 'shapes_capacity'
+;                  | shapes (see 'va_reserve').
+;
+-----------------------------------------------------------------------------**/
+stIndicesInfo* va_shape_add(unsigned int va_idx)
+{
+    stVertexArray* va = _get_built_va(va_idx);
+    if (NULL == va)
+        return NULL;
+    if (NULL == va->ring)
+    {
+        LOG_ERROR("Vertex array %d is not dynamic.", va_idx);
+        return NULL;
     }
 
-    m_free(vabd);
-    map_erase(_va_to_build, va_idx);
+    stVaRing* ring = va->ring;
+    if (NULL == va->objects || (0 == ring->free_shapes_count &&
+        va->shapes_count == va->shapes_capacity))
+    {
+        LOG_ERROR("Vertex array %d has no space for shapes.", va_idx);
+        return NULL;
+    }
 
-    if(0 == map_get_size(_va_to_build))
+    stIndicesInfo* shape = m_calloc(1, sizeof(stIndicesInfo));
+    if (NULL == shape)
     {
-        map_destroy(_va_to_build);
-        _va_to_build = NULL;
+        LOG_ERROR("Unable to add shape to vertex array %d.", va_idx);
+        return NULL;
+    }
+    shape->mode = GL_TRIANGLES;
+    shape->type = va->index_type;
+    shape->idx = (ring->free_shapes_count > 0) ?
+        ring->free_shapes[--ring->free_shapes_count] :
+        (unsigned int)va->shapes_count++;
+    va->shapes[shape->idx] = shape;
+
+    stVaShapeSlot* slot = &ring->slots[shape->idx];
+    memset(slot, 0, sizeof(stVaShapeSlot));
+
+    const stVaObjectData default_object = { { 0.0f, 0.0f }, { 1.0f, 1.0f },
+        0, 0 };
+    va->objects[shape->idx] = default_object;
+    if (!va->is_object_dirty[shape->idx])
+    {
+        va->is_object_dirty[shape->idx] = 1;
+        va->dirty_objects[va->dirty_count++] = shape->idx;
     }
+    return shape;
 }
+
+
+/**-----------------------------------------------------------------------------
+; @func va_shape_remove
+;
+; @brief
+;   Removes the shape from the built dynamic vertex array and frees its slot.
+;   The shape is no longer drawn from the next frame on (it is drawn the rest
+;   of the frame if the array has already been drawn), the pointer becomes
+;   invalid immediately. The index of the shape is given to a shape added
+;   after that frame.
+;
+; @return
+;   int | 0 on success, -1 on failure.
+;
+-----------------------------------------------------------------------------**/
+int va_shape_remove(unsigned int va_idx, stIndicesInfo* shape)
+{
+    stVertexArray* va = NULL;
+    stVaShapeSlot* slot = _get_dynamic_slot(va_idx, shape, &va);
+    if (NULL == slot)
+        return -1;
+
+    if (slot->rects_capacity > 0)
+        _free_rects(va->ring, slot->first_rect, slot->rects_capacity);
+    slot->rects_capacity = 0;
+
+    /* '_sync_ring' stops drawing the shape and frees its index */
+    _mark_shape_dirty(va->ring, shape->idx);
+    va->shapes[shape->idx] = NULL;
+    m_free(shape);
+    return 0;
+}
+
+
+/**-----------------------------------------------------------------------------
+; @func va_draw_all
+;
+; @brief
+;   Draws all shapes of the built vertex array with a single
+;   'glMultiDrawElementsIndirect' call. The commands are uploaded once by
+;   'va_build', so only the changed objects are uploaded. The vertex array
+;   stays bound.
+;
+-----------------------------------------------------------------------------**/
+void va_draw_all(unsigned int va_idx)
+{
+    stVertexArray* va = _get_built_va(va_idx);
+    if (NULL == va || NULL == va->objects)
+        return;
+
+    _upload_dirty_objects(va);
+    GL_CALL(glBindVertexArray(va->vertex_array));
+    GL_CALL(glBindBuffer(GL_DRAW_INDIRECT_BUFFER, va->all_indirect_buffer));
+    if (va->ring != NULL)
+    {
+        _sync_ring(va);
+        if (va->ring->are_commands_dirty &&
+            0 == _reserve_draws(va, va->shapes_count))
+        {
+            for (int i = 0; i < va->shapes_count; i++)
+                _set_command(va, &va->commands[i], i);
+            GL_CALL(glBufferSubData(GL_DRAW_INDIRECT_BUFFER, 0,
+                sizeof(stDrawElementsIndirectCommand) * va->shapes_count,
+                va->commands));
+            va->ring->are_commands_dirty = 0;
+        }
+    }
+    _draw_objects(va, va->shapes_count);
+}
+
+
+/**-----------------------------------------------------------------------------
+; @func va_draw_list
+;
+; @brief
+;   Draws the shapes with a single 'glMultiDrawElementsIndirect' call. The
+;   vertex array stays bound.
+;
+; @params
+;   va_idx | Vertex array.
+;   shapes | Shapes of this vertex array, a shape listed several times is
+;          | drawn several times with the same data.
+;   count  | Number of items of 'shapes'.
+;
+-----------------------------------------------------------------------------**/
+void va_draw_list(unsigned int va_idx, stIndicesInfo* const* shapes,
+    int count)
+{
+    stVertexArray* va = _get_built_va(va_idx);
+    if (NULL == va || NULL == va->objects || count <= 0)
+        return;
+    if (_reserve_draws(va, count) != 0)
+        return;
+
+    _upload_dirty_objects(va);
+    GL_CALL(glBindVertexArray(va->vertex_array));
+    if (va->ring != NULL)
+        _sync_ring(va);
+
+    for (int i = 0; i < count; i++)
+        _set_command(va, &va->commands[i], shapes[i]->idx);
+
+    /* The buffer is orphaned first, so the upload does not wait for the
+       previous draws that still read it */
+    GL_CALL(glBindBuffer(GL_DRAW_INDIRECT_BUFFER, va->indirect_buffer));
+    GL_CALL(glBufferData(GL_DRAW_INDIRECT_BUFFER,
+        sizeof(stDrawElementsIndirectCommand) * va->draws_capacity, NULL,
+        GL_STREAM_DRAW));
+    GL_CALL(glBufferSubData(GL_DRAW_INDIRECT_BUFFER, 0,
+        sizeof(stDrawElementsIndirectCommand) * count, va->commands));
+    _draw_objects(va, count);
+}
+
+
+/**-----------------------------------------------------------------------------
+; @func va_destroy
+;
+; @brief
+;   Completely removes vertex array with index 'va_idx' if one was created using
+;   the 'va_create' function:
+;     - Removes created vertices, texture vertices and indices buffers, vertices 
+;       arrays from video memory.
+;     - Frees memory allocated for each 'stIndicesData' object created in the
+;       'va_shape_create' function (all pointers that were returned by this
+;       function become invalid).
+;     - Erases 'stIndicesData' objects related to the removed vertex array from
+;       created vertex arrays storage '_built_va'.
+;     - Removes the '_built_va' storage if there are no items left in it.
+;
+-----------------------------------------------------------------------------**/
+void va_destroy(unsigned int va_idx)
+{
+    extern map* _built_va;
+
+    if (NULL == _built_va)
+        return;
+
+    stVertexArray* va = map_search(_built_va, va_idx);
+    if (NULL == va)
+        return;
+
+    /* Remove OpenGL objects */
+    GL_CALL(glDeleteVertexArrays(1, &va->vertex_array));
+    GL_CALL(glDeleteBuffers(1, &va->vertex_buffer));
+    _release_quad_indices(va->index_type);
+    _delete_objects(va);
+    _delete_ring(va);
+
+    /* Remove indices info for each va's shape */
+    for (int shape_idx = 0; shape_idx < va->shapes_count; shape_idx++)
+        m_free(va->shapes[shape_idx]);
+
+    /* Destroy indices' storage */
+    m_free(va->shapes);
+
+    /* Remove va object */
+    m_free(va);
+
+    /* Remove va object ptr from created va's storage */
+    map_erase(_built_va, va_idx);
+
+    if (0 == map_get_size(_built_va))
+    {
+        map_destroy(_built_va);
+        _built_va = NULL;
+    }
+}
+
+
+/**-----------------------------------------------------------------------------
+; @func _destroy_build_data
+;
+; @brief
+;   Zeroes pointers and frees memory that was used to create vertex array with
+;   index 'va_idx'.
+;   Deletes 'stIndicesInfo' and frees the video memory filled with data related
+;   to the 'va_idx' array.
+;
+-----------------------------------------------------------------------------**/
+static void _destroy_build_data(unsigned int va_idx)
+{
+    extern map* _va_to_build;
+    extern map* _built_va;
+
+    if (NULL == _va_to_build)
+        return;
+
+    stVaBuildData* vabd = map_search(_va_to_build, va_idx);
+    if (NULL == vabd)
+        return;
+
+    int is_this_va_built_successfully = 0;
+
+    if (NULL != _built_va)
+        if (map_search(_built_va, va_idx) != 0)
+            is_this_va_built_successfully = 1;
+
+    /* For each shape build data of current va */
+    for (int shape_idx = 0; shape_idx < vabd->shapes_count; shape_idx++)
+    {
+        stVaShapeBuildData* vasbd = &vabd->shapes[shape_idx];
+
+        /* Remove vertices */
+        if (vasbd->vertices != NULL)
+            m_free(vasbd->vertices);
+
+        /* The indices info of a shape moves to the built vertex array */
+        if (!is_this_va_built_successfully)
+            m_free(vasbd->target);
+
+        // TODO: Remove empty shapes.
+    }
+    m_free(vabd->shapes);
+
+    /* If this va was not built successfully */
+    if (!is_this_va_built_successfully)
+    {
+        stVertexArray* va = vabd->va;
+
+        /* Remove OpenGL objects */
+        GL_CALL(glDeleteVertexArrays(1, &va->vertex_array));
+        GL_CALL(glDeleteBuffers(1, &va->vertex_buffer));
+
+        /* Destroy indices' storage, the indices info is freed above */
+        m_free(va->shapes);
+
+        /* Remove va object */
+        m_free(va);
+    }
+
+    m_free(vabd);
+    map_erase(_va_to_build, va_idx);
+
+    if(0 == map_get_size(_va_to_build))
+    {
+        map_destroy(_va_to_build);
+        _va_to_build = NULL;
+    }
+}
+
+
+/* Creates a buffer with immutable storage of 'glBufferStorage' 'flags'.
+   Contexts older than OpenGL 4.4 get a 'glBufferData' buffer instead, with
+   'GL_DYNAMIC_DRAW' usage if 'flags' has 'GL_DYNAMIC_STORAGE_BIT'. The buffer
+   stays bound to 'target' */
+static void _create_buffer(unsigned int target, unsigned int* buffer,
+    size_t size, const void* data, unsigned int flags)
+{
+    GL_CALL(glGenBuffers(1, buffer));
+    GL_CALL(glBindBuffer(target, *buffer));
+    if (0 == size)
+        return;
+
+    if (GLAD_GL_VERSION_4_4)
+    {
+        GL_CALL(glBufferStorage(target, size, data, flags));
+    }
+    else
+    {
+        GL_CALL(glBufferData(target, size, data,
+            (flags & GL_DYNAMIC_STORAGE_BIT) ? GL_DYNAMIC_DRAW :
+                GL_STATIC_DRAW));
+    }
+}
+
+
+static stVaBuildData* _get_build_data(unsigned int va_idx)
+{
+    extern map* _va_to_build;
+
+    stVaBuildData* vabd = (NULL == _va_to_build) ? NULL :
+        map_search(_va_to_build, va_idx);
+    if (NULL == vabd)
+    {
+        LOG_ERROR("Vertex array with index %d does not exist.", va_idx);
+    }
+    return vabd;
+}
+
+
+/* Finds the build data of the shape by its index */
+static stVaShapeBuildData* _get_shape_build_data(unsigned int va_idx,
+    const stIndicesInfo* shape)
+{
+    stVaBuildData* vabd = _get_build_data(va_idx);
+    if (NULL == vabd)
+        return NULL;
+
+    if (NULL == shape || shape->idx >= (unsigned int)vabd->shapes_count ||
+        vabd->shapes[shape->idx].target != shape)
+    {
+        LOG_ERROR("Vertex array %d does not contain shape '%p'.", va_idx, shape);
+        return NULL;
+    }
+    return &vabd->shapes[shape->idx];
+}
+
+
+static void _write_vertex(const stVertexArray* va, unsigned char* dst,
+    const float* pos, const float* txd_pos)
+{
+    if (VA_FORMAT_FLOAT == va->format)
+    {
+        stFloatVertex vertex;
+        vertex.pos[0] = pos[0];
+        vertex.pos[1] = pos[1];
+        vertex.txd_pos[0] = _to_unorm16(txd_pos[0]);
+        vertex.txd_pos[1] = _to_unorm16(txd_pos[1]);
+        memcpy(dst, &vertex, sizeof(vertex));
+    }
+    else
+    {
+        stShortVertex vertex;
+        vertex.pos[0] = _to_snorm16(pos[0]);
+        vertex.pos[1] = _to_snorm16(pos[1]);
+        vertex.txd_pos[0] = _to_unorm16(txd_pos[0]);
+        vertex.txd_pos[1] = _to_unorm16(txd_pos[1]);
+        memcpy(dst, &vertex, sizeof(vertex));
+    }
+}
+
+
+/* Converts [0, 1] to 'GL_UNSIGNED_SHORT' read as normalized */
+static unsigned short _to_unorm16(float value)
+{
+    if (value <= 0.0f)
+        return 0;
+    if (value >= 1.0f)
+        return 65535;
+    return (unsigned short)(value * 65535.0f + 0.5f);
+}
+
+
+/* Converts [-1, 1] to 'GL_SHORT' read as normalized */
+static short _to_snorm16(float value)
+{
+    if (value <= -1.0f)
+        return -32767;
+    if (value >= 1.0f)
+        return 32767;
+    return (short)((value < 0.0f) ? value * 32767.0f - 0.5f :
+        value * 32767.0f + 0.5f);
+}
+
+
+static stQuadIndexBuffer* _get_quad_indices(unsigned int type)
+{
+    extern stQuadIndexBuffer _short_quad_indices;
+    extern stQuadIndexBuffer _int_quad_indices;
+
+    return (GL_UNSIGNED_SHORT == type) ? &_short_quad_indices :
+        &_int_quad_indices;
+}
+
+
+/* Makes the quad index buffer of the type cover at least 'quads_count' quads
+   and binds it to the current vertex array. The capacity grows by doubling
+   (up to 'VA_MAX_SHORT_INDEX_QUADS' for 16-bit indices), the buffer keeps its
+   id, so the vertex arrays already built with it stay valid. That is why its
+   storage is mutable, unlike the other buffers of the module */
+static int _reserve_quad_indices(unsigned int type, int quads_count)
+{
+    stQuadIndexBuffer* quad_indices = _get_quad_indices(type);
+
+    if (quads_count > quad_indices->quads_capacity)
+    {
+        int capacity = (quad_indices->quads_capacity > 0) ?
+            quad_indices->quads_capacity : MIN_QUAD_INDICES_CAPACITY;
+        while (capacity < quads_count)
+            capacity *= 2;
+        if (GL_UNSIGNED_SHORT == type && capacity > VA_MAX_SHORT_INDEX_QUADS)
+            capacity = VA_MAX_SHORT_INDEX_QUADS;
+
+        size_t index_size = (GL_UNSIGNED_SHORT == type) ?
+            sizeof(unsigned short) : sizeof(unsigned int);
+        size_t indices_count = (size_t)capacity * INDICES_PER_RECTANGLE;
+        void* indices = m_malloc(index_size * indices_count);
+        if (NULL == indices)
+            return -1;
+
+        /* Top right, bottom right, top left; bottom right, bottom left, top
+           left of each rectangle */
+        static const unsigned int pattern[INDICES_PER_RECTANGLE] =
+            { 0, 1, 3, 1, 2, 3 };
+        for (size_t i = 0; i < indices_count; i++)
+        {
+            unsigned int index = (unsigned int)(i / INDICES_PER_RECTANGLE) * 4 +
+                pattern[i % INDICES_PER_RECTANGLE];
+            if (GL_UNSIGNED_SHORT == type)
+                ((unsigned short*)indices)[i] = (unsigned short)index;
+            else
+                ((unsigned int*)indices)[i] = index;
+        }
+
+        if (0 == quad_indices->buffer)
+        {
+            GL_CALL(glGenBuffers(1, &quad_indices->buffer));
+        }
+        GL_CALL(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, quad_indices->buffer));
+        GL_CALL(glBufferData(GL_ELEMENT_ARRAY_BUFFER,
+            index_size * indices_count, indices, GL_STATIC_DRAW));
+        m_free(indices);
+        quad_indices->quads_capacity = capacity;
+    }
+    else
+    {
+        GL_CALL(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, quad_indices->buffer));
+    }
+
+    quad_indices->users_count++;
+    return 0;
+}
+
+
+/* Deletes the quad index buffer when the last vertex array that uses it is
+   destroyed */
+static void _release_quad_indices(unsigned int type)
+{
+    stQuadIndexBuffer* quad_indices = _get_quad_indices(type);
+
+    if (--quad_indices->users_count > 0)
+        return;
+
+    GL_CALL(glDeleteBuffers(1, &quad_indices->buffer));
+    quad_indices->buffer = 0;
+    quad_indices->quads_capacity = 0;
+    quad_indices->users_count = 0;
+}
+
+
+static stVertexArray* _get_built_va(unsigned int va_idx)
+{
+    extern map* _built_va;
+
+    stVertexArray* va = (NULL == _built_va) ? NULL :
+        map_search(_built_va, va_idx);
+    if (NULL == va)
+    {
+        LOG_ERROR("Vertex array with index %d has not been built.", va_idx);
+    }
+    return va;
+}
+
+
+static int _round_up_to_power_of_two(int value)
+{
+    if (value <= 0)
+        return 0;
+
+    int result = 1;
+    while (result < value)
+        result *= 2;
+    return result;
+}
+
+
+/* Creates the ring of a dynamic vertex array with zeroed vertices of a
+   region of 'rects_capacity' rectangles */
+static stVaRing* _create_ring(int shapes_capacity, int rects_capacity,
+    size_t rect_size)
+{
+    stVaRing* ring = m_calloc(1, sizeof(stVaRing));
+    if (NULL == ring)
+        return NULL;
+
+    /* Each free range is followed by a slot or by the end of the region */
+    ring->region_size = rect_size * rects_capacity;
+    ring->rects_capacity = rects_capacity;
+    ring->vertices = m_calloc(1, ring->region_size);
+    ring->free_ranges = m_malloc(sizeof(stVaFreeRange) * (shapes_capacity + 1));
+    ring->slots = m_calloc(shapes_capacity + 1, sizeof(stVaShapeSlot));
+    ring->free_shapes = m_malloc(sizeof(unsigned int) * (shapes_capacity + 1));
+    ring->dirty_shapes = m_malloc(sizeof(unsigned int) *
+        (shapes_capacity + 1));
+    if (NULL == ring->vertices || NULL == ring->free_ranges ||
+        NULL == ring->slots || NULL == ring->free_shapes ||
+        NULL == ring->dirty_shapes)
+    {
+        m_free(ring->vertices);
+        m_free(ring->free_ranges);
+        m_free(ring->slots);
+        m_free(ring->free_shapes);
+        m_free(ring->dirty_shapes);
+        m_free(ring);
+        return NULL;
+    }
+    return ring;
+}
+
+
+/* Creates the vertex buffer of all regions of the ring and fills each of them
+   with the built vertices. OpenGL 4.4 maps it once for the lifetime of the
+   array, older contexts update it with 'glBufferSubData' */
+static void _create_ring_buffer(stVertexArray* va)
+{
+    stVaRing* ring = va->ring;
+    size_t ring_size = ring->region_size * VA_RING_REGIONS;
+
+    GL_CALL(glGenBuffers(1, &va->vertex_buffer));
+    GL_CALL(glBindBuffer(GL_ARRAY_BUFFER, va->vertex_buffer));
+    if (GLAD_GL_VERSION_4_4)
+    {
+        unsigned int flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT |
+            GL_MAP_COHERENT_BIT;
+        GL_CALL(glBufferStorage(GL_ARRAY_BUFFER, ring_size, NULL, flags));
+        ring->mapped_ring = glMapBufferRange(GL_ARRAY_BUFFER, 0, ring_size,
+            flags);
+        if (NULL == ring->mapped_ring)
+        {
+            LOG_ERROR("Unable to map vertex buffer %u.", va->vertex_buffer);
+        }
+    }
+    else
+    {
+        GL_CALL(glBufferData(GL_ARRAY_BUFFER, ring_size, NULL,
+            GL_DYNAMIC_DRAW));
+    }
+
+    for (int region = 0; region < VA_RING_REGIONS; region++)
+    {
+        _write_ring(va, ring->region_size * region, ring->region_size,
+            ring->vertices);
+    }
+}
+
+
+/* Finds the slot of the shape of the built dynamic vertex array */
+static stVaShapeSlot* _get_dynamic_slot(unsigned int va_idx,
+    const stIndicesInfo* shape, stVertexArray** out_va)
+{
+    stVertexArray* va = _get_built_va(va_idx);
+    if (NULL == va)
+        return NULL;
+    if (NULL == va->ring)
+    {
+        LOG_ERROR("Vertex array %d is not dynamic.", va_idx);
+        return NULL;
+    }
+    if (NULL == shape || shape->idx >= (unsigned int)va->shapes_count ||
+        va->shapes[shape->idx] != shape)
+    {
+        LOG_ERROR("Vertex array %d does not contain shape '%p'.", va_idx, shape);
+        return NULL;
+    }
+
+    *out_va = va;
+    return &va->ring->slots[shape->idx];
+}
+
+
+/* Makes the next 'va_draw_*' of each region copy the shape into the region */
+static void _mark_shape_dirty(stVaRing* ring, unsigned int shape_idx)
+{
+    stVaShapeSlot* slot = &ring->slots[shape_idx];
+    if (0 == slot->dirty_regions)
+        ring->dirty_shapes[ring->dirty_count++] = shape_idx;
+    slot->dirty_regions = (1 << VA_RING_REGIONS) - 1;
+}
+
+
+/* Returns the index of the lowest free range of at least 'rects_count'
+   rectangles that starts before 'limit', -1 if there is none */
+static int _find_free_range(const stVaRing* ring, int rects_count, int limit)
+{
+    for (int i = 0; i < ring->free_count; i++)
+    {
+        const stVaFreeRange* range = &ring->free_ranges[i];
+        if (range->first_rect >= limit)
+            break;
+        if (range->rects_count >= rects_count)
+            return i;
+    }
+    return -1;
+}
+
+
+/* Takes 'rects_count' rectangles from the start of the lowest free range that
+   can hold them (first fit). Returns the first of the rectangles, -1 if no
+   range before 'limit' can hold them */
+static int _alloc_rects(stVaRing* ring, int rects_count, int limit)
+{
+    int range_idx = _find_free_range(ring, rects_count, limit);
+    if (range_idx < 0)
+        return -1;
+
+    stVaFreeRange* range = &ring->free_ranges[range_idx];
+    int first_rect = range->first_rect;
+    range->first_rect += rects_count;
+    range->rects_count -= rects_count;
+    if (0 == range->rects_count)
+    {
+        memmove(range, range + 1,
+            sizeof(stVaFreeRange) * (ring->free_count - range_idx - 1));
+        ring->free_count--;
+    }
+    return first_rect;
+}
+
+
+/* Returns the rectangles to the free ranges, joining them with the adjacent
+   ranges */
+static void _free_rects(stVaRing* ring, int first_rect, int rects_count)
+{
+    stVaFreeRange* ranges = ring->free_ranges;
+    int next = 0;
+    while (next < ring->free_count && ranges[next].first_rect < first_rect)
+        next++;
+
+    int joins_prev = next > 0 &&
+        ranges[next - 1].first_rect + ranges[next - 1].rects_count ==
+            first_rect;
+    int joins_next = next < ring->free_count &&
+        first_rect + rects_count == ranges[next].first_rect;
+
+    if (joins_prev && joins_next)
+    {
+        ranges[next - 1].rects_count += rects_count + ranges[next].rects_count;
+        memmove(&ranges[next], &ranges[next + 1],
+            sizeof(stVaFreeRange) * (ring->free_count - next - 1));
+        ring->free_count--;
+    }
+    else if (joins_prev)
+    {
+        ranges[next - 1].rects_count += rects_count;
+    }
+    else if (joins_next)
+    {
+        ranges[next].first_rect = first_rect;
+        ranges[next].rects_count += rects_count;
+    }
+    else
+    {
+        memmove(&ranges[next + 1], &ranges[next],
+            sizeof(stVaFreeRange) * (ring->free_count - next));
+        ranges[next].first_rect = first_rect;
+        ranges[next].rects_count = rects_count;
+        ring->free_count++;
+    }
+    ring->is_compacted = 0;
+}
+
+
+/* Moves the rectangles of the shape to the allocated slot and frees its old
+   slot */
+static void _move_slot(stVertexArray* va, unsigned int shape_idx,
+    int first_rect, int rects_capacity)
+{
+    stVaRing* ring = va->ring;
+    stVaShapeSlot* slot = &ring->slots[shape_idx];
+    stIndicesInfo* shape = va->shapes[shape_idx];
+    size_t rect_size = (size_t)va->vertex_size * VERTICES_PER_RECTANGLE;
+
+    memcpy(ring->vertices + rect_size * first_rect,
+        ring->vertices + rect_size * slot->first_rect,
+        rect_size * (shape->count / INDICES_PER_RECTANGLE));
+    if (slot->rects_capacity > 0)
+        _free_rects(ring, slot->first_rect, slot->rects_capacity);
+    slot->first_rect = first_rect;
+    slot->rects_capacity = rects_capacity;
+
+    size_t index_size = (GL_UNSIGNED_SHORT == va->index_type) ?
+        sizeof(unsigned short) : sizeof(unsigned int);
+    shape->offset = (void*)((size_t)first_rect * INDICES_PER_RECTANGLE *
+        index_size);
+    _mark_shape_dirty(ring, shape_idx);
+}
+
+
+/* Moves the slots placed last into the lowest free ranges before them, so the
+   free rectangles of the region join at its end. Moves at most 'max_moves'
+   slots */
+static void _compact_ring(stVertexArray* va, int max_moves)
+{
+    stVaRing* ring = va->ring;
+    for (int move = 0; move < max_moves && !ring->is_compacted; move++)
+    {
+        /* A single free range at the end of the region is compacted */
+        const stVaFreeRange* range = ring->free_ranges;
+        if (0 == ring->free_count || (1 == ring->free_count &&
+            range->first_rect + range->rects_count == ring->rects_capacity))
+        {
+            ring->is_compacted = 1;
+            break;
+        }
+
+        int moved_idx = -1;
+        for (int i = 0; i < va->shapes_count; i++)
+        {
+            const stVaShapeSlot* slot = &ring->slots[i];
+            if (NULL == va->shapes[i] || 0 == slot->rects_capacity ||
+                (moved_idx >= 0 &&
+                    slot->first_rect < ring->slots[moved_idx].first_rect))
+            {
+                continue;
+            }
+            if (_find_free_range(ring, slot->rects_capacity,
+                slot->first_rect) >= 0)
+            {
+                moved_idx = i;
+            }
+        }
+        if (moved_idx < 0)
+        {
+            ring->is_compacted = 1;
+            break;
+        }
+
+        stVaShapeSlot* slot = &ring->slots[moved_idx];
+        int first_rect = _alloc_rects(ring, slot->rects_capacity,
+            slot->first_rect);
+        _move_slot(va, moved_idx, first_rect, slot->rects_capacity);
+    }
+}
+
+
+/* Capacity of a dynamic vertex array: twice the built items, at least the
+   reserved and the minimal ones */
+static int _get_dynamic_capacity(int count, int reserved, int minimal)
+{
+    int capacity = 2 * count;
+    if (capacity < reserved)
+        capacity = reserved;
+    if (capacity < minimal)
+        capacity = minimal;
+    return capacity;
+}
+
+
+/* 'map_for_each_item' callback of 'va_begin_frame'. The slots of the array
+   are compacted a little each frame it is drawn */
+static void _advance_ring(size_t va_idx, void* va_ptr)
+{
+    (void)va_idx;
+    stVertexArray* va = va_ptr;
+    stVaRing* ring = va->ring;
+    if (NULL == ring || !ring->is_region_drawn)
+        return;
+
+    /* 'glBufferSubData' is synchronized by the driver */
+    if (ring->mapped_ring != NULL)
+    {
+        ring->fences[ring->region] =
+            glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    }
+    ring->region = (ring->region + 1) % VA_RING_REGIONS;
+    ring->is_region_drawn = 0;
+
+    GLsync fence = ring->fences[ring->region];
+    if (fence != NULL)
+    {
+        GLenum result = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT,
+            RING_WAIT_TIMEOUT);
+        while (GL_TIMEOUT_EXPIRED == result)
+            result = glClientWaitSync(fence, 0, RING_WAIT_TIMEOUT);
+        if (GL_WAIT_FAILED == result)
+        {
+            LOG_ERROR("Unable to wait for region %d of vertex buffer %u.",
+                ring->region, va->vertex_buffer);
+        }
+        glDeleteSync(fence);
+        ring->fences[ring->region] = NULL;
+    }
+
+    _compact_ring(va, COMPACT_MOVES_PER_FRAME);
+}
+
+
+/* Copies the dirty shapes into the region of the frame before its first draw
+   and binds the region as the vertices of the vertex array. The shapes are
+   drawn from where they are at that moment until the next frame. The vertex
+   array must be bound */
+static void _sync_ring(stVertexArray* va)
+{
+    stVaRing* ring = va->ring;
+    if (!ring->is_region_drawn)
+    {
+        size_t rect_size = (size_t)va->vertex_size * VERTICES_PER_RECTANGLE;
+        size_t region_offset = ring->region_size * ring->region;
+        unsigned char region_bit = (unsigned char)(1 << ring->region);
+        int kept_count = 0;
+
+        for (int i = 0; i < ring->dirty_count; i++)
+        {
+            unsigned int shape_idx = ring->dirty_shapes[i];
+            stVaShapeSlot* slot = &ring->slots[shape_idx];
+
+            /* A removed shape is not drawn from now on, so its index can be
+               given to a new shape */
+            if (NULL == va->shapes[shape_idx])
+            {
+                slot->dirty_regions = 0;
+                slot->drawn_rects_count = 0;
+                ring->free_shapes[ring->free_shapes_count++] = shape_idx;
+                ring->are_commands_dirty = 1;
+                continue;
+            }
+
+            int rects_count = va->shapes[shape_idx]->count /
+                INDICES_PER_RECTANGLE;
+            if (slot->dirty_regions & region_bit)
+            {
+                size_t offset = rect_size * slot->first_rect;
+                _write_ring(va, region_offset + offset,
+                    rect_size * rects_count, ring->vertices + offset);
+                slot->dirty_regions &= ~region_bit;
+            }
+            if (slot->drawn_first_rect != slot->first_rect ||
+                slot->drawn_rects_count != rects_count)
+            {
+                slot->drawn_first_rect = slot->first_rect;
+                slot->drawn_rects_count = rects_count;
+                ring->are_commands_dirty = 1;
+            }
+            if (slot->dirty_regions != 0)
+                ring->dirty_shapes[kept_count++] = shape_idx;
+        }
+        ring->dirty_count = kept_count;
+        ring->is_region_drawn = 1;
+    }
+
+    GL_CALL(glBindVertexBuffer(0, va->vertex_buffer,
+        (GLintptr)(ring->region_size * ring->region), va->vertex_size));
+}
+
+
+static void _write_ring(stVertexArray* va, size_t offset, size_t size,
+    const void* data)
+{
+    if (0 == size)
+        return;
+
+    if (va->ring->mapped_ring != NULL)
+    {
+        memcpy(va->ring->mapped_ring + offset, data, size);
+    }
+    else
+    {
+        GL_CALL(glBindBuffer(GL_ARRAY_BUFFER, va->vertex_buffer));
+        GL_CALL(glBufferSubData(GL_ARRAY_BUFFER, offset, size, data));
+    }
+}
+
+
+static void _delete_ring(stVertexArray* va)
+{
+    stVaRing* ring = va->ring;
+    if (NULL == ring)
+        return;
+
+    for (int region = 0; region < VA_RING_REGIONS; region++)
+    {
+        if (ring->fences[region] != NULL)
+            glDeleteSync(ring->fences[region]);
+    }
+    /* The mapping is released with the buffer */
+    m_free(ring->vertices);
+    m_free(ring->free_ranges);
+    m_free(ring->slots);
+    m_free(ring->free_shapes);
+    m_free(ring->dirty_shapes);
+    m_free(ring);
+    va->ring = NULL;
+}
+
+
+/* Creates the objects of the built shapes and the buffers that 'va_draw_*'
+   read: the object data, the object indices and the commands of
+   'va_draw_all'. The vertex array must be bound */
+static int _create_objects(stVertexArray* va)
+{
+    int capacity = va->shapes_capacity;
+    if (0 == capacity)
+        return 0;
+
+    va->objects = m_malloc(sizeof(stVaObjectData) * capacity);
+    va->dirty_objects = m_malloc(sizeof(unsigned int) * capacity);
+    va->is_object_dirty = m_calloc(capacity, sizeof(unsigned char));
+    unsigned int* object_ids = m_malloc(sizeof(unsigned int) * capacity);
+    stDrawElementsIndirectCommand* commands = m_calloc(capacity,
+        sizeof(stDrawElementsIndirectCommand));
+    if (NULL == va->objects || NULL == va->dirty_objects ||
+        NULL == va->is_object_dirty || NULL == object_ids || NULL == commands)
+    {
+        m_free(object_ids);
+        m_free(commands);
+        _delete_objects(va);
+        return -1;
+    }
+
+    /* Until their data is set, the shapes are drawn as they were built */
+    const stVaObjectData default_object = { { 0.0f, 0.0f }, { 1.0f, 1.0f },
+        0, 0 };
+    for (int object_idx = 0; object_idx < capacity; object_idx++)
+    {
+        va->objects[object_idx] = default_object;
+        object_ids[object_idx] = object_idx;
+        if (object_idx < va->shapes_count)
+            _set_command(va, &commands[object_idx], object_idx);
+    }
+
+    /* A dynamic array has room for the shapes added after 'va_build' */
+    _create_buffer(GL_SHADER_STORAGE_BUFFER, &va->objects_buffer,
+        sizeof(stVaObjectData) * capacity, va->objects,
+        GL_DYNAMIC_STORAGE_BIT);
+
+    /* The commands of a dynamic array change when its shapes move */
+    _create_buffer(GL_DRAW_INDIRECT_BUFFER, &va->all_indirect_buffer,
+        sizeof(stDrawElementsIndirectCommand) * capacity, commands,
+        va->is_dynamic ? GL_DYNAMIC_STORAGE_BIT : 0);
+    m_free(commands);
+
+    /* The object indices are read by instance, a draw with the base instance
+       'i' reads 'i' */
+    _create_buffer(GL_ARRAY_BUFFER, &va->object_ids_buffer,
+        sizeof(unsigned int) * capacity, object_ids, 0);
+    GL_CALL(glBindBuffer(GL_ARRAY_BUFFER, 0));
+    m_free(object_ids);
+
+    GL_CALL(glBindVertexBuffer(VA_OBJECT_ID_ATTRIB, va->object_ids_buffer, 0,
+        sizeof(unsigned int)));
+    GL_CALL(glVertexAttribIFormat(VA_OBJECT_ID_ATTRIB, 1, GL_UNSIGNED_INT, 0));
+    GL_CALL(glVertexAttribBinding(VA_OBJECT_ID_ATTRIB, VA_OBJECT_ID_ATTRIB));
+    GL_CALL(glVertexBindingDivisor(VA_OBJECT_ID_ATTRIB, 1));
+    GL_CALL(glEnableVertexAttribArray(VA_OBJECT_ID_ATTRIB));
+    return 0;
+}
+
+
+/* Uploads the objects changed since the previous upload. Dirty objects
+   separated by at most 'MAX_UPLOAD_GAP' clean ones are uploaded by one
+   'glBufferSubData' call */
+static void _upload_dirty_objects(stVertexArray* va)
+{
+    if (0 == va->dirty_count)
+        return;
+
+    qsort(va->dirty_objects, va->dirty_count, sizeof(unsigned int),
+        _compare_indices);
+
+    GL_CALL(glBindBuffer(GL_SHADER_STORAGE_BUFFER, va->objects_buffer));
+    int run_start = 0;
+    for (int i = 1; i <= va->dirty_count; i++)
+    {
+        if (i < va->dirty_count &&
+            va->dirty_objects[i] - va->dirty_objects[i - 1] <= MAX_UPLOAD_GAP + 1)
+        {
+            continue;
+        }
+
+        unsigned int first = va->dirty_objects[run_start];
+        unsigned int last = va->dirty_objects[i - 1];
+        GL_CALL(glBufferSubData(GL_SHADER_STORAGE_BUFFER,
+            sizeof(stVaObjectData) * first,
+            sizeof(stVaObjectData) * (last - first + 1), &va->objects[first]));
+        run_start = i;
+    }
+
+    for (int i = 0; i < va->dirty_count; i++)
+        va->is_object_dirty[va->dirty_objects[i]] = 0;
+    va->dirty_count = 0;
+}
+
+
+static int _compare_indices(const void* a, const void* b)
+{
+    unsigned int lhs = *(const unsigned int*)a;
+    unsigned int rhs = *(const unsigned int*)b;
+    return (lhs > rhs) - (lhs < rhs);
+}
+
+
+/* Makes the commands of 'va_draw_list' hold at least 'count' draws */
+static int _reserve_draws(stVertexArray* va, int count)
+{
+    if (count <= va->draws_capacity)
+        return 0;
+
+    int capacity = (va->draws_capacity > 0) ? va->draws_capacity : 16;
+    while (capacity < count)
+        capacity *= 2;
+
+    stDrawElementsIndirectCommand* commands = m_realloc(va->commands,
+        sizeof(stDrawElementsIndirectCommand) * capacity);
+    if (NULL == commands)
+        return -1;
+    va->commands = commands;
+
+    if (0 == va->indirect_buffer)
+    {
+        GL_CALL(glGenBuffers(1, &va->indirect_buffer));
+    }
+    va->draws_capacity = capacity;
+    return 0;
+}
+
+
+/* The base instance of the command is the index of the object of the shape.
+   A shape of a dynamic array is drawn from the rectangles that the region of
+   the frame holds for it */
+static void _set_command(const stVertexArray* va,
+    stDrawElementsIndirectCommand* command, unsigned int shape_idx)
+{
+    if (va->ring != NULL)
+    {
+        const stVaShapeSlot* slot = &va->ring->slots[shape_idx];
+        command->count = slot->drawn_rects_count * INDICES_PER_RECTANGLE;
+        command->first_index = slot->drawn_first_rect * INDICES_PER_RECTANGLE;
+    }
+    else
+    {
+        const stIndicesInfo* shape = va->shapes[shape_idx];
+        command->count = shape->count;
+        command->first_index = (unsigned int)((size_t)shape->offset /
+            ((GL_UNSIGNED_SHORT == shape->type) ? sizeof(unsigned short) :
+                sizeof(unsigned int)));
+    }
+    command->instance_count = 1;
+    command->base_vertex = 0;
+    command->base_instance = shape_idx;
+}
+
+
+/* Issues the multi-draw call of the first 'count' commands of the bound
+   'GL_DRAW_INDIRECT_BUFFER' */
+static void _draw_objects(stVertexArray* va, int count)
+{
+    GL_CALL(glBindBufferBase(GL_SHADER_STORAGE_BUFFER, VA_OBJECT_DATA_BINDING,
+        va->objects_buffer));
+
+    /* All shapes are built of 'GL_TRIANGLES' */
+    GL_CALL(glMultiDrawElementsIndirect(GL_TRIANGLES, va->index_type, NULL,
+        count, 0));
+}
+
+
+static void _delete_objects(stVertexArray* va)
+{
+    if (va->objects_buffer != 0)
+    {
+        GL_CALL(glDeleteBuffers(1, &va->objects_buffer));
+        GL_CALL(glDeleteBuffers(1, &va->object_ids_buffer));
+        GL_CALL(glDeleteBuffers(1, &va->all_indirect_buffer));
+    }
+    if (va->indirect_buffer != 0)
+    {
+        GL_CALL(glDeleteBuffers(1, &va->indirect_buffer));
+    }
+    m_free(va->objects);
+    m_free(va->dirty_objects);
+    m_free(va->is_object_dirty);
+    m_free(va->commands);
+    va->objects = NULL;
+    va->dirty_objects = NULL;
+    va->is_object_dirty = NULL;
+    va->dirty_count = 0;
+    va->objects_buffer = 0;
+    va->object_ids_buffer = 0;
+    va->all_indirect_buffer = 0;
+    va->indirect_buffer = 0;
+    va->commands = NULL;
+    va->draws_capacity = 0;
+}
+
+
+
+/** @tests-------------------------------------------------------------------**/
+//#define TEST_RUN
+//#define VERTEX_ARRAY_TEST
+//#define TEST_MODULE VERTEX_ARRAY
+
+#ifdef TEST_RUN
+#ifdef VERTEX_ARRAY_TEST
+
+#include <GLFW/glfw3.h>
+
+#include "../window.h"
+#include "../../test.h"
+
+
+#define __BENCH_SHAPES 10000
+
+
+/* Adds 'shape_idx % 4 + 1' rectangles, each vertex is (shape_idx, rect) */
+static void _add_test_rects(unsigned int va, stIndicesInfo* shape,
+    int shape_idx)
+{
+    float vertices[4 * 8];
+    float txd_vertices[4 * 8];
+    int count = shape_idx % 4 + 1;
+    for (int i = 0; i < count * 8; i++)
+    {
+        vertices[i] = (float)shape_idx + (float)(i / 8);
+        txd_vertices[i] = (i % 2) ? 1.0f : 0.0f;
+    }
+    va_shape_add_textured_rects(va, shape, count, vertices, txd_vertices);
+}
+
+
+/**-----------------------------------------------------------------------------
+; @unit_test
+;
+; @brief
+;   The vertices of all shapes are uploaded contiguously in the order the
+;   shapes were created and each shape refers to its own quads.
+;
+-----------------------------------------------------------------------------**/
+TEST_BEGIN(test_build_uploads_all_shapes)
+{
+    extern map* _built_va;
+
+    EXPECT_ZERO(window_init("test", 1, 1, 0, 0));
+
+    unsigned int va = va_create(VA_FORMAT_FLOAT);
+    stIndicesInfo* shapes[8];
+    for (int i = 0; i < 8; i++)
+        shapes[i] = va_shape_create(va);
+    for (int i = 0; i < 8; i++)
+        _add_test_rects(va, shapes[i], i);
+    va_build(va);
+
+    /* 1 + 2 + 3 + 4 + 1 + 2 + 3 + 4 rectangles */
+    stVertexArray* built = map_search(_built_va, va);
+    stFloatVertex vertices[20 * 4];
+    glBindBuffer(GL_ARRAY_BUFFER, built->vertex_buffer);
+    glGetBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(vertices), vertices);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    int vertex_idx = 0;
+    for (int i = 0; i < 8; i++)
+    {
+        EXPECT(shapes[i]->count, (unsigned int)(i % 4 + 1) * 6);
+        EXPECT((size_t)shapes[i]->offset,
+            (size_t)vertex_idx / 4 * 6 * sizeof(unsigned short));
+        for (int rect = 0; rect <= i % 4; rect++)
+        {
+            for (int v = 0; v < 4; v++, vertex_idx++)
+                EXPECT(vertices[vertex_idx].pos[0], (float)(i + rect));
+        }
+    }
+
+    if (GLAD_GL_VERSION_4_4)
+    {
+        int is_immutable = 0;
+        glBindBuffer(GL_ARRAY_BUFFER, built->vertex_buffer);
+        glGetBufferParameteriv(GL_ARRAY_BUFFER, GL_BUFFER_IMMUTABLE_STORAGE,
+            &is_immutable);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        EXPECT(is_immutable, GL_TRUE);
+    }
+
+    va_destroy(va);
+    glfwTerminate();
+    TEST_END
+}
+
+
+/**-----------------------------------------------------------------------------
+; @unit_test
+;
+; @brief
+;   'va_shape_update' rewrites the rectangles of a dynamic shape in the region
+;   drawn next, and 'va_shape_resize' moves a grown shape to a new slot while
+;   keeping its rectangles.
+;
+-----------------------------------------------------------------------------**/
+TEST_BEGIN(test_dynamic_update_and_resize)
+{
+    extern map* _built_va;
+
+    EXPECT_ZERO(window_init("test", 1, 1, 0, 0));
+
+    unsigned int va = va_create(VA_FORMAT_FLOAT | VA_DYNAMIC);
+    stIndicesInfo* shapes[2];
+    for (int i = 0; i < 2; i++)
+    {
+        shapes[i] = va_shape_create(va);
+        _add_test_rects(va, shapes[i], i + 2);
+    }
+    va_build(va);
+    stVertexArray* built = map_search(_built_va, va);
+    EXPECT_NOT_NULL(built->ring);
+
+    /* Slots of 4 and 4 rectangles */
+    float vertices[4 * 8];
+    float txd_vertices[4 * 8] = { 0.0f };
+    for (int i = 0; i < 8; i++)
+        vertices[i] = 7.0f;
+    EXPECT_ZERO(va_shape_update(va, shapes[1], 1, 1, vertices, txd_vertices));
+    EXPECT(va_shape_update(va, shapes[1], 4, 1, vertices, txd_vertices), -1);
+
+    stFloatVertex region[8 * 4];
+    va_draw_all(va);
+    glBindBuffer(GL_ARRAY_BUFFER, built->vertex_buffer);
+    glGetBufferSubData(GL_ARRAY_BUFFER, built->ring->region_size *
+        built->ring->region, sizeof(region), region);
+    EXPECT(region[4 * 4].pos[0], 3.0f);
+    EXPECT(region[5 * 4].pos[0], 7.0f);
+    EXPECT(region[6 * 4].pos[0], 5.0f);
+
+    /* Shape 1 grows past its slot and moves after both slots */
+    EXPECT_ZERO(va_shape_resize(va, shapes[1], 5));
+    EXPECT(shapes[1]->count, 5u * 6);
+    EXPECT((size_t)shapes[1]->offset, 8 * 6 * sizeof(unsigned short));
+    EXPECT(built->ring->free_count, 2);
+    EXPECT(built->ring->free_ranges[0].first_rect, 4);
+    EXPECT(va_shape_resize(va, shapes[0], 1000), -1);
+
+    va_begin_frame();
+    va_draw_all(va);
+    glGetBufferSubData(GL_ARRAY_BUFFER, built->ring->region_size *
+        built->ring->region + sizeof(stFloatVertex) * 8 * 4,
+        sizeof(stFloatVertex) * 4 * 4, region);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    EXPECT(region[0].pos[0], 3.0f);
+    EXPECT(region[4].pos[0], 7.0f);
+
+    va_destroy(va);
+    glfwTerminate();
+    TEST_END
+}
+
+
+/**-----------------------------------------------------------------------------
+; @unit_test
+;
+; @brief
+;   Removed shapes free their slots, added shapes take the free ranges and
+;   the region is compacted when a slot does not fit into any of them.
+;
+-----------------------------------------------------------------------------**/
+TEST_BEGIN(test_dynamic_add_remove_compact)
+{
+    extern map* _built_va;
+
+    EXPECT_ZERO(window_init("test", 1, 1, 0, 0));
+
+    /* 4 shapes of 16 rectangles in a region of 128 */
+    unsigned int va = va_create(VA_FORMAT_FLOAT | VA_DYNAMIC);
+    stIndicesInfo* shapes[4];
+    float vertices[16 * 8];
+    float txd_vertices[16 * 8] = { 0.0f };
+    for (int i = 0; i < 4; i++)
+    {
+        for (int v = 0; v < 16 * 8; v++)
+            vertices[v] = (float)i;
+        shapes[i] = va_shape_create(va);
+        va_shape_add_textured_rects(va, shapes[i], 16, vertices, txd_vertices);
+    }
+    va_build(va);
+    stVertexArray* built = map_search(_built_va, va);
+
+    stIndicesInfo* added = va_shape_add(va);
+    EXPECT_NOT_NULL(added);
+    EXPECT(added->idx, 4u);
+    EXPECT_ZERO(va_shape_resize(va, added, 64));
+    EXPECT_ZERO(va_shape_remove(va, shapes[1]));
+    EXPECT_ZERO(va_shape_remove(va, shapes[3]));
+    EXPECT(built->ring->free_count, 2);
+
+    /* The removed indices are given to new shapes after the next draw */
+    va_draw_all(va);
+    va_begin_frame();
+    stIndicesInfo* moved = va_shape_add(va);
+    EXPECT(moved->idx == 1 || moved->idx == 3, 1);
+
+    /* Free ranges of 16 and 16 rectangles, shape 2 moves down to join them */
+    EXPECT_ZERO(va_shape_resize(va, moved, 32));
+    EXPECT((size_t)shapes[2]->offset, 16 * 6 * sizeof(unsigned short));
+    EXPECT((size_t)moved->offset, 32 * 6 * sizeof(unsigned short));
+    EXPECT_ZERO(built->ring->free_count);
+
+    va_draw_all(va);
+    stFloatVertex vertex;
+    glBindBuffer(GL_ARRAY_BUFFER, built->vertex_buffer);
+    glGetBufferSubData(GL_ARRAY_BUFFER, built->ring->region_size *
+        built->ring->region + sizeof(stFloatVertex) * 16 * 4,
+        sizeof(vertex), &vertex);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    EXPECT(vertex.pos[0], 2.0f);
+
+    va_destroy(va);
+    glfwTerminate();
+    TEST_END
+}
+
+
+/**-----------------------------------------------------------------------------
+; @unit_test
+;
+; @brief
+;   Measures the time of 'va_build' for '__BENCH_SHAPES' shapes of 1-4
+;   rectangles (until the GPU finishes the upload).
+;
+-----------------------------------------------------------------------------**/
+TEST_BEGIN(bench_build_10k_shapes)
+{
+    EXPECT_ZERO(window_init("test", 1, 1, 0, 0));
+
+    static const unsigned int formats[] = { VA_FORMAT_FLOAT, VA_FORMAT_SHORT };
+    for (int f = 0; f < 2; f++)
+    {
+        double start = glfwGetTime();
+        unsigned int va = va_create(formats[f]);
+        for (int i = 0; i < __BENCH_SHAPES; i++)
+            _add_test_rects(va, va_shape_create(va), i);
+        double build_start = glfwGetTime();
+        va_build(va);
+        glFinish();
+        double end = glfwGetTime();
+
+        OUTPUT("  %s: %d shapes added in %.3f ms, built in %.3f ms\n",
+            (VA_FORMAT_FLOAT == formats[f]) ? "float" : "short",
+            __BENCH_SHAPES, (build_start - start) * 1000.0,
+            (end - build_start) * 1000.0);
+        va_destroy(va);
+    }
+
+    glfwTerminate();
+    TEST_END
+}
+
+
+RUN_TESTS
+(
+    test_build_uploads_all_shapes,
+    test_dynamic_update_and_resize,
+    test_dynamic_add_remove_compact,
+    bench_build_10k_shapes
+)
+
+
+#endif /* VERTEX_ARRAY_TEST */
+#endif /* TEST_RUN */
@@ -6,14 +6,21 @@
 ;   vertex arrays with data.
 ;
 ; @usage
-;   - create an array of vertices using the 'va_create' function;
+;   - create an array of vertices using the 'va_create' function, the format
+;     sets the precision of its vertices ('VA_FORMAT_*');
 ;   - create a shape in this array using the 'va_shape_create' function;
-;   - add primitives to this shape using the 'va_shape_add_textured_rect' func.
+;   - add primitives to this shape using the 'va_shape_add_textured_rect' func
+;     or many at once with 'va_shape_add_textured_rects'.
 ;       At this stage, it is possible to only add a textured quadrilateral.
 ;       Hopefully the functionality will be improved (for example, adding a
 ;       circle, triangle, 3d objects, etc.);
 ;   - build an array of vertices (load all primitives of all shapes into video
 ;     memory) using the 'va_build' function;
+;   - set the position, size, layer and unit of the shapes with
+;     'va_shape_set_data' (again whenever they change);
+;   - draw all shapes of the array with 'va_draw_all' or some of them with
+;     'va_draw_list'. Both issue a single multi-draw call;
+;   - call 'va_begin_frame' once per frame (the main loop does it);
 ;   - delete the created vertex array after use using the 'va_destroy' function.
 ;     This function will clear the video memory and delete the information about
 ;     the created shapes from the main memory.
@@ -23,7 +30,56 @@
 ;   valid only after calling the 'va_build' function.
 ;
 ;   After calling 'va_destroy', all 'stIndicesInfo*' returned from
-;   'va_shape_create' become invalid.
+;   'va_shape_create' and 'va_shape_add' become invalid.
+;
+;   The vertices of an array are interleaved in one buffer: a position and
+;   16-bit normalized texture coordinates. 'VA_FORMAT_FLOAT' keeps 32-bit
+;   float positions (12 bytes per vertex), 'VA_FORMAT_SHORT' keeps 16-bit
+;   normalized positions (8 bytes per vertex). Positions of 'VA_FORMAT_SHORT'
+;   and texture coordinates are clamped to [-1, 1] and [0, 1]: place and
+;   scale the shapes with 'stVaObjectData' instead (a large tile map is one
+;   shape in [0, 1] with the size of the map).
+;
+;   The shapes do not have their own indices. All vertex arrays share one
+;   precomputed quad index buffer (0, 1, 3, 1, 2, 3, 4, 5, 7, ...) that grows
+;   on demand, a shape keeps only its vertices and refers to the range of the
+;   buffer that covers its quads. Vertex arrays of up to
+;   'VA_MAX_SHORT_INDEX_QUADS' quads use 16-bit indices.
+;
+;   Each shape of a built vertex array is an object with 'stVaObjectData'
+;   (position, size, layer and unit) kept in a shader storage buffer. The
+;   data is set with 'va_shape_set_data' and stays in video memory: only the
+;   objects changed since the previous draw are uploaded, so static objects
+;   cost nothing per frame.
+;
+;   'va_draw_all' and 'va_draw_list' expect the current program to read the
+;   'stVaObjectData' of each draw from the shader storage buffer at binding
+;   'VA_OBJECT_DATA_BINDING', indexed by the vertex attribute
+;   'VA_OBJECT_ID_ATTRIB' (see the 'txd_array_indirect' shaders). OpenGL 4.3
+;   has no 'gl_DrawID', so each draw is a single instance whose base instance
+;   is the index of the object, and the attribute reads a buffer of object
+;   indices with divisor 1.
+;
+;   The vertices of a vertex array created with the 'VA_DYNAMIC' flag can be
+;   changed after 'va_build' with 'va_shape_update' and 'va_shape_resize'. Its
+;   vertex buffer is a ring of 'VA_RING_REGIONS' regions persistently mapped
+;   for writing (OpenGL 4.4). Each frame draws from the next region: changed
+;   shapes are copied into it by the first draw of the array in the frame,
+;   after the fence of the frame that last read the region is signaled, so
+;   neither the CPU nor the GPU waits for the other. Changes made after the
+;   array is drawn are drawn the next frame. On older contexts the regions
+;   are written with 'glBufferSubData'.
+;
+;   A region of a dynamic vertex array is a heap of rectangles: a shape gets
+;   a slot of a power of two rectangles allocated from a list of free ranges
+;   (lowest range that fits), 'va_shape_resize' moves it to a larger slot and
+;   'va_shape_remove' frees its slot. Shapes are added after 'va_build' with
+;   'va_shape_add'. 'va_begin_frame' compacts the region a few slots per
+;   frame by moving the last slots into the free ranges before them, so the
+;   free rectangles join at the end of the region. The indices need no heap:
+;   a slot refers to the range of the quad index buffer that covers it. By
+;   default an array holds twice the shapes and the rectangles it is built
+;   with, 'va_reserve' sets more.
 ; 
 ; @date   October 2021
 ; @author Eph
@@ -35,6 +91,18 @@
 
 
 
+#define VA_FORMAT_FLOAT 0               /* Float positions                    */
+#define VA_FORMAT_SHORT 1               /* 16-bit normalized positions        */
+#define VA_DYNAMIC 0x100                /* Flag of the format of 'va_create'  */
+
+#define VA_RING_REGIONS 3               /* Frames in flight of dynamic arrays */
+
+#define VA_OBJECT_DATA_BINDING 0        /* Shader storage buffer binding      */
+#define VA_OBJECT_ID_ATTRIB 2           /* Vertex attribute of object indices */
+#define VA_MAX_SHORT_INDEX_QUADS 16384  /* Quads addressable by 16-bit index  */
+
+
+
 /** @types -------------------------------------------------------------------*/
 
 /* The structure contains a minimum set of data required to render anything
@@ -45,17 +113,48 @@ typedef struct stIndicesInfo
     // TODO: Add vertex array idx.
     /* const */ unsigned int mode;      /* Vertices connection mode           */
     /* const */ unsigned int count;     /* Number of elements to be rendered  */
+    /* const */ unsigned int type;      /* 'GL_UNSIGNED_SHORT' or             */
+                                        /* 'GL_UNSIGNED_INT'                  */
     /* const */ void* offset;           /* Offset to the first index of the   */
                                         /* shape(s)                           */
+    /* const */ unsigned int idx;       /* Index of the shape (its object) in */
+                                        /* the vertex array                   */
 }stIndicesInfo;
 
 
+/* Data of one object (shape) of a vertex array, laid out as the std430
+   structure of the shaders */
+typedef struct
+{
+    float pos[2];                       /* Model position                     */
+    float size[2];                      /* Model size                         */
+    int layer;                          /* Layer of the texture 2d array      */
+    int unit;                           /* Texture unit of the array          */
+}stVaObjectData;
+
+
 
-unsigned int va_create(void);
+unsigned int va_create(unsigned int format);
 stIndicesInfo* va_shape_create(unsigned int va_idx);
 void va_shape_add_textured_rect(unsigned int va_idx, stIndicesInfo* shape,
     float* vertices, float* txd_vertices);
+void va_shape_add_textured_rects(unsigned int va_idx, stIndicesInfo* shape,
+    int count, const float* vertices, const float* txd_vertices);
 void va_build(unsigned int va_idx);
+void va_shape_set_data(unsigned int va_idx, const stIndicesInfo* shape,
+    const stVaObjectData* data);
+void va_draw_all(unsigned int va_idx);
+void va_draw_list(unsigned int va_idx, stIndicesInfo* const* shapes,
+    int count);
+void va_reserve(unsigned int va_idx, int shapes_count, int rects_count);
+void va_begin_frame(void);
+int va_shape_update(unsigned int va_idx, const stIndicesInfo* shape,
+    int first_rect, int count, const float* vertices,
+    const float* txd_vertices);
+int va_shape_resize(unsigned int va_idx, stIndicesInfo* shape,
+    int rects_count);
+stIndicesInfo* va_shape_add(unsigned int va_idx);
+int va_shape_remove(unsigned int va_idx, stIndicesInfo* shape);
 void va_destroy(unsigned int va_idx);
 
 
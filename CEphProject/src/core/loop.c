@@ -2,6 +2,10 @@
 
 #include "loop.h"
 #include "window.h"
+#include "graphics/sprite_batch.h"
+#include "graphics/vertex_array.h"
+#include "graphics/texture/texture_residency.h"
+#include "graphics/texture/texture_units.h"
 #include "../log.h"
 
 
@@ -18,7 +22,18 @@ static float _calc_fps(float period);
 
 
 /** @functions ---------------------------------------------------------------*/
-void start_loop(void(*loop_iteration_callback_ptr)(void))
+/**-----------------------------------------------------------------------------
+; @func start_loop
+;
+; @brief
+;   Calls 'loop_iteration_callback_ptr' every frame until the window is closed.
+;   'shutdown_callback_ptr' (may be NULL) is called after the last frame while
+;   the OpenGL context is still current, so modules that own OpenGL objects
+;   must be destroyed there. GLFW is terminated after it.
+;
+-----------------------------------------------------------------------------**/
+void start_loop(void(*loop_iteration_callback_ptr)(void),
+    void(*shutdown_callback_ptr)(void))
 {
     extern float _tick_count;
     extern float _frame_time;
@@ -47,6 +62,14 @@ void start_loop(void(*loop_iteration_callback_ptr)(void))
         /* Clear the 'GL_COLOR_BUFFER_BIT' buffer using the selected color */
         glClear(GL_COLOR_BUFFER_BIT);
 
+        /* Start counting texture binds and sprites of the frame, evict
+           texture arrays that do not fit into the video memory budget and
+           move dynamic vertex arrays to the next regions of their rings */
+        tu_begin_frame();
+        tr_begin_frame();
+        sb_begin_frame();
+        va_begin_frame();
+
         /* Call a custom callback */
         loop_iteration_callback_ptr();
 
@@ -57,8 +80,12 @@ void start_loop(void(*loop_iteration_callback_ptr)(void))
         glfwPollEvents();
     }
 
+    /* Free OpenGL objects while the context is alive */
+    if (shutdown_callback_ptr != NULL)
+        shutdown_callback_ptr();
+
     /* Destroy all windows, free allocated resources */
-    glfwTerminate();
+    window_terminate();
 }
 
 
@@ -3,7 +3,8 @@
 
 
 
-void start_loop(void(*loop_iteration_callback_ptr)(void));
+void start_loop(void(*loop_iteration_callback_ptr)(void),
+    void(*shutdown_callback_ptr)(void));
 
 float get_tick_count(void);
 float get_frame_time(void);
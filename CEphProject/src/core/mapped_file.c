@@ -0,0 +1,191 @@
+/**-----------------------------------------------------------------------------
+; @file mapped_file.c
+;
+; @brief
+;   The file implements the functionality of the 'mapped_file' module.
+;
+;   mf - mapped file
+;
+; @date   October 2021
+; @author Eph
+;
+-----------------------------------------------------------------------------**/
+
+
+
+/** @includes ----------------------------------------------------------------*/
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <fcntl.h>    /* open */
+#include <sys/mman.h> /* mmap */
+#include <sys/stat.h> /* fstat */
+#include <unistd.h>   /* close */
+#endif
+
+#include "mapped_file.h"
+#include "memory.h"
+#include "../log.h"
+
+
+
+/** @types -------------------------------------------------------------------*/
+
+typedef struct stMappedFile
+{
+    const void* data;                   /* NULL for empty files               */
+    size_t size;
+#if defined(_WIN32)
+    HANDLE file;
+    HANDLE mapping;
+#endif
+}stMappedFile;
+
+
+
+/** @functions ---------------------------------------------------------------*/
+
+/**-----------------------------------------------------------------------------
+; @func mf_open
+;
+; @brief
+;   Maps the whole file into memory for reading.
+;
+; @return
+;   Mapped file that must be passed to 'mf_close' or NULL on failure.
+;
+-----------------------------------------------------------------------------**/
+stMappedFile* mf_open(const char* path)
+{
+    stMappedFile* file = m_calloc(1, sizeof(stMappedFile));
+    if (NULL == file)
+        return NULL;
+
+#if defined(_WIN32)
+    file->file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL,
+        OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (INVALID_HANDLE_VALUE == file->file)
+    {
+        LOG_ERROR("Unable to open file [%s].", path);
+        m_free(file);
+        return NULL;
+    }
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file->file, &size))
+    {
+        LOG_ERROR("Unable to get the size of file [%s].", path);
+        CloseHandle(file->file);
+        m_free(file);
+        return NULL;
+    }
+    file->size = (size_t)size.QuadPart;
+
+    /* Empty files cannot be mapped */
+    if (0 == file->size)
+        return file;
+
+    file->mapping = CreateFileMappingA(file->file, NULL, PAGE_READONLY, 0, 0,
+        NULL);
+    if (file->mapping != NULL)
+        file->data = MapViewOfFile(file->mapping, FILE_MAP_READ, 0, 0, 0);
+    if (NULL == file->data)
+    {
+        LOG_ERROR("Unable to map file [%s].", path);
+        if (file->mapping != NULL)
+            CloseHandle(file->mapping);
+        CloseHandle(file->file);
+        m_free(file);
+        return NULL;
+    }
+#else
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        LOG_ERROR("Unable to open file [%s].", path);
+        m_free(file);
+        return NULL;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+    {
+        LOG_ERROR("Unable to get the size of file [%s].", path);
+        close(fd);
+        m_free(file);
+        return NULL;
+    }
+    file->size = (size_t)st.st_size;
+
+    /* Empty files cannot be mapped */
+    if (file->size > 0)
+    {
+        void* data = mmap(NULL, file->size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (MAP_FAILED == data)
+        {
+            LOG_ERROR("Unable to map file [%s].", path);
+            close(fd);
+            m_free(file);
+            return NULL;
+        }
+        file->data = data;
+    }
+
+    /* The mapping stays valid after the descriptor is closed */
+    close(fd);
+#endif
+    return file;
+}
+
+
+/**-----------------------------------------------------------------------------
+; @func mf_close
+;
+; @brief
+;   Unmaps the file and frees the mapped file object. Pointers returned by
+;   'mf_get_data' become invalid.
+;
+-----------------------------------------------------------------------------**/
+void mf_close(stMappedFile* file)
+{
+    if (NULL == file)
+        return;
+
+#if defined(_WIN32)
+    if (file->data != NULL)
+        UnmapViewOfFile(file->data);
+    if (file->mapping != NULL)
+        CloseHandle(file->mapping);
+    CloseHandle(file->file);
+#else
+    if (file->data != NULL)
+        munmap((void*)file->data, file->size);
+#endif
+    m_free(file);
+}
+
+
+/* Returns 1 if the file exists, without logging errors otherwise */
+int mf_exists(const char* path)
+{
+#if defined(_WIN32)
+    DWORD attributes = GetFileAttributesA(path);
+    return attributes != INVALID_FILE_ATTRIBUTES &&
+        !(attributes & FILE_ATTRIBUTE_DIRECTORY);
+#else
+    struct stat st;
+    return 0 == stat(path, &st) && S_ISREG(st.st_mode);
+#endif
+}
+
+
+const void* mf_get_data(const stMappedFile* file)
+{
+    return file->data;
+}
+
+
+size_t mf_get_size(const stMappedFile* file)
+{
+    return file->size;
+}
@@ -0,0 +1,38 @@
+/**-----------------------------------------------------------------------------
+; @file mapped_file.h
+;
+; @brief
+;   Read-only files mapped into memory. The contents of the file are read by
+;   the operating system on first access, without copying them through stdio
+;   buffers.
+;
+; @date   October 2021
+; @author Eph
+;
+-----------------------------------------------------------------------------**/
+
+
+
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+
+
+#include <stddef.h> /* size_t */
+
+
+
+typedef struct stMappedFile stMappedFile;
+
+
+
+stMappedFile* mf_open(const char* path);
+void mf_close(stMappedFile* file);
+int mf_exists(const char* path);
+
+const void* mf_get_data(const stMappedFile* file);
+size_t mf_get_size(const stMappedFile* file);
+
+
+
+#endif /* !MAPPED_FILE_H */
@@ -1,12 +1,50 @@
 #include <stdlib.h>
+#include <string.h> /* memcpy */
+#if defined(__linux__)
+#include <stdint.h>   /* uintptr_t */
+#include <sys/mman.h> /* madvise */
+#endif
 
 #include "memory.h"
+#include "thread.h"
 #include "../log.h"
 
 
 
-static int _alloc_calls_number = 0;
-static int _free_calls_number = 0;
+#define POOL_MIN_SIZE       (64 * 1024) /* Smaller blocks are not pooled      */
+#define POOL_CLASSES_COUNT  96          /* 4 classes per doubling of the size */
+#define POOL_NO_CLASS       (-1)
+#define HUGE_PAGE_SIZE      (2 * 1024 * 1024)
+
+/* Header of the blocks of the pool */
+typedef struct stPoolBlock
+{
+    size_t size;                        /* Usable size of the block           */
+    int class_idx;                      /* 'POOL_NO_CLASS' for small blocks   */
+    struct stPoolBlock* next;           /* Next free block of the same class  */
+}stPoolBlock;
+
+/* Keeps the data after the header aligned as 'malloc' does */
+#define POOL_HEADER_SIZE    ((sizeof(stPoolBlock) + 15) & ~(size_t)15)
+
+
+
+/* Updated atomically, blocks are allocated and freed by several threads */
+static volatile int _alloc_calls_number = 0;
+static volatile int _free_calls_number = 0;
+
+static stPoolBlock* _pool_free_blocks[POOL_CLASSES_COUNT];
+static size_t _pool_limit = 256 * 1024 * 1024;
+static int _pool_use_huge_pages = 0;
+static stMemoryPoolStats _pool_stats;
+/* Guards the pool, the loader thread of 'tb_build_async' decodes through it */
+static volatile int _pool_lock = 0;
+
+
+
+static int _get_pool_class(size_t size, size_t* out_class_size);
+static void _advise_huge_pages(void* ptr, size_t size);
+
 
 void* m_malloc(size_t size)
 {
@@ -16,7 +54,7 @@ void* m_malloc(size_t size)
     {
         LOG_ERROR("Failed to allocate %zu bytes.", size);
     }
-    _alloc_calls_number++;
+    th_atomic_add(&_alloc_calls_number, 1);
     return result;
 }
 
@@ -29,7 +67,7 @@ void* m_calloc(size_t count, size_t size)
     {
         LOG_ERROR("Failed to allocate %zu bytes.", count * size);
     }
-    _alloc_calls_number++;
+    th_atomic_add(&_alloc_calls_number, 1);
     return result;
 }
 
@@ -38,10 +76,15 @@ void* m_realloc(void* ptr, size_t new_size)
     void* result = NULL;
     //LOG_MSG("m_realloc [%p]", ptr);
     result = realloc(ptr, new_size);
-    if (NULL == ptr)
+    if (NULL == result)
     {
         LOG_ERROR("Failed to reallocate %zu bytes.", new_size);
     }
+    else if (NULL == ptr)
+    {
+        /* Reallocation of NULL is an allocation */
+        th_atomic_add(&_alloc_calls_number, 1);
+    }
     return result;
 }
 
@@ -49,15 +92,236 @@ void* m_realloc(void* ptr, size_t new_size)
 void m_free(void* ptr)
 {
     //LOG_MSG("m_free [%p]", ptr);
+    if (NULL == ptr)
+        return;
     free(ptr);
-    _free_calls_number++;
+    th_atomic_add(&_free_calls_number, 1);
 }
 
 
 // TODO: The next function is for debugging. Delete it.
 int m_get_unreleased(void)
 {
-    extern int _alloc_calls_number;
-    extern int _free_calls_number;
-    return _alloc_calls_number - _free_calls_number;
+    extern volatile int _alloc_calls_number;
+    extern volatile int _free_calls_number;
+    return th_atomic_load(&_alloc_calls_number) -
+        th_atomic_load(&_free_calls_number);
+}
+
+
+void* m_pool_alloc(size_t size)
+{
+    extern stPoolBlock* _pool_free_blocks[POOL_CLASSES_COUNT];
+    extern int _pool_use_huge_pages;
+    extern stMemoryPoolStats _pool_stats;
+    extern volatile int _pool_lock;
+
+    size_t block_size = size;
+    int class_idx = _get_pool_class(size, &block_size);
+
+    stPoolBlock* block = NULL;
+    th_lock(&_pool_lock);
+    if (class_idx != POOL_NO_CLASS && _pool_free_blocks[class_idx] != NULL)
+    {
+        block = _pool_free_blocks[class_idx];
+        _pool_free_blocks[class_idx] = block->next;
+        _pool_stats.hits++;
+        _pool_stats.cached_bytes -= block->size;
+        _pool_stats.cached_blocks--;
+    }
+    else if (class_idx != POOL_NO_CLASS)
+    {
+        _pool_stats.misses++;
+    }
+    int use_huge_pages = _pool_use_huge_pages;
+    th_unlock(&_pool_lock);
+
+    if (NULL == block)
+    {
+        block = m_malloc(POOL_HEADER_SIZE + block_size);
+        if (NULL == block)
+            return NULL;
+        block->size = block_size;
+        block->class_idx = class_idx;
+        if (use_huge_pages && block_size >= HUGE_PAGE_SIZE)
+            _advise_huge_pages(block, POOL_HEADER_SIZE + block_size);
+    }
+    block->next = NULL;
+    return (char*)block + POOL_HEADER_SIZE;
+}
+
+
+void* m_pool_realloc(void* ptr, size_t new_size)
+{
+    if (NULL == ptr)
+        return m_pool_alloc(new_size);
+    if (0 == new_size)
+    {
+        m_pool_free(ptr);
+        return NULL;
+    }
+
+    /* Blocks of a class have spare room up to the class size */
+    stPoolBlock* block = (stPoolBlock*)((char*)ptr - POOL_HEADER_SIZE);
+    if (new_size <= block->size)
+        return ptr;
+
+    void* new_ptr = m_pool_alloc(new_size);
+    if (NULL == new_ptr)
+        return NULL;
+    memcpy(new_ptr, ptr, block->size);
+    m_pool_free(ptr);
+    return new_ptr;
+}
+
+
+void m_pool_free(void* ptr)
+{
+    extern stPoolBlock* _pool_free_blocks[POOL_CLASSES_COUNT];
+    extern size_t _pool_limit;
+    extern stMemoryPoolStats _pool_stats;
+    extern volatile int _pool_lock;
+
+    if (NULL == ptr)
+        return;
+
+    stPoolBlock* block = (stPoolBlock*)((char*)ptr - POOL_HEADER_SIZE);
+    if (POOL_NO_CLASS == block->class_idx)
+    {
+        m_free(block);
+        return;
+    }
+
+    th_lock(&_pool_lock);
+    int is_cached = _pool_stats.cached_bytes + block->size <= _pool_limit;
+    if (is_cached)
+    {
+        block->next = _pool_free_blocks[block->class_idx];
+        _pool_free_blocks[block->class_idx] = block;
+        _pool_stats.cached_bytes += block->size;
+        _pool_stats.cached_blocks++;
+    }
+    th_unlock(&_pool_lock);
+
+    if (!is_cached)
+        m_free(block);
+}
+
+
+/* Returns the memory of all free blocks to the system */
+void m_pool_trim(void)
+{
+    extern stPoolBlock* _pool_free_blocks[POOL_CLASSES_COUNT];
+    extern stMemoryPoolStats _pool_stats;
+    extern volatile int _pool_lock;
+
+    /* Free blocks are taken out of the pool first and freed without the lock */
+    stPoolBlock* blocks = NULL;
+    th_lock(&_pool_lock);
+    for (int i = 0; i < POOL_CLASSES_COUNT; i++)
+    {
+        while (_pool_free_blocks[i] != NULL)
+        {
+            stPoolBlock* block = _pool_free_blocks[i];
+            _pool_free_blocks[i] = block->next;
+            block->next = blocks;
+            blocks = block;
+        }
+    }
+    _pool_stats.cached_bytes = 0;
+    _pool_stats.cached_blocks = 0;
+    th_unlock(&_pool_lock);
+
+    while (blocks != NULL)
+    {
+        stPoolBlock* block = blocks;
+        blocks = block->next;
+        m_free(block);
+    }
+}
+
+
+/* Sets the maximum size of the free blocks kept by the pool (256 MiB by
+   default). Blocks freed above the limit are returned to the system */
+void m_pool_set_limit(size_t bytes)
+{
+    extern size_t _pool_limit;
+    extern stMemoryPoolStats _pool_stats;
+    extern volatile int _pool_lock;
+
+    th_lock(&_pool_lock);
+    _pool_limit = bytes;
+    int is_over_limit = _pool_stats.cached_bytes > _pool_limit;
+    th_unlock(&_pool_lock);
+
+    if (is_over_limit)
+        m_pool_trim();
+}
+
+
+/* Asks the system to back new blocks of 2 MiB and larger with huge pages, so
+   touching them causes fewer page faults. Only transparent huge pages of
+   Linux are used; elsewhere this is a no-op, since large pages of Windows
+   require the "Lock pages in memory" privilege */
+void m_pool_use_huge_pages(int use)
+{
+    extern int _pool_use_huge_pages;
+    extern volatile int _pool_lock;
+
+    th_lock(&_pool_lock);
+    _pool_use_huge_pages = use;
+    th_unlock(&_pool_lock);
+}
+
+
+void m_pool_get_stats(stMemoryPoolStats* out_stats)
+{
+    extern stMemoryPoolStats _pool_stats;
+    extern volatile int _pool_lock;
+
+    th_lock(&_pool_lock);
+    *out_stats = _pool_stats;
+    th_unlock(&_pool_lock);
+}
+
+
+/* Rounds the size up to one of 4 classes between neighbouring powers of two,
+   so at most a quarter of a block is wasted */
+static int _get_pool_class(size_t size, size_t* out_class_size)
+{
+    if (size < POOL_MIN_SIZE)
+        return POOL_NO_CLASS;
+
+    size_t base = POOL_MIN_SIZE;
+    int doublings = 0;
+    while (size / 2 >= base)
+    {
+        base *= 2;
+        doublings++;
+    }
+
+    size_t step = base / 4;
+    size_t class_size = (size + step - 1) / step * step;
+    int class_idx = doublings * 4 + (int)((class_size - base) / step);
+    if (class_idx >= POOL_CLASSES_COUNT)
+        return POOL_NO_CLASS;
+
+    *out_class_size = class_size;
+    return class_idx;
+}
+
+
+static void _advise_huge_pages(void* ptr, size_t size)
+{
+#if defined(__linux__)
+    /* Only whole huge pages inside the block can be backed by them */
+    uintptr_t begin = ((uintptr_t)ptr + HUGE_PAGE_SIZE - 1) &
+        ~(uintptr_t)(HUGE_PAGE_SIZE - 1);
+    uintptr_t end = ((uintptr_t)ptr + size) & ~(uintptr_t)(HUGE_PAGE_SIZE - 1);
+    if (end > begin)
+        madvise((void*)begin, end - begin, MADV_HUGEPAGE);
+#else
+    (void)ptr;
+    (void)size;
+#endif
 }
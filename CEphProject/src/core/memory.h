@@ -15,4 +15,26 @@ void m_free(void* ptr);
 int m_get_unreleased(void);
 
 
+/* Pool of large blocks (pixel buffers of decoded images and the like). Freed
+   blocks are kept in size classes and reused by the next allocations of a
+   similar size instead of being returned to the system. Blocks of the pool
+   must be released with 'm_pool_free'. The pool may be used from several
+   threads. */
+typedef struct
+{
+    unsigned int hits;                  /* Allocations served from the pool   */
+    unsigned int misses;                /* Allocations served by the system   */
+    size_t cached_bytes;                /* Free blocks kept for reuse         */
+    int cached_blocks;
+}stMemoryPoolStats;
+
+void* m_pool_alloc(size_t size);
+void* m_pool_realloc(void* ptr, size_t new_size);
+void m_pool_free(void* ptr);
+void m_pool_trim(void);
+void m_pool_set_limit(size_t bytes);
+void m_pool_use_huge_pages(int use);
+void m_pool_get_stats(stMemoryPoolStats* out_stats);
+
+
 #endif /* !MEMORY_H */
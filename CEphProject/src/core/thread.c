@@ -0,0 +1,180 @@
+/**-----------------------------------------------------------------------------
+; @file thread.c
+;
+; @brief
+;   The file implements the functionality of the 'thread' module.
+;
+;   th - thread
+;
+; @date   October 2021
+; @author Eph
+;
+-----------------------------------------------------------------------------**/
+
+
+
+/** @includes ----------------------------------------------------------------*/
+#if defined(_WIN32)
+#include <windows.h>
+#include <process.h> /* _beginthreadex */
+#else
+#include <pthread.h>
+#include <sched.h> /* sched_yield */
+#endif
+
+#include "thread.h"
+#include "memory.h"
+#include "../log.h"
+
+
+
+/** @types -------------------------------------------------------------------*/
+
+typedef struct stThread
+{
+#if defined(_WIN32)
+    HANDLE handle;
+#else
+    pthread_t handle;
+#endif
+    void(*func_ptr)(void*);
+    void* arg;
+}stThread;
+
+
+
+/** @internal_prototypes -----------------------------------------------------*/
+#if defined(_WIN32)
+static unsigned int __stdcall _thread_entry(void* thread_ptr);
+#else
+static void* _thread_entry(void* thread_ptr);
+#endif
+
+
+
+/** @functions ---------------------------------------------------------------*/
+
+/**-----------------------------------------------------------------------------
+; @func th_create
+;
+; @brief
+;   Starts a thread that calls 'func_ptr(arg)'.
+;
+; @return
+;   Thread object that must be passed to 'th_join' or NULL on failure.
+;
+-----------------------------------------------------------------------------**/
+stThread* th_create(void(*func_ptr)(void*), void* arg)
+{
+    stThread* thread = m_malloc(sizeof(stThread));
+    if (NULL == thread)
+        return NULL;
+    thread->func_ptr = func_ptr;
+    thread->arg = arg;
+
+#if defined(_WIN32)
+    thread->handle = (HANDLE)_beginthreadex(NULL, 0, _thread_entry, thread, 0,
+        NULL);
+    if (0 == thread->handle)
+#else
+    if (pthread_create(&thread->handle, NULL, _thread_entry, thread) != 0)
+#endif
+    {
+        LOG_ERROR("Unable to create a thread.");
+        m_free(thread);
+        return NULL;
+    }
+    return thread;
+}
+
+
+/**-----------------------------------------------------------------------------
+; @func th_join
+;
+; @brief
+;   Waits for the thread to finish and frees the thread object.
+;
+-----------------------------------------------------------------------------**/
+void th_join(stThread* thread)
+{
+    if (NULL == thread)
+        return;
+
+#if defined(_WIN32)
+    WaitForSingleObject(thread->handle, INFINITE);
+    CloseHandle(thread->handle);
+#else
+    pthread_join(thread->handle, NULL);
+#endif
+    m_free(thread);
+}
+
+
+int th_atomic_load(volatile int* value)
+{
+#if defined(_WIN32)
+    return InterlockedCompareExchange((volatile long*)value, 0, 0);
+#else
+    return __atomic_load_n(value, __ATOMIC_SEQ_CST);
+#endif
+}
+
+
+void th_atomic_store(volatile int* value, int new_value)
+{
+#if defined(_WIN32)
+    InterlockedExchange((volatile long*)value, new_value);
+#else
+    __atomic_store_n(value, new_value, __ATOMIC_SEQ_CST);
+#endif
+}
+
+
+void th_atomic_add(volatile int* value, int addend)
+{
+#if defined(_WIN32)
+    InterlockedExchangeAdd((volatile long*)value, addend);
+#else
+    __atomic_fetch_add(value, addend, __ATOMIC_SEQ_CST);
+#endif
+}
+
+
+void th_lock(volatile int* lock)
+{
+#if defined(_WIN32)
+    while (InterlockedCompareExchange((volatile long*)lock, 1, 0) != 0)
+        SwitchToThread();
+#else
+    int unlocked = 0;
+    while (!__atomic_compare_exchange_n(lock, &unlocked, 1, 0,
+        __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+    {
+        unlocked = 0;
+        sched_yield();
+    }
+#endif
+}
+
+
+void th_unlock(volatile int* lock)
+{
+    th_atomic_store(lock, 0);
+}
+
+
+#if defined(_WIN32)
+static unsigned int __stdcall _thread_entry(void* thread_ptr)
+{
+    stThread* thread = thread_ptr;
+    thread->func_ptr(thread->arg);
+    return 0;
+}
+#else
+static void* _thread_entry(void* thread_ptr)
+{
+    stThread* thread = thread_ptr;
+    thread->func_ptr(thread->arg);
+    return NULL;
+}
+#endif
@@ -0,0 +1,37 @@
+/**-----------------------------------------------------------------------------
+; @file thread.h
+;
+; @brief
+;   Thin wrapper over the threads of the operating system.
+;
+; @date   October 2021
+; @author Eph
+;
+-----------------------------------------------------------------------------**/
+
+
+
+#ifndef THREAD_H
+#define THREAD_H
+
+
+
+typedef struct stThread stThread;
+
+
+
+stThread* th_create(void(*func_ptr)(void*), void* arg);
+void th_join(stThread* thread);
+
+int th_atomic_load(volatile int* value);
+void th_atomic_store(volatile int* value, int new_value);
+void th_atomic_add(volatile int* value, int addend);
+
+/* Spin lock over an int that is 0 while unlocked. Meant for short critical
+   sections only */
+void th_lock(volatile int* lock);
+void th_unlock(volatile int* lock);
+
+
+
+#endif /* !THREAD_H */
@@ -8,6 +8,8 @@
 
 /** @static_data -------------------------------------------------------------*/
 static GLFWwindow* _window_ptr = NULL;
+static GLFWwindow* _loader_window_ptr = NULL; /* Hidden, shares objects with  */
+                                              /* '_window_ptr'                */
 static int _width;
 static int _height;
 
@@ -23,6 +25,7 @@ int window_init(const char* title, int width, int height, int is_fullscreen,
     int swap_interval)
 {
     extern GLFWwindow* _window_ptr;
+    extern GLFWwindow* _loader_window_ptr;
     extern int _width;
     extern int _height;
 
@@ -46,7 +49,7 @@ int window_init(const char* title, int width, int height, int is_fullscreen,
     if (width > vidmode_ptr->width || height > vidmode_ptr->height)
     {
         LOG_ERROR("Invalid window size %dx%d.", width, height);
-        glfwTerminate();
+        window_terminate();
         return -1;
     }
 
@@ -55,8 +58,21 @@ int window_init(const char* title, int width, int height, int is_fullscreen,
     /* Create the window */
     if (NULL == _window_ptr)
     {
+        window_terminate();
         return -1;
     }
+
+    /* Create an invisible window whose context shares textures and buffers
+       with the main one, so they can be loaded on a background thread. The
+       window is optional, loading falls back to the main thread without it */
+    glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+    _loader_window_ptr = glfwCreateWindow(1, 1, title, NULL, _window_ptr);
+    glfwWindowHint(GLFW_VISIBLE, GLFW_TRUE);
+    if (NULL == _loader_window_ptr)
+    {
+        LOG_WARNING("Unable to create a shared context for loading.");
+    }
+
     glfwMakeContextCurrent(_window_ptr);
 
     /* Set the number of screen updates to wait from the time */
@@ -67,6 +83,7 @@ int window_init(const char* title, int width, int height, int is_fullscreen,
     /* Initialize GLAD */
     if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress))
     {
+        window_terminate();
         return -1;
     }
     GL_CALL(glViewport(0, 0, width, height));
@@ -82,12 +99,50 @@ int window_init(const char* title, int width, int height, int is_fullscreen,
     return 0;
 }
 
+/**-----------------------------------------------------------------------------
+; @func window_terminate
+;
+; @brief
+;   Destroys the windows created by 'window_init' and terminates GLFW. The
+;   window pointers are cleared, so no module uses the freed windows.
+;
+-----------------------------------------------------------------------------**/
+void window_terminate(void)
+{
+    extern GLFWwindow* _window_ptr;
+    extern GLFWwindow* _loader_window_ptr;
+
+    if (_loader_window_ptr != NULL)
+        glfwDestroyWindow(_loader_window_ptr);
+    if (_window_ptr != NULL)
+        glfwDestroyWindow(_window_ptr);
+    _loader_window_ptr = NULL;
+    _window_ptr = NULL;
+    glfwTerminate();
+}
+
+
 void* window_get_glfw_window_ptr(void)
 {
     return _window_ptr;
 }
 
 
+/**-----------------------------------------------------------------------------
+; @func window_get_glfw_loader_window_ptr
+;
+; @brief
+;   Returns the hidden window created by 'window_init' whose OpenGL context
+;   shares objects with the main window. Its context can be made current on
+;   one background thread at a time. NULL if the window was not created.
+;
+-----------------------------------------------------------------------------**/
+void* window_get_glfw_loader_window_ptr(void)
+{
+    return _loader_window_ptr;
+}
+
+
 int window_get_width(void)
 {
     return _width;
@@ -103,7 +158,7 @@ int window_get_height(void)
 static void _glfw_error_callback(int code, const char* message)
 {
     LOG_ERROR("%d. %s.", code, message);
-    glfwTerminate();
+    window_terminate();
 }
 
 
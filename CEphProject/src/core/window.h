@@ -5,7 +5,9 @@
 
 int window_init(const char* title, int width, int height, int is_fullscreen,
     int swap_interval);
+void window_terminate(void);
 void* window_get_glfw_window_ptr(void);
+void* window_get_glfw_loader_window_ptr(void);
 int window_get_width(void);
 int window_get_height(void);
 
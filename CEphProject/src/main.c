@@ -14,25 +14,33 @@
 
 #pragma warning (disable: 4996)
 #include <cglm/cglm.h>
+#include <string.h> /* strcmp */
 
 #include "core/window.h"
 #include "core/loop.h"
+#include "core/memory.h"
+#include "core/asset_pack.h"
 #include "core/graphics/shader.h"
+#include "core/graphics/image_cooker.h"
+#include "core/graphics/sprite_batch.h"
 #include "core/graphics/texture/texture_builder.h"
+#include "core/graphics/texture/texture_residency.h"
+#include "core/graphics/texture/texture_units.h"
 #include "core/graphics/vertex_array.h"
 
 
 
-stTexture* t1 = NULL;
-stTexture* t2 = NULL;
-stTexture* t3 = NULL;
-stTexture* t4 = NULL;
-stTexture* t5 = NULL;
-stTexture* t6 = NULL;
-stTexture* t7 = NULL;
-stTexture* t8 = NULL;
-stTexture* t9 = NULL;
+tb_handle t1 = TB_INVALID_HANDLE;
+tb_handle t2 = TB_INVALID_HANDLE;
+tb_handle t3 = TB_INVALID_HANDLE;
+tb_handle t4 = TB_INVALID_HANDLE;
+tb_handle t5 = TB_INVALID_HANDLE;
+tb_handle t6 = TB_INVALID_HANDLE;
+tb_handle t7 = TB_INVALID_HANDLE;
+tb_handle t8 = TB_INVALID_HANDLE;
+tb_handle t9 = TB_INVALID_HANDLE;
 
+unsigned int va = 0;
 stIndicesInfo* ii1 = NULL;
 stIndicesInfo* ii2 = NULL;
 stIndicesInfo* ii3 = NULL;
@@ -49,24 +57,48 @@ stIndicesInfo* ii3 = NULL;
 -----------------------------------------------------------------------------**/
 void loop_iteration_callback(void)
 {
+    const stTextureTable* textures = tb_get_texture_table();
     {
-        vec2 pos = { 000.0f, 000.0f };
-        shader_set_uf_fvec2(3, "uf_model_pos", pos);
-        vec2 size = { 150.0f, 150.0f };
-        shader_set_uf_fvec2(3, "uf_model_size", size);
-        shader_set_uf_int(3, "uf_txd_array_z_offset", t1->texture_info_ptr->z_offset);
-        shader_set_uf_int(3, "uf_txd_unit", t1->texture_info_ptr->unit);
-        glDrawElements(ii1->mode, ii1->count, GL_UNSIGNED_INT, ii1->offset);
+        /* Both shapes are drawn with a single multi-draw call. Their data
+           stays in video memory and is uploaded again only if it changes */
+        tu_begin_batch();
+        stVaObjectData data1 = { { 000.0f, 000.0f }, { 150.0f, 150.0f },
+            textures->z_offsets[t1], tu_bind(textures->array_ids[t1]) };
+        stVaObjectData data2 = { { 000.0f, 160.0f }, { 150.0f, 150.0f },
+            textures->z_offsets[t2], tu_bind(textures->array_ids[t2]) };
+        va_shape_set_data(va, ii1, &data1);
+        va_shape_set_data(va, ii2, &data2);
+        va_draw_all(va);
     }
+
+    /* The textures of groups 1 and 2 are drawn with a single draw call */
+    tb_handle sprites[] = { t4, t5, t6, t7, t8, t9 };
+    for (int i = 0; i < 6; i++)
     {
-        vec2 pos = { 000.0f, 160.0f };
-        shader_set_uf_fvec2(3, "uf_model_pos", pos);
-        vec2 size = { 150.0f, 150.0f };
-        shader_set_uf_fvec2(3, "uf_model_size", size);
-        shader_set_uf_int(3, "uf_txd_array_z_offset", t2->texture_info_ptr->z_offset);
-        shader_set_uf_int(3, "uf_txd_unit", t2->texture_info_ptr->unit);
-        glDrawElements(ii2->mode, ii2->count, GL_UNSIGNED_INT, ii2->offset);
+        vec2 pos = { 160.0f + (i % 3) * 130.0f, 000.0f + (i / 3) * 130.0f };
+        vec2 size = { 120.0f, 120.0f };
+        sb_draw(sprites[i], pos, size);
     }
+    sb_flush();
+}
+
+
+/**-----------------------------------------------------------------------------
+; @func shutdown_callback
+;
+; @brief
+;   This function is called after the last tick of the main loop, before the
+;   OpenGL context is destroyed.
+;
+-----------------------------------------------------------------------------**/
+void shutdown_callback(void)
+{
+    /* De-allocate all OpenGL resources */
+    va_destroy(va);
+    sb_destroy();
+    tu_destroy();
+    tb_destroy();
+    tr_destroy();
 }
 
 
@@ -80,33 +112,49 @@ void loop_iteration_callback(void)
 #ifndef TEST_RUN
 int main(int argc, char* argv[], char* envp[])
 {
+    /* Convert the images of a directory to cooked images and exit:
+       '--cook <directory> [--mips]' */
+    if (argc >= 3 && 0 == strcmp(argv[1], "--cook"))
+    {
+        int with_mips = (argc >= 4 && 0 == strcmp(argv[3], "--mips"));
+        return (0 == ic_cook_directory(argv[2], with_mips)) ? 0 : 1;
+    }
+    /* Pack all files of a directory into a single file and exit:
+       '--pack <pack> <directory>' */
+    if (argc >= 4 && 0 == strcmp(argv[1], "--pack"))
+        return (0 == ap_create(argv[2], argv[3])) ? 0 : 1;
+
+    /* Resources are taken from the pack if there is one */
+    ap_open(AP_DEFAULT_PATH);
+
     window_init("CEphProject", 800, 600, 0, 0);
 
     unsigned int shader_program = shader_create_program(
-        "resources/shaders/txd_array_vertex.shader",
-        "resources/shaders/txd_array_fragment.shader");
+        "resources/shaders/txd_array_indirect_vertex.shader",
+        "resources/shaders/txd_array_indirect_fragment.shader");
 
     shader_use_program(shader_program);
 
     /* The next 3 textures will be placed on any free space of any layer of any
        2d texture array */
-    t1 = tb_add_texture(TB_NO_GROUP, "resources/img/512x512_transp.png", 0, 0, 512, 512);
-    t2 = tb_add_texture(TB_NO_GROUP, "resources/img/256x256.jpg", 0, 0, 256, 256);
-    t3 = tb_add_texture(TB_NO_GROUP, "resources/img/256x256.jpg", 128, 128, 128, 128);
+    t1 = tb_add_texture(TB_NO_GROUP, "resources/img/512x512_transp.png", 0, 0, 512, 512, TB_FORMAT_RGBA8);
+    t2 = tb_add_texture(TB_NO_GROUP, "resources/img/256x256.jpg", 0, 0, 256, 256, TB_FORMAT_RGBA8);
+    t3 = tb_add_texture(TB_NO_GROUP, "resources/img/256x256.jpg", 128, 128, 128, 128, TB_FORMAT_RGBA8);
     /* The next 3 textures are guaranteed to be placed on the same layer */
-    t4 = tb_add_texture(1, "resources/img/512x512_transp.png", 0, 0, 256, 256);
-    t5 = tb_add_texture(1, "resources/img/512x512_transp.png", 128, 0, 256, 256);
-    t6 = tb_add_texture(1, "resources/img/512x512_transp.png", 256, 0, 256, 256);
+    t4 = tb_add_texture(1, "resources/img/512x512_transp.png", 0, 0, 256, 256, TB_FORMAT_RGBA8);
+    t5 = tb_add_texture(1, "resources/img/512x512_transp.png", 128, 0, 256, 256, TB_FORMAT_RGBA8);
+    t6 = tb_add_texture(1, "resources/img/512x512_transp.png", 256, 0, 256, 256, TB_FORMAT_RGBA8);
     /* The next 3 textures are guaranteed to be placed on the same layer */
-    t7 = tb_add_texture(2, "resources/img/512x512_transp.png", 0, 256, 256, 256);
-    t8 = tb_add_texture(2, "resources/img/512x512_transp.png", 128, 256, 256, 256);
-    t9 = tb_add_texture(2, "resources/img/512x512_transp.png", 256, 256, 256, 256);
+    t7 = tb_add_texture(2, "resources/img/512x512_transp.png", 0, 256, 256, 256, TB_FORMAT_RGBA8);
+    t8 = tb_add_texture(2, "resources/img/512x512_transp.png", 128, 256, 256, 256, TB_FORMAT_RGBA8);
+    t9 = tb_add_texture(2, "resources/img/512x512_transp.png", 256, 256, 256, 256, TB_FORMAT_RGBA8);
     /* The next 100 textures will be placed on any free space of any layer of
        any 2d texture array */
     //for (int i = 0; i < 100; i++)
     //{
     //    tb_add_texture(0, "resources/img/512x512_transp.png",
-    //        rand() % 449, rand() % 449, 1 + rand() % 62, 1 + rand() % 62);
+    //        rand() % 449, rand() % 449, 1 + rand() % 62, 1 + rand() % 62,
+    //        TB_FORMAT_RGBA8);
     //}
     tb_build();
 
@@ -140,32 +188,38 @@ int main(int argc, char* argv[], char* envp[])
         0.0f, 1.0f                      /* Top left                           */
     };
 
-    unsigned int va = va_create();
+    /* All vertices are in [0, 1], 16-bit positions are enough */
+    va = va_create(VA_FORMAT_SHORT);
     ii1 = va_shape_create(va);
     ii2 = va_shape_create(va);
     va_shape_add_textured_rect(va, ii1, vertices, txd_vertices);
 
-    va_shape_add_textured_rect(va, ii2, vertices2, t1->vertices);
-    va_shape_add_textured_rect(va, ii2, vertices3, t3->vertices);
+    const stTextureTable* textures = tb_get_texture_table();
+    va_shape_add_textured_rect(va, ii2, vertices2, textures->vertices[t1]);
+    va_shape_add_textured_rect(va, ii2, vertices3, textures->vertices[t3]);
     va_build(va);
 
     mat4 projection = GLM_MAT4_IDENTITY_INIT;
     glm_ortho(0.0f, (float)window_get_width(), (float)window_get_height(),
         0.0f, -0.1f, 0.1f, projection);
     shader_set_uf_fmat4(shader_program, "uf_projection", projection);
-    shader_set_uf_int(shader_program, "uf_txd_array_z_offset", 0);
-    shader_set_uf_int(shader_program, "uf_txd_unit", 0);
-    vec2 pos = { 10.0f, 10.0f };
-    shader_set_uf_fvec2(shader_program, "uf_model_pos", pos);
-    vec2 size = { 512.0f, 512.0f };
-    shader_set_uf_fvec2(shader_program, "uf_model_size", size);
 
+    /* Draws select their texture unit from the sampler array */
+    int units[TU_MAX_UNITS];
+    for (int i = 0; i < TU_MAX_UNITS; i++)
+        units[i] = i;
+    shader_set_uf_int_array(shader_program, "uf_txd_units", TU_MAX_UNITS,
+        units);
 
-    start_loop(loop_iteration_callback);
+    sb_init();
+    sb_set_projection(projection);
 
-    /* De-allocate all resources */
-    va_destroy(va);
-    tb_destroy();
+
+    start_loop(loop_iteration_callback, shutdown_callback);
+
+    /* De-allocate all remaining resources */
+    ap_close();
+    m_pool_trim();
     //glDeleteVertexArrays(1, &vertex_array);
     //glDeleteBuffers(1, &vertex_buffer);
     //glDeleteBuffers(1, &txd_vertex_buffer);